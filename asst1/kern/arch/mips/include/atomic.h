@@ -0,0 +1,75 @@
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+/*
+ * Machine-dependent part of atomic.h: the read-modify-write
+ * operations, with LL/SC. See the comments on LL/SC in spinlock.h.
+ *
+ * These don't order anything; atomic.h puts the memory barriers
+ * around them.
+ */
+
+ATOMIC_INLINE
+int atomic_data_fetchadd(volatile int *p, int n);
+ATOMIC_INLINE
+int atomic_data_cas(volatile int *p, int old, int new);
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Fetch and add. Load *P, add N, and try to store the sum; if the SC
+ * fails, start over. Return what we loaded.
+ */
+ATOMIC_INLINE
+int
+atomic_data_fetchadd(volatile int *p, int n)
+{
+	int x, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"addu %1, %0, %3;"	/*   tmp = x + n */
+		"sc %1, 0(%2);"		/*   *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/*   if (!tmp) try again */
+		"nop;"			/*   (delay slot) */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (tmp)
+		: "r" (p), "r" (n)
+		: "memory");
+	return x;
+}
+
+/*
+ * Compare and swap. Load *P; if it isn't OLD, stop; otherwise try to
+ * store NEW, and if the SC fails (someone else stored in between, or
+ * we took an interrupt) go back and load it again.
+ */
+ATOMIC_INLINE
+int
+atomic_data_cas(volatile int *p, int old, int new)
+{
+	int x, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"bne %0, %3, 2f;"	/*   if (x != old) give up */
+		"move %1, %4;"		/*   tmp = new (delay slot) */
+		"sc %1, 0(%2);"		/*   *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/*   if (!tmp) try again */
+		"nop;"			/*   (delay slot) */
+		"2:"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (tmp)
+		: "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return x;
+}
+
+
+#endif /* _MIPS_ATOMIC_H_ */
@@ -4,23 +4,41 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <test.h>
+#include <cpu.h>
+#include <current.h>
 #include <thread.h>
 #include <synch.h>
+#include <atomic.h>
 
 
 /*
  * Declare the counter variable that all threads increment or decrement
  * via the interface provided here.
  *
- * Declaring it "volatile" instructs the compiler to always (re)read the
- * variable from memory and not to optimise by keeping the value in a process 
- * register and avoid memory references.
- *
- * NOTE: The volatile declaration is actually not needed for the provided code 
- * as the variable is only loaded once in each function.
+ * The counter is split into one cell per cpu, and each thread updates
+ * the cell of the cpu it's running on, so cpus don't fight over one
+ * memory word. Each cell is aligned to the start of a cache line, which
+ * also pads it out to a whole one, so they don't share a cache line
+ * either. The value is the sum of the cells; it's only read once all
+ * the updates are done, so the sum is exact. A thread can move to
+ * another cpu between looking up its cell and updating it, so the
+ * cells are still atomic_t, but that's rare enough that they stay
+ * uncontended.
  */
 
-static volatile int the_counter;
+#define COUNTER_CELLS   32      /* more than we'll have cpus */
+#define COUNTER_LINE    64      /* cache line size */
+
+static struct counter_cell {
+        atomic_t cc_value;
+} __attribute__((__aligned__(COUNTER_LINE))) the_counter[COUNTER_CELLS];
+
+static
+atomic_t *
+counter_mycell(void)
+{
+        return &the_counter[curcpu->c_number % COUNTER_CELLS].cc_value;
+}
 
 /*
  * ********************************************************************
@@ -28,38 +46,30 @@ static volatile int the_counter;
  * ********************************************************************
  */
 
-struct lock* my_lock;
-
 void counter_increment(void)
 {
-        lock_acquire(my_lock);
-        the_counter = the_counter + 1;
-        lock_release(my_lock);
+        atomic_add(counter_mycell(), 1);
 }
 
 void counter_decrement(void)
 {
-        lock_acquire(my_lock);
-        the_counter = the_counter - 1;
-        lock_release(my_lock);
+        atomic_sub(counter_mycell(), 1);
 }
 
 int counter_initialise(int val)
 {
+        unsigned i;
 
-        the_counter = val;
+        atomic_set(&the_counter[0].cc_value, val);
+        for (i = 1; i < COUNTER_CELLS; i++) {
+                atomic_set(&the_counter[i].cc_value, 0);
+        }
 
         /*
          * ********************************************************************
          * INSERT ANY INITIALISATION CODE YOU REQUIRE HERE
          * ********************************************************************
          */
-        
-        my_lock = lock_create("my_lock");
-
-        if (my_lock == NULL){
-                return ENOMEM;
-        }
 
         /*
          * Return 0 to indicate success
@@ -74,14 +84,19 @@ int counter_initialise(int val)
 
 int counter_read_and_destroy(void)
 {
+        unsigned i;
+        int sum;
+
         /*
          * **********************************************************************
          * INSERT ANY CLEANUP CODE YOU REQUIRE HERE
          * **********************************************************************
          */
-    
-        lock_destroy(my_lock);
 
-        return the_counter;
+        sum = 0;
+        for (i = 0; i < COUNTER_CELLS; i++) {
+                sum += atomic_read(&the_counter[i].cc_value);
+        }
+        return sum;
 }
 
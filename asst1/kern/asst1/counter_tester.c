@@ -1,10 +1,12 @@
 #include "opt-synchprobs.h"
 #include "counter.h"
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <test.h>
 #include <thread.h>
 #include <synch.h>
+#include <bench.h>
 
 /* THIS FILE WILL BE REPLACED IN AUTOMARKING SO YOU SHOULD NOT RELY ON ANY CHANGES
    YOU MAKE HERE FOR PERSONAL TESTING */
@@ -127,3 +129,84 @@ int counter_tester (int data1, char **data2)
         return 0;
 }
 
+
+
+/*
+ * Throughput benchmark.
+ *
+ * Run the incrementer threads with 1, 2, 4, ... up to MAXTHREADS
+ * threads, each doing INCS increments, and report on each run (see
+ * bench.h). The count must still come out exact.
+ *
+ * Usage: 1ab [maxthreads [incs]]
+ */
+
+static unsigned bench_incs;
+
+static void bench_thread(void *unusedpointer, unsigned long threadnumber)
+{
+        unsigned i;
+
+        (void) unusedpointer;
+        (void) threadnumber;
+
+        for (i = 0; i < bench_incs; i++) {
+                counter_increment();
+        }
+        V(finished);
+}
+
+int counter_bench(int nargs, char **args)
+{
+        struct bench b;
+        char name[32];
+        unsigned long long nops;
+        unsigned params[2] = { 16, 10000 };
+        unsigned nthreads, i;
+        int error, final_count;
+        bool ok = true;
+
+        if (bench_args(nargs, args, params, 2)) {
+                kprintf("Usage: 1ab [maxthreads [incs]]\n");
+                return EINVAL;
+        }
+        bench_incs = params[1];
+
+        finished = sem_create("finished", 0);
+        if (finished == NULL) {
+                panic("counter_bench: sem create failed");
+        }
+
+        for (nthreads = 1; nthreads <= params[0]; nthreads *= 2) {
+                error = counter_initialise(0);
+                if (error) {
+                        panic("counter_bench: initialise counter failed");
+                }
+
+                bench_start(&b);
+                for (i = 0; i < nthreads; i++) {
+                        error = thread_fork("bench thread", NULL,
+                                            &bench_thread, NULL, i);
+                        if (error) {
+                                panic("bench thread: thread_fork failed: %s\n",
+                                      strerror(error));
+                        }
+                }
+                for (i = 0; i < nthreads; i++) {
+                        P(finished);
+                }
+                nops = (unsigned long long)nthreads * bench_incs;
+                snprintf(name, sizeof(name), "%u threads", nthreads);
+                bench_report(&b, name, nops);
+
+                final_count = counter_read_and_destroy();
+                if ((unsigned long long)final_count != nops) {
+                        kprintf("*** Error! Final count %d, expected %llu\n",
+                                final_count, nops);
+                        ok = false;
+                }
+        }
+
+        sem_destroy(finished);
+        return bench_done("Counter benchmark", ok);
+}
@@ -1,16 +1,22 @@
 #include "opt-synchprobs.h"
 #include "kitchen.h"
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <test.h>
 #include <thread.h>
 #include <synch.h>
+#include <bench.h>
 
 /* THIS FILE WILL BE REPLACED IN AUTOMARKING SO YOU SHOULD NOT RELY ON
    ANY CHANGES YOU MAKE HERE FOR PERSONAL TESTING */
 
 #define NUM_DINERS 20
 #define NUM_SERVES 10
+
+/* the numbers for this run; the benchmark changes these */
+static int num_diners = NUM_DINERS;
+static int num_serves = NUM_SERVES;
 /* 
  * We use a semaphore to wait for threads to finish
  */
@@ -60,7 +66,7 @@ static void cooking_thread(void * unusedpointer, unsigned long threadnumber)
         int i;
 
 
-        int pots_to_cook = (NUM_DINERS * NUM_SERVES + POTSIZE_IN_SERVES - 1) / POTSIZE_IN_SERVES; 
+        int pots_to_cook = (num_diners * num_serves + POTSIZE_IN_SERVES - 1) / POTSIZE_IN_SERVES; 
 
         for (i = 0; i < pots_to_cook; i++) {
                 do_cooking();
@@ -82,7 +88,7 @@ static void dining_thread(void * unusedpointer, unsigned long threadnumber)
 
         int i;
 
-        for (i = 0; i <  NUM_SERVES; i++) {
+        for (i = 0; i < num_serves; i++) {
                 fill_bowl();
                 eat();
         }                
@@ -107,6 +113,8 @@ int kitchen_tester (int data1, char **data2)
 
         served = 0;
         servings_remaining = 0;
+        num_diners = NUM_DINERS;
+        num_serves = NUM_SERVES;
         
         /* create a semaphore to allow main thread to wait on workers */
         
@@ -181,3 +189,67 @@ int kitchen_tester (int data1, char **data2)
         return 0;
 }
 
+
+/*
+ * Benchmark: as above, with DINERS diners eating SERVES serves each,
+ * reporting servings per second.
+ *
+ * Usage: 1db [diners [serves]]
+ */
+int kitchen_bench(int nargs, char **args)
+{
+        unsigned params[2] = { NUM_DINERS, NUM_SERVES };
+        struct bench b;
+        char name[32];
+        int index, error;
+        bool ok;
+
+        if (bench_args(nargs, args, params, 2)) {
+                kprintf("Usage: 1db [diners [serves]]\n");
+                return EINVAL;
+        }
+        num_diners = params[0];
+        num_serves = params[1];
+        served = 0;
+        servings_remaining = 0;
+
+        finished = sem_create("finished", 0);
+        if (finished == NULL) {
+                panic("kitchen_bench: sem create failed");
+        }
+        error = initialise_kitchen();
+        if (error) {
+                panic("kitchen_bench: initialise_kitchen failed");
+        }
+
+        bench_start(&b);
+        for (index = 0; index < num_diners; index++) {
+                error = thread_fork("dining thread", NULL, &dining_thread, NULL, index);
+                if (error) {
+                        panic("dining thread: thread_fork failed: %s\n",
+                              strerror(error));
+                }
+        }
+        error = thread_fork("cook thread", NULL, &cooking_thread, NULL, 0);
+        if (error) {
+                panic("cooking thread: thread_fork failed: %s\n",
+                      strerror(error));
+        }
+        for (index = 0; index < num_diners + 1; index++) {
+                P(finished);
+        }
+        snprintf(name, sizeof(name), "%d diners", num_diners);
+        bench_report(&b, name, (unsigned long long)num_diners * num_serves);
+
+        cleanup_kitchen();
+        ok = served == num_diners * num_serves;
+        if (!ok) {
+                kprintf("*** Error! Served %d (expected %d)\n",
+                        served, num_diners * num_serves);
+        }
+
+        num_diners = NUM_DINERS;
+        num_serves = NUM_SERVES;
+        sem_destroy(finished);
+        return bench_done("Kitchen benchmark", ok);
+}
@@ -2,6 +2,8 @@
 #include <types.h>
 #include <lib.h>
 #include <synch.h>
+#include <atomic.h>
+#include <membar.h>
 #include "producerconsumer.h"
 
 /* Declare any variables you need here to keep track of and
@@ -13,17 +15,123 @@
    prior to blocking
 */
 
-#define BUFFLEN (BUFFER_SIZE + 1)
+/*
+ * Producers only touch head and consumers only touch tail, so each
+ * side has its own lock and the two don't contend. What they share
+ * is the number of items in the buffer, which is atomic: a producer
+ * fills slots and then adds to it, a consumer empties slots and then
+ * subtracts, and the full barrier in each makes the slots visible
+ * before the count says so. Reading the count is a plain load, so each
+ * side also needs a barrier after reading it: a consumer must not read
+ * slots before it has seen the count that covers them
+ * (membar_load_load), nor a producer refill slots before it has seen
+ * them emptied (membar_any_store).
+ *
+ * A side that has to wait counts itself in *_waiting (also atomic,
+ * for the barrier) and checks the count again before sleeping; the
+ * other side checks *_waiting after changing the count, and only
+ * takes the sleeper's lock to wake it if someone is there. One of the
+ * two always sees the other, so no wakeup is lost.
+ */
+
+data_item_t ** item_buffer;
+static unsigned buffer_size = BUFFER_SIZE;
+
+static struct lock *head_lock;          /* producers */
+static struct cv *not_full;
+static unsigned head;
+static atomic_t producers_waiting;
+
+static struct lock *tail_lock;          /* consumers */
+static struct cv *not_empty;
+static unsigned tail;
+static atomic_t consumers_waiting;
+
+static atomic_t count;                  /* items in the buffer */
+
+/*
+ * Wake everyone on CV (under LOCK) if WAITING says anyone is there.
+ */
+static void wake_waiters(atomic_t *waiting, struct lock *lock, struct cv *cv)
+{
+        if (atomic_read(waiting) > 0) {
+                lock_acquire(lock);
+                cv_broadcast(cv, lock);
+                lock_release(lock);
+        }
+}
 
-data_item_t * item_buffer[BUFFER_SIZE+1];
+/* consumer_receive_batch() takes up to MAX items out of the buffer
+   into OUT, waiting until there is at least one, and returns how
+   many it took. */
 
-struct semaphore *mutex;
+unsigned consumer_receive_batch(data_item_t **out, unsigned max)
+{
+        unsigned n, i;
+
+        KASSERT(max > 0);
+
+        lock_acquire(tail_lock);
+        n = atomic_read(&count);
+        while (n == 0) {
+                atomic_add(&consumers_waiting, 1);
+                n = atomic_read(&count);
+                if (n == 0) {
+                        cv_wait(not_empty, tail_lock);
+                        n = atomic_read(&count);
+                }
+                atomic_sub(&consumers_waiting, 1);
+        }
+        membar_load_load();
+        if (n > max) {
+                n = max;
+        }
+        for (i = 0; i < n; i++) {
+                out[i] = item_buffer[tail];
+                tail = (tail + 1) % buffer_size;
+        }
+        atomic_sub(&count, n);
+        lock_release(tail_lock);
 
-struct semaphore *full;
+        wake_waiters(&producers_waiting, head_lock, not_full);
+        return n;
+}
 
-struct semaphore *empty;
+/* producer_send_batch() puts N items into the buffer, as many at a
+   time as there is room for, waiting when it is full. */
 
-volatile int head, tail;
+void producer_send_batch(data_item_t **items, unsigned n)
+{
+        unsigned space, i;
+
+        while (n > 0) {
+                lock_acquire(head_lock);
+                space = buffer_size - atomic_read(&count);
+                while (space == 0) {
+                        atomic_add(&producers_waiting, 1);
+                        space = buffer_size - atomic_read(&count);
+                        if (space == 0) {
+                                cv_wait(not_full, head_lock);
+                                space = buffer_size - atomic_read(&count);
+                        }
+                        atomic_sub(&producers_waiting, 1);
+                }
+                membar_any_store();
+                if (space > n) {
+                        space = n;
+                }
+                for (i = 0; i < space; i++) {
+                        item_buffer[head] = items[i];
+                        head = (head + 1) % buffer_size;
+                }
+                atomic_add(&count, space);
+                lock_release(head_lock);
+
+                wake_waiters(&consumers_waiting, tail_lock, not_empty);
+                items += space;
+                n -= space;
+        }
+}
 
 /* consumer_receive() is called by a consumer to request more data. It
    should block on a sync primitive if no data is available in your
@@ -33,16 +141,7 @@ data_item_t * consumer_receive(void)
 {
         data_item_t * item;
 
-        P(full);
-        P(mutex);
-        item = item_buffer[tail];
-        tail = (tail + 1) % BUFFLEN;
-        V(mutex);
-        V(empty);        
-        /******************
-         * Remove above here
-         */
-
+        consumer_receive_batch(&item, 1);
         return item;
 }
 
@@ -52,45 +151,50 @@ data_item_t * consumer_receive(void)
 
 void producer_send(data_item_t *item)
 {
-        P(empty);
-        P(mutex);
-        item_buffer[head] = item;
-        head = (head + 1) % BUFFLEN;
-        V(mutex);
-        V(full);
+        producer_send_batch(&item, 1);
 }
 
 
 
+/* Set the buffer size used from the next producerconsumer_startup()
+   on, for benchmarking. */
+
+void producerconsumer_set_buffer_size(unsigned n)
+{
+        KASSERT(n > 0);
+        buffer_size = n;
+}
+
 /* Perform any initialisation (e.g. of global data) you need
    here. Note: You can panic if any allocation fails during setup */
 
 void producerconsumer_startup(void)
 {
-        head = tail = 0;
-
-        mutex = sem_create("mutex",1);
-
-        if(mutex == NULL){
-                panic("semaphore mutex doesn't get created ");
-        }
-
-        full = sem_create("full",0);
-        if(full == NULL){
-                panic("semaphore full doesn't get created ");
+        item_buffer = kmalloc(buffer_size * sizeof(item_buffer[0]));
+        if (item_buffer == NULL) {
+                panic("producerconsumer_startup: out of memory");
         }
-
-        empty = sem_create("empty",BUFFER_SIZE);
-        if(empty == NULL){
-                panic("semaphore empty doesn't get created ");
+        head = tail = 0;
+        atomic_set(&count, 0);
+        atomic_set(&producers_waiting, 0);
+        atomic_set(&consumers_waiting, 0);
+
+        head_lock = lock_create("head_lock");
+        tail_lock = lock_create("tail_lock");
+        not_full = cv_create("not_full");
+        not_empty = cv_create("not_empty");
+        if (head_lock == NULL || tail_lock == NULL ||
+            not_full == NULL || not_empty == NULL) {
+                panic("producerconsumer_startup: out of memory");
         }
 }
 
 /* Perform any clean-up you need here */
 void producerconsumer_shutdown(void)
 {
-        sem_destroy(mutex);
-        sem_destroy(full);
-        sem_destroy(empty);
+        cv_destroy(not_empty);
+        cv_destroy(not_full);
+        lock_destroy(tail_lock);
+        lock_destroy(head_lock);
+        kfree(item_buffer);
 }
-
@@ -46,6 +46,25 @@ void producer_send(data_item_t *);      /* send a data item to the shared
                                          * buffer, block if full.
                                          */
 
+unsigned consumer_receive_batch(data_item_t **out, unsigned max);
+                                        /* receive between 1 and MAX
+                                         * items into OUT, blocking
+                                         * until there is at least one;
+                                         * returns how many
+                                         */
+
+void producer_send_batch(data_item_t **items, unsigned n);
+                                        /* send N items, as many per
+                                         * round as there is space for,
+                                         * blocking while full
+                                         */
+
+void producerconsumer_set_buffer_size(unsigned n);
+                                        /* use a buffer of N items
+                                         * instead of BUFFER_SIZE from
+                                         * the next startup on
+                                         */
+
 void producerconsumer_startup(void);    /* initialise your buffer and
                                          * surrounding code 
                                          */
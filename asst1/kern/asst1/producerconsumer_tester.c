@@ -10,12 +10,15 @@
  */
 #include "opt-synchprobs.h"
 #include <types.h>  /* required by lib.h */
+#include <kern/errno.h>
 #include <lib.h>    /* for kprintf */
+#include <spinlock.h>
 #include <synch.h>  /* for P(), V(), sem_* */
 #include <thread.h> /* for thread_fork() */
 #include <test.h>
 
 #include "producerconsumer.h"
+#include <bench.h>
 
 /* The number of producers
  * This will be changed during testing
@@ -267,3 +270,174 @@ run_producerconsumer(int nargs, char **args)
         return 0;
 }
 
+
+
+/*
+ * Throughput benchmark for the batch interface.
+ *
+ * Like the simulation, but each producer sends ITEMS items from a
+ * preallocated array, BATCH at a time, and each consumer receives up
+ * to BATCH at a time. This is run for each batch size in
+ * bench_batches, reporting on each run (see bench.h).
+ *
+ * Consumers stop on the usual 0, 0 item. A batch can pick up more
+ * than one of those, so a consumer passes any extras back.
+ *
+ * Usage: 1cb [producers [consumers [items [buffer size]]]]
+ */
+
+#define MAX_BATCH 10
+
+static const unsigned bench_batches[] = { 1, 2, 5, 10 };
+
+static data_item_t *bench_items;
+static data_item_t bench_stop_item;
+static unsigned bench_nitems;
+static unsigned bench_batch;
+static struct spinlock bench_lock = SPINLOCK_INITIALIZER;
+static unsigned long bench_received;
+static bool bench_bad;
+
+static void
+bench_producer(void *unused_ptr, unsigned long thread_num)
+{
+        data_item_t *batch[MAX_BATCH];
+        unsigned i, n;
+
+        (void)unused_ptr;
+
+        for (i = 0; i < bench_nitems; i += n) {
+                for (n = 0; n < bench_batch && i + n < bench_nitems; n++) {
+                        batch[n] = &bench_items[thread_num * bench_nitems + i + n];
+                }
+                producer_send_batch(batch, n);
+        }
+        V(producer_finished);
+}
+
+static void
+bench_consumer(void *unused_ptr, unsigned long thread_num)
+{
+        data_item_t *batch[MAX_BATCH];
+        unsigned long received = 0;
+        unsigned i, n, nstop = 0;
+        bool bad = false;
+
+        (void)unused_ptr;
+        (void)thread_num;
+
+        while (nstop == 0) {
+                n = consumer_receive_batch(batch, bench_batch);
+                for (i = 0; i < n; i++) {
+                        if (batch[i] == &bench_stop_item) {
+                                /* keep the first, pass the rest back */
+                                if (nstop++ > 0) {
+                                        producer_send(batch[i]);
+                                }
+                        }
+                        else {
+                                if (batch[i]->data1 + 1 != batch[i]->data2) {
+                                        bad = true;
+                                }
+                                received++;
+                        }
+                }
+        }
+
+        spinlock_acquire(&bench_lock);
+        bench_received += received;
+        bench_bad = bench_bad || bad;
+        spinlock_release(&bench_lock);
+        V(consumer_finished);
+}
+
+int
+run_producerconsumer_bench(int nargs, char **args)
+{
+        struct bench b;
+        char name[32];
+        unsigned params[4] = { NUM_PRODUCERS, NUM_CONSUMERS, 2000, BUFFER_SIZE };
+        unsigned nprod, ncons;
+        unsigned long total, i;
+        unsigned k;
+        int result;
+        bool ok = true;
+
+        if (bench_args(nargs, args, params, 4)) {
+                kprintf("Usage: 1cb [producers [consumers [items "
+                        "[buffer size]]]]\n");
+                return EINVAL;
+        }
+        nprod = params[0];
+        ncons = params[1];
+        bench_nitems = params[2];
+
+        consumer_finished = sem_create("consumer_finished", 0);
+        producer_finished = sem_create("producer_finished", 0);
+        total = (unsigned long)nprod * bench_nitems;
+        bench_items = kmalloc(total * sizeof(data_item_t));
+        if (!consumer_finished || !producer_finished || !bench_items) {
+                panic("run_producerconsumer_bench: out of memory\n");
+        }
+        for (i = 0; i < total; i++) {
+                bench_items[i].data1 = i + 1;
+                bench_items[i].data2 = i + 2;
+        }
+        bench_stop_item.data1 = 0;
+        bench_stop_item.data2 = 0;
+        producerconsumer_set_buffer_size(params[3]);
+
+        kprintf("%u producers, %u consumers, %u items each, "
+                "buffer of %u\n", nprod, ncons, bench_nitems, params[3]);
+
+        for (k = 0; k < sizeof(bench_batches) / sizeof(bench_batches[0]); k++) {
+                bench_batch = bench_batches[k];
+                bench_received = 0;
+                bench_bad = false;
+                producerconsumer_startup();
+
+                bench_start(&b);
+                for (i = 0; i < ncons; i++) {
+                        result = thread_fork("consumer thread", NULL,
+                                             bench_consumer, NULL, i);
+                        if (result) {
+                                panic("run_producerconsumer_bench: couldn't fork (%s)\n",
+                                      strerror(result));
+                        }
+                }
+                for (i = 0; i < nprod; i++) {
+                        result = thread_fork("producer thread", NULL,
+                                             bench_producer, NULL, i);
+                        if (result) {
+                                panic("run_producerconsumer_bench: couldn't fork (%s)\n",
+                                      strerror(result));
+                        }
+                }
+                for (i = 0; i < nprod; i++) {
+                        P(producer_finished);
+                }
+                for (i = 0; i < ncons; i++) {
+                        producer_send(&bench_stop_item);
+                }
+                for (i = 0; i < ncons; i++) {
+                        P(consumer_finished);
+                }
+                snprintf(name, sizeof(name), "batch %u", bench_batch);
+                bench_report(&b, name, total);
+
+                producerconsumer_shutdown();
+
+                if (bench_received != total || bench_bad) {
+                        kprintf("*** Error! Received %lu of %lu items%s\n",
+                                bench_received, total,
+                                bench_bad ? ", some corrupted" : "");
+                        ok = false;
+                }
+        }
+
+        producerconsumer_set_buffer_size(BUFFER_SIZE);
+        kfree(bench_items);
+        sem_destroy(producer_finished);
+        sem_destroy(consumer_finished);
+        return bench_done("Producer/consumer benchmark", ok);
+}
@@ -4,7 +4,9 @@
 #include <test.h>
 #include <thread.h>
 #include <synch.h>
+#include <kern/errno.h>
 #include "twolocks.h"
+#include <bench.h>
 
 /********************************************************************************
  Document your resource order here. 
@@ -21,19 +23,26 @@ static struct semaphore *finished;
 /* a constant indicating how many times the locking loops go round */
 #define NUM_LOOPS 1000
 
+/* how many times they go round this time, and whether to say hello
+   (the benchmark changes these) */
+static unsigned num_loops = NUM_LOOPS;
+static bool quiet;
+
 
 /* Bill, Ben, Bob and Bruce are four threads that simply spin for a while,
    acquiring and releasing locks */
 
 static void bill(void * unusedpointer, unsigned long unusedint)
 {
-        int i;
+        unsigned i;
         (void) unusedpointer;
         (void) unusedint;
 
-        kprintf("Hi, I'm Bill\n");
+        if (!quiet) {
+                kprintf("Hi, I'm Bill\n");
+        }
 
-        for (i = 0; i < NUM_LOOPS; i++) {
+        for (i = 0; i < num_loops; i++) {
                 
                 lock_acquire(lockb);
                 
@@ -53,20 +62,24 @@ static void bill(void * unusedpointer, unsigned long unusedint)
                 lock_release(locka);
         }
 
-        kprintf("Bill says 'bye'\n");
+        if (!quiet) {
+                kprintf("Bill says 'bye'\n");
+        }
         V(finished); /* indicate to the parent thread Bill has
                         finished */
 }
 
 static void bruce(void * unusedpointer, unsigned long unusedint)
 {
-        int i;
+        unsigned i;
         (void) unusedpointer;
         (void) unusedint;
 
-        kprintf("Hi, I'm Bruce\n");
+        if (!quiet) {
+                kprintf("Hi, I'm Bruce\n");
+        }
 
-        for (i = 0; i < NUM_LOOPS; i++) {
+        for (i = 0; i < num_loops; i++) {
                 
                 lock_acquire(lockb);
                 
@@ -76,20 +89,24 @@ static void bruce(void * unusedpointer, unsigned long unusedint)
 
         }
 
-        kprintf("Bruce says 'bye'\n");
+        if (!quiet) {
+                kprintf("Bruce says 'bye'\n");
+        }
         V(finished); /* indicate to the parent thread Bruce has
                         finished */
 }
 
 static void ben(void * unusedpointer, unsigned long unusedint)
 {
-        int i;
+        unsigned i;
         (void) unusedpointer;
         (void) unusedint;
 
-        kprintf("Hi, I'm Ben\n");
+        if (!quiet) {
+                kprintf("Hi, I'm Ben\n");
+        }
 
-        for (i = 0; i < NUM_LOOPS; i++) {
+        for (i = 0; i < num_loops; i++) {
                 
                 lock_acquire(locka);
 
@@ -109,7 +126,9 @@ static void ben(void * unusedpointer, unsigned long unusedint)
                 lock_release(locka);
         }
 
-        kprintf("Ben says 'bye'\n");
+        if (!quiet) {
+                kprintf("Ben says 'bye'\n");
+        }
         V(finished); /* indicate to the parent thread Bill has
                         finished */
 }
@@ -117,13 +136,15 @@ static void ben(void * unusedpointer, unsigned long unusedint)
 static void bob(void * unusedpointer, unsigned long unusedint)
 {
 
-        int i;
+        unsigned i;
         (void) unusedpointer;
         (void) unusedint;
         
-        kprintf("Hi, I'm Bob\n");
+        if (!quiet) {
+                kprintf("Hi, I'm Bob\n");
+        }
 
-        for (i = 0; i < NUM_LOOPS; i++) {
+        for (i = 0; i < num_loops; i++) {
                 lock_acquire(locka);
 
                 holds_locka();          /* Critical section */
@@ -132,7 +153,9 @@ static void bob(void * unusedpointer, unsigned long unusedint)
 
         }
 
-        kprintf("Bob says 'bye'\n");
+        if (!quiet) {
+                kprintf("Bob says 'bye'\n");
+        }
         V(finished); /* indicate to the parent thread Bob has
                         finished */
 
@@ -227,3 +250,60 @@ int twolocks (int data1, char ** data2)
 
         return 0;
 }
+
+/*
+ * Benchmark: start THREADS each of Bill, Ben, Bob and Bruce, quietly,
+ * going round LOOPS times, and report lock acquisitions per second
+ * (Bill and Ben take three locks per loop, Bob and Bruce one).
+ *
+ * Usage: 1bb [threads [loops]]
+ */
+int twolocks_bench(int nargs, char **args)
+{
+        static void (*const who[])(void *, unsigned long) = {
+                bill, ben, bob, bruce
+        };
+        unsigned params[2] = { 1, NUM_LOOPS };
+        struct bench b;
+        char name[32];
+        unsigned i, j;
+        int error;
+
+        if (bench_args(nargs, args, params, 2)) {
+                kprintf("Usage: 1bb [threads [loops]]\n");
+                return EINVAL;
+        }
+
+        finished = sem_create("finished", 0);
+        locka = lock_create("lock_a");
+        lockb = lock_create("lock_b");
+        if (finished == NULL || locka == NULL || lockb == NULL) {
+                panic("twolocks_bench: out of memory\n");
+        }
+        num_loops = params[1];
+        quiet = true;
+
+        bench_start(&b);
+        for (i = 0; i < params[0]; i++) {
+                for (j = 0; j < 4; j++) {
+                        error = thread_fork("twolocks thread", NULL,
+                                            who[j], NULL, i);
+                        if (error) {
+                                panic("twolocks_bench: thread_fork failed: %s\n",
+                                      strerror(error));
+                        }
+                }
+        }
+        for (i = 0; i < params[0] * 4; i++) {
+                P(finished);
+        }
+        snprintf(name, sizeof(name), "%u x 4 threads", params[0]);
+        bench_report(&b, name, 8ULL * params[0] * num_loops);
+
+        num_loops = NUM_LOOPS;
+        quiet = false;
+        lock_destroy(locka);
+        lock_destroy(lockb);
+        sem_destroy(finished);
+        return bench_done("Two locks benchmark", true);
+}
@@ -0,0 +1,138 @@
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic integers. Like spinlocks, the guts are machine-dependent
+ * but the interface is the same everywhere.
+ *
+ * An atomic_t is an int that is only ever read and written with the
+ * functions below, so several cpus can update it at once without a
+ * lock.
+ *
+ * atomic_read		Get the value.
+ * atomic_set		Set the value.
+ * atomic_add		Add N.
+ * atomic_sub		Subtract N.
+ * atomic_fetch_add	Add N and return the value from before.
+ * atomic_cas		Compare and swap: if the value is OLD, make it
+ *			NEW. Either way, return the value it had, so the
+ *			swap happened if and only if that is OLD.
+ * atomic_add_unless	Add N unless the value is UNLESS. Returns true
+ *			if it added.
+ * atomic_inc_not_zero	Add 1 unless the value is 0, as for taking a
+ *			reference to something that may be on its way
+ *			out. Returns true if it added.
+ *
+ * atomic_read and atomic_set are plain loads and stores and imply no
+ * ordering. The rest are full memory barriers (see membar.h) both
+ * before and after, so they can be used to publish data, to take
+ * ownership of something, or to drop the last reference to it;
+ * atomic_add_unless and atomic_inc_not_zero only when they add.
+ */
+
+#include <cdefs.h>
+#include <membar.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+typedef struct {
+	volatile int a_val;
+} atomic_t;
+
+#define ATOMIC_INITIALIZER(v)	{ (v) }
+
+/* Get the machine-dependent bits. */
+#include <machine/atomic.h>
+
+ATOMIC_INLINE int atomic_read(const atomic_t *a);
+ATOMIC_INLINE void atomic_set(atomic_t *a, int val);
+ATOMIC_INLINE void atomic_add(atomic_t *a, int n);
+ATOMIC_INLINE void atomic_sub(atomic_t *a, int n);
+ATOMIC_INLINE int atomic_fetch_add(atomic_t *a, int n);
+ATOMIC_INLINE int atomic_cas(atomic_t *a, int old, int new);
+ATOMIC_INLINE bool atomic_add_unless(atomic_t *a, int n, int unless);
+ATOMIC_INLINE bool atomic_inc_not_zero(atomic_t *a);
+
+////////////////////////////////////////////////////////////
+
+ATOMIC_INLINE
+int
+atomic_read(const atomic_t *a)
+{
+	return a->a_val;
+}
+
+ATOMIC_INLINE
+void
+atomic_set(atomic_t *a, int val)
+{
+	a->a_val = val;
+}
+
+ATOMIC_INLINE
+void
+atomic_add(atomic_t *a, int n)
+{
+	(void)atomic_fetch_add(a, n);
+}
+
+ATOMIC_INLINE
+void
+atomic_sub(atomic_t *a, int n)
+{
+	(void)atomic_fetch_add(a, -n);
+}
+
+ATOMIC_INLINE
+int
+atomic_fetch_add(atomic_t *a, int n)
+{
+	int ret;
+
+	membar_any_any();
+	ret = atomic_data_fetchadd(&a->a_val, n);
+	membar_any_any();
+	return ret;
+}
+
+ATOMIC_INLINE
+int
+atomic_cas(atomic_t *a, int old, int new)
+{
+	int ret;
+
+	membar_any_any();
+	ret = atomic_data_cas(&a->a_val, old, new);
+	membar_any_any();
+	return ret;
+}
+
+ATOMIC_INLINE
+bool
+atomic_add_unless(atomic_t *a, int n, int unless)
+{
+	int old, now;
+
+	old = atomic_read(a);
+	while (old != unless) {
+		now = atomic_cas(a, old, old + n);
+		if (now == old) {
+			return true;
+		}
+		old = now;
+	}
+	return false;
+}
+
+ATOMIC_INLINE
+bool
+atomic_inc_not_zero(atomic_t *a)
+{
+	return atomic_add_unless(a, 1, 0);
+}
+
+
+#endif /* _ATOMIC_H_ */
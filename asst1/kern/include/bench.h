@@ -0,0 +1,32 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/*
+ * Benchmark support, for the asst1 problems and the tests in kern/test.
+ *
+ * bench_start() notes the time and context switch count; bench_report()
+ * prints the elapsed time, NOPS operations per second, and the number
+ * of context switches since then.
+ *
+ * bench_done() prints "WHAT done" or "WHAT FAILED" as the last line of
+ * a benchmark's output, and returns what the menu command should: 0,
+ * or EIO if the benchmark's own checks failed.
+ *
+ * bench_args() parses up to NVALS numeric menu arguments (after the
+ * command name) into VALS, leaving the values already there for any
+ * not given. It returns EINVAL if there are too many or any is 0.
+ */
+
+#include <clock.h>
+
+struct bench {
+	struct timespec b_start;
+	unsigned long b_switches;
+};
+
+void bench_start(struct bench *b);
+void bench_report(struct bench *b, const char *what, unsigned long long nops);
+int bench_done(const char *what, bool ok);
+int bench_args(int nargs, char **args, unsigned *vals, unsigned nvals);
+
+#endif /* _BENCH_H_ */
@@ -61,6 +61,7 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	unsigned long c_switches;	/* Counter of context switches */
 
 	/*
 	 * Accessed by other cpus.
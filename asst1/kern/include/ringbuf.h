@@ -0,0 +1,50 @@
+#ifndef _RINGBUF_H_
+#define _RINGBUF_H_
+
+/*
+ * Bounded ring buffers of pointers.
+ *
+ * A ringbuf is a fixed-size FIFO that producers put pointers into and
+ * consumers take them out of, for the places where we'd otherwise
+ * build a bounded buffer out of a mutex and full/empty semaphores.
+ * Sending and receiving are lock-free (atomic_cas on the ring
+ * positions), so they cost a few memory operations unless the buffer
+ * is full or empty. Only then does anyone take a lock, to sleep or to
+ * wake a sleeper.
+ *
+ * Any number of threads may send and receive at once. If only one
+ * thread will ever send, create the ringbuf with RINGBUF_ONESENDER
+ * and sending skips the atomic operation.
+ *
+ * Functions:
+ *     ringbuf_create     - create a ringbuf holding at least SIZE
+ *                          pointers (rounded up to a power of 2).
+ *                          NAME is not copied. Returns NULL if out
+ *                          of memory.
+ *     ringbuf_destroy    - destroy a ringbuf. Nobody may be waiting on
+ *                          it. Anything left in it is dropped.
+ *     ringbuf_send       - add ITEM at the end, waiting if full.
+ *     ringbuf_receive    - remove the first item, waiting if empty.
+ *     ringbuf_trysend    - like ringbuf_send, but return false
+ *                          instead of waiting.
+ *     ringbuf_tryreceive - like ringbuf_receive, but return false
+ *                          instead of waiting.
+ *
+ * Items may be NULL. The try versions are safe in interrupt handlers.
+ */
+
+struct ringbuf;	/* Opaque. */
+
+#define RINGBUF_ONESENDER	0x1	/* only one thread ever sends */
+
+struct ringbuf *ringbuf_create(const char *name, unsigned size,
+			       unsigned flags);
+void ringbuf_destroy(struct ringbuf *rb);
+
+void ringbuf_send(struct ringbuf *rb, void *item);
+void *ringbuf_receive(struct ringbuf *rb);
+bool ringbuf_trysend(struct ringbuf *rb, void *item);
+bool ringbuf_tryreceive(struct ringbuf *rb, void **ret);
+
+
+#endif /* _RINGBUF_H_ */
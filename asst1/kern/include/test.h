@@ -37,9 +37,13 @@
 
 #ifdef OPT_SYNCHPROBS
 int twolocks(int, char **);
+int twolocks_bench(int, char **);
 int counter_tester(int, char **);
+int counter_bench(int, char **);
 int run_producerconsumer(int, char **);
+int run_producerconsumer_bench(int, char **);
 int kitchen_tester(int, char **);
+int kitchen_bench(int, char **);
 #endif
 
 /*
@@ -60,6 +64,7 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int ringbufbench(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
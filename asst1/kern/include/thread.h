@@ -158,6 +158,11 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Return the number of context switches so far, on all cpus together.
+ */
+unsigned long thread_switchcount(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
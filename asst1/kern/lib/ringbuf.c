@@ -0,0 +1,282 @@
+/*
+ * Bounded ring buffers.
+ *
+ * This is the usual array-based lock-free queue. Each slot has a
+ * sequence number saying whose turn it is: a slot at ring position
+ * POS is ready for the sender with POS when its sequence number is
+ * POS, and for the receiver with POS once the sender sets it to
+ * POS + 1. The receiver then sets it to POS + the ring size, which
+ * is the position the slot will have on the next lap. Senders claim
+ * positions by advancing rb_head with compare-and-swap, receivers
+ * by advancing rb_tail, so the two sides never touch the same word
+ * except in the slots themselves.
+ *
+ * A sender that finds its slot still holding an item from the last
+ * lap knows the buffer is full; a receiver that finds its slot not
+ * filled yet knows it's empty. Positions are unsigned and wrap; the
+ * signed difference is what matters.
+ *
+ * Waiting uses a spinlock and two wait channels. A thread that has to
+ * wait counts itself in rb_sendwaiting or rb_recvwaiting, then tries
+ * again before sleeping; after each send or receive we look at the
+ * other side's count, and only take the lock if somebody is there.
+ * Both sides put a full barrier between the write and the read, so
+ * at least one of them sees the other and no wakeup is lost.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <membar.h>
+#include <atomic.h>
+#include <ringbuf.h>
+
+struct rb_slot {
+	atomic_t rs_seq;		/* whose turn it is */
+	void *rs_item;
+};
+
+struct ringbuf {
+	const char *rb_name;
+	unsigned rb_mask;		/* size - 1 */
+	bool rb_onesender;
+	struct rb_slot *rb_slots;
+	atomic_t rb_head;		/* next position to send to */
+	atomic_t rb_tail;		/* next position to receive from */
+
+	/* for waiting at the edges */
+	struct spinlock rb_lock;
+	struct wchan *rb_sendwc;
+	struct wchan *rb_recvwc;
+	volatile unsigned rb_sendwaiting;
+	volatile unsigned rb_recvwaiting;
+};
+
+struct ringbuf *
+ringbuf_create(const char *name, unsigned size, unsigned flags)
+{
+	struct ringbuf *rb;
+	unsigned n, i;
+
+	KASSERT(size > 0 && size <= 0x40000000);
+	for (n = 1; n < size; n *= 2) {
+		/* round up */
+	}
+
+	rb = kmalloc(sizeof(*rb));
+	if (rb == NULL) {
+		return NULL;
+	}
+	rb->rb_slots = kmalloc(n * sizeof(rb->rb_slots[0]));
+	if (rb->rb_slots == NULL) {
+		kfree(rb);
+		return NULL;
+	}
+	rb->rb_sendwc = wchan_create(name);
+	if (rb->rb_sendwc == NULL) {
+		kfree(rb->rb_slots);
+		kfree(rb);
+		return NULL;
+	}
+	rb->rb_recvwc = wchan_create(name);
+	if (rb->rb_recvwc == NULL) {
+		wchan_destroy(rb->rb_sendwc);
+		kfree(rb->rb_slots);
+		kfree(rb);
+		return NULL;
+	}
+
+	rb->rb_name = name;
+	rb->rb_mask = n - 1;
+	rb->rb_onesender = (flags & RINGBUF_ONESENDER) != 0;
+	for (i=0; i<n; i++) {
+		atomic_set(&rb->rb_slots[i].rs_seq, i);
+		rb->rb_slots[i].rs_item = NULL;
+	}
+	atomic_set(&rb->rb_head, 0);
+	atomic_set(&rb->rb_tail, 0);
+	spinlock_init(&rb->rb_lock);
+	rb->rb_sendwaiting = 0;
+	rb->rb_recvwaiting = 0;
+	membar_store_store();
+
+	return rb;
+}
+
+void
+ringbuf_destroy(struct ringbuf *rb)
+{
+	KASSERT(rb->rb_sendwaiting == 0);
+	KASSERT(rb->rb_recvwaiting == 0);
+
+	spinlock_cleanup(&rb->rb_lock);
+	wchan_destroy(rb->rb_recvwc);
+	wchan_destroy(rb->rb_sendwc);
+	kfree(rb->rb_slots);
+	kfree(rb);
+}
+
+/*
+ * Put ITEM in the ring if there's room.
+ */
+static
+bool
+rb_put(struct ringbuf *rb, void *item)
+{
+	struct rb_slot *slot;
+	unsigned pos, seq, now;
+	int diff;
+
+	pos = atomic_read(&rb->rb_head);
+	while (1) {
+		slot = &rb->rb_slots[pos & rb->rb_mask];
+		seq = atomic_read(&slot->rs_seq);
+		membar_load_load();
+		diff = (int)(seq - pos);
+		if (diff < 0) {
+			/* still full from the last lap */
+			return false;
+		}
+		if (diff == 0) {
+			if (rb->rb_onesender) {
+				atomic_set(&rb->rb_head, pos + 1);
+				break;
+			}
+			now = atomic_cas(&rb->rb_head, pos, pos + 1);
+			if (now == pos) {
+				break;
+			}
+			pos = now;
+		}
+		else {
+			/* someone else got this position; catch up */
+			pos = atomic_read(&rb->rb_head);
+		}
+	}
+
+	slot->rs_item = item;
+	membar_store_store();
+	atomic_set(&slot->rs_seq, pos + 1);
+	return true;
+}
+
+/*
+ * Take the first item out of the ring, if there is one.
+ */
+static
+bool
+rb_get(struct ringbuf *rb, void **ret)
+{
+	struct rb_slot *slot;
+	unsigned pos, seq, now;
+	int diff;
+
+	pos = atomic_read(&rb->rb_tail);
+	while (1) {
+		slot = &rb->rb_slots[pos & rb->rb_mask];
+		seq = atomic_read(&slot->rs_seq);
+		membar_load_load();
+		diff = (int)(seq - (pos + 1));
+		if (diff < 0) {
+			/* not sent yet */
+			return false;
+		}
+		if (diff == 0) {
+			now = atomic_cas(&rb->rb_tail, pos, pos + 1);
+			if (now == pos) {
+				break;
+			}
+			pos = now;
+		}
+		else {
+			pos = atomic_read(&rb->rb_tail);
+		}
+	}
+
+	*ret = slot->rs_item;
+	membar_any_store();
+	atomic_set(&slot->rs_seq, pos + rb->rb_mask + 1);
+	return true;
+}
+
+/*
+ * Wake one thread on WC if the count says anyone is waiting there.
+ */
+static
+void
+rb_wakeup(struct ringbuf *rb, volatile unsigned *waiting, struct wchan *wc)
+{
+	membar_any_any();
+	if (*waiting > 0) {
+		spinlock_acquire(&rb->rb_lock);
+		wchan_wakeone(wc, &rb->rb_lock);
+		spinlock_release(&rb->rb_lock);
+	}
+}
+
+bool
+ringbuf_trysend(struct ringbuf *rb, void *item)
+{
+	if (!rb_put(rb, item)) {
+		return false;
+	}
+	rb_wakeup(rb, &rb->rb_recvwaiting, rb->rb_recvwc);
+	return true;
+}
+
+bool
+ringbuf_tryreceive(struct ringbuf *rb, void **ret)
+{
+	if (!rb_get(rb, ret)) {
+		return false;
+	}
+	rb_wakeup(rb, &rb->rb_sendwaiting, rb->rb_sendwc);
+	return true;
+}
+
+void
+ringbuf_send(struct ringbuf *rb, void *item)
+{
+	bool done;
+
+	while (!rb_put(rb, item)) {
+		spinlock_acquire(&rb->rb_lock);
+		rb->rb_sendwaiting++;
+		membar_any_any();
+		done = rb_put(rb, item);
+		if (!done) {
+			wchan_sleep(rb->rb_sendwc, &rb->rb_lock);
+		}
+		rb->rb_sendwaiting--;
+		spinlock_release(&rb->rb_lock);
+		if (done) {
+			break;
+		}
+	}
+	rb_wakeup(rb, &rb->rb_recvwaiting, rb->rb_recvwc);
+}
+
+void *
+ringbuf_receive(struct ringbuf *rb)
+{
+	void *item;
+	bool done;
+
+	while (!rb_get(rb, &item)) {
+		spinlock_acquire(&rb->rb_lock);
+		rb->rb_recvwaiting++;
+		membar_any_any();
+		done = rb_get(rb, &item);
+		if (!done) {
+			wchan_sleep(rb->rb_recvwc, &rb->rb_lock);
+		}
+		rb->rb_recvwaiting--;
+		spinlock_release(&rb->rb_lock);
+		if (done) {
+			break;
+		}
+	}
+	rb_wakeup(rb, &rb->rb_sendwaiting, rb->rb_sendwc);
+	return item;
+}
@@ -571,6 +571,7 @@ static const char *testmenu[] = {
 	"[sy2] Lock test                     ",
 	"[sy3] CV test                       ",
 	"[sy4] CV test #2                    ",
+	"[rbb] Ring buffer benchmark         ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -599,9 +600,13 @@ static const char *mainmenu[] = {
 	"[?t] Tests menu                     ",
 #if OPT_SYNCHPROBS
 	"[1a] Simple math synchronisation    ",
+	"[1ab] Counter throughput benchmark  ",
 	"[1b] Simple deadlock                ",
+	"[1bb] Two locks benchmark           ",
 	"[1c] Producer/consumer problem      ",
+	"[1cb] Producer/consumer benchmark   ",
 	"[1d] Soup kitchen problem           ",
+	"[1db] Soup kitchen benchmark        ",
 #endif
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
@@ -656,9 +661,13 @@ static struct {
 #if OPT_SYNCHPROBS
 	/* in-kernel synchronization problem(s) */
 	{ "1a",     counter_tester },
+	{ "1ab",    counter_bench },
 	{ "1b",     twolocks }, 
+	{ "1bb",    twolocks_bench },
         { "1c",     run_producerconsumer},
+        { "1cb",    run_producerconsumer_bench},
         { "1d",     kitchen_tester},
+        { "1db",    kitchen_bench},
 #endif
 
 	/* stats */
@@ -687,6 +696,7 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "rbb",	ringbufbench },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
@@ -0,0 +1,59 @@
+/*
+ * Benchmark support. See <bench.h>.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <bench.h>
+
+void
+bench_start(struct bench *b)
+{
+	b->b_switches = thread_switchcount();
+	gettime(&b->b_start);
+}
+
+void
+bench_report(struct bench *b, const char *what, unsigned long long nops)
+{
+	struct timespec end;
+	unsigned long switches;
+	uint64_t nsecs;
+
+	gettime(&end);
+	switches = thread_switchcount() - b->b_switches;
+	timespec_sub(&end, &b->b_start, &end);
+
+	nsecs = (uint64_t)end.tv_sec * 1000000000 + end.tv_nsec;
+	kprintf("%-16s %llu.%09lu s  %llu ops/s  %lu switches\n", what,
+		(unsigned long long)end.tv_sec, (unsigned long)end.tv_nsec,
+		nsecs ? (unsigned long long)(nops * 1000000000 / nsecs) : 0,
+		switches);
+}
+
+int
+bench_done(const char *what, bool ok)
+{
+	kprintf("%s %s\n", what, ok ? "done" : "FAILED");
+	return ok ? 0 : EIO;
+}
+
+int
+bench_args(int nargs, char **args, unsigned *vals, unsigned nvals)
+{
+	int i;
+
+	if (nargs - 1 > (int)nvals) {
+		return EINVAL;
+	}
+	for (i = 1; i < nargs; i++) {
+		vals[i - 1] = atoi(args[i]);
+		if (vals[i - 1] == 0) {
+			return EINVAL;
+		}
+	}
+	return 0;
+}
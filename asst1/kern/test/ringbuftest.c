@@ -0,0 +1,225 @@
+/*
+ * Ring buffer benchmark.
+ *
+ * Producers pass numbered items to consumers through a bounded
+ * buffer, first one built from a mutex and full/empty semaphores the
+ * way the asst1 producer/consumer problem does it, then a ringbuf of
+ * the same size. Consumers add up what they get, so we can check
+ * that every item arrived exactly once, and we print the time and
+ * items per second for each.
+ *
+ * Usage: rbb [producers [consumers [items per producer]]]
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <ringbuf.h>
+#include <bench.h>
+#include <test.h>
+
+#define RB_SIZE		16
+
+/*
+ * The semaphore version.
+ */
+static void *sb_items[RB_SIZE];
+static unsigned sb_head, sb_tail;
+static struct semaphore *sb_mutex, *sb_full, *sb_empty;
+
+static
+void
+sb_send(void *item)
+{
+	P(sb_empty);
+	P(sb_mutex);
+	sb_items[sb_head] = item;
+	sb_head = (sb_head + 1) % RB_SIZE;
+	V(sb_mutex);
+	V(sb_full);
+}
+
+static
+void *
+sb_receive(void)
+{
+	void *item;
+
+	P(sb_full);
+	P(sb_mutex);
+	item = sb_items[sb_tail];
+	sb_tail = (sb_tail + 1) % RB_SIZE;
+	V(sb_mutex);
+	V(sb_empty);
+	return item;
+}
+
+/*
+ * The benchmark.
+ */
+static struct ringbuf *rb;
+static bool use_rb;
+static unsigned long nitems;
+static struct semaphore *donesem;
+static struct spinlock sum_lock = SPINLOCK_INITIALIZER;
+static unsigned long long sum;
+
+static
+void
+send(void *item)
+{
+	if (use_rb) {
+		ringbuf_send(rb, item);
+	}
+	else {
+		sb_send(item);
+	}
+}
+
+static
+void *
+receive(void)
+{
+	return use_rb ? ringbuf_receive(rb) : sb_receive();
+}
+
+static
+void
+producer(void *junk, unsigned long num)
+{
+	unsigned long i;
+
+	(void)junk;
+
+	/* never send 0, which means stop */
+	for (i=0; i<nitems; i++) {
+		send((void *)(num * nitems + i + 1));
+	}
+	V(donesem);
+}
+
+static
+void
+consumer(void *junk, unsigned long num)
+{
+	unsigned long long mysum;
+	uintptr_t item;
+
+	(void)junk;
+	(void)num;
+
+	mysum = 0;
+	while ((item = (uintptr_t)receive()) != 0) {
+		mysum += item;
+	}
+
+	spinlock_acquire(&sum_lock);
+	sum += mysum;
+	spinlock_release(&sum_lock);
+	V(donesem);
+}
+
+static
+bool
+rbb_run(const char *name, unsigned nprod, unsigned ncons)
+{
+	struct bench b;
+	unsigned long long total, expected;
+	unsigned i;
+	int result;
+
+	sum = 0;
+	bench_start(&b);
+	for (i=0; i<ncons; i++) {
+		result = thread_fork("rbb consumer", NULL, consumer, NULL, i);
+		if (result) {
+			panic("rbb: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nprod; i++) {
+		result = thread_fork("rbb producer", NULL, producer, NULL, i);
+		if (result) {
+			panic("rbb: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nprod; i++) {
+		P(donesem);
+	}
+	for (i=0; i<ncons; i++) {
+		send(NULL);
+	}
+	for (i=0; i<ncons; i++) {
+		P(donesem);
+	}
+
+	total = (unsigned long long)nprod * nitems;
+	bench_report(&b, name, total);
+
+	expected = total * (total + 1) / 2;
+
+	if (sum != expected) {
+		kprintf("rbb: items add up to %llu, not %llu\n",
+			sum, expected);
+		return false;
+	}
+	return true;
+}
+
+int
+ringbufbench(int nargs, char **args)
+{
+	unsigned nprod = 2, ncons = 5;
+	bool ok;
+
+	if (nargs > 4) {
+		kprintf("Usage: rbb [producers [consumers [items]]]\n");
+		return EINVAL;
+	}
+	nitems = 10000;
+	if (nargs > 1) {
+		nprod = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		ncons = atoi(args[2]);
+	}
+	if (nargs > 3) {
+		nitems = atoi(args[3]);
+	}
+	if (nprod == 0 || ncons == 0) {
+		kprintf("rbb: need at least one producer and consumer\n");
+		return EINVAL;
+	}
+
+	donesem = sem_create("rbb done", 0);
+	sb_mutex = sem_create("rbb mutex", 1);
+	sb_full = sem_create("rbb full", 0);
+	sb_empty = sem_create("rbb empty", RB_SIZE);
+	rb = ringbuf_create("rbb", RB_SIZE,
+			    nprod == 1 ? RINGBUF_ONESENDER : 0);
+	if (donesem == NULL || sb_mutex == NULL || sb_full == NULL ||
+	    sb_empty == NULL || rb == NULL) {
+		panic("rbb: out of memory\n");
+	}
+	sb_head = sb_tail = 0;
+
+	kprintf("%u producers, %u consumers, %lu items each, "
+		"buffer of %u\n", nprod, ncons, nitems, RB_SIZE);
+	use_rb = false;
+	ok = rbb_run("semaphore", nprod, ncons);
+	use_rb = true;
+	ok = rbb_run("ringbuf", nprod, ncons) && ok;
+
+	ringbuf_destroy(rb);
+	sem_destroy(sb_empty);
+	sem_destroy(sb_full);
+	sem_destroy(sb_mutex);
+	sem_destroy(donesem);
+
+	return bench_done("Ring buffer benchmark", ok);
+}
@@ -181,6 +181,7 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_switches = 0;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
@@ -662,6 +663,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	curcpu->c_curthread = next;
 	curthread = next;
 
+	if (next != cur) {
+		curcpu->c_switches++;
+	}
+
 	/* do the switch (in assembler in switch.S) */
 	switchframe_switch(&cur->t_context, &next->t_context);
 
@@ -822,6 +827,24 @@ thread_yield(void)
 	thread_switch(S_READY, NULL, NULL);
 }
 
+/*
+ * Total context switches on all cpus so far. The other cpus' counts
+ * are read without locking, so this is only exact when they're quiet,
+ * which is fine for statistics.
+ */
+unsigned long
+thread_switchcount(void)
+{
+	unsigned long total;
+	unsigned i;
+
+	total = 0;
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		total += cpuarray_get(&allcpus, i)->c_switches;
+	}
+	return total;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
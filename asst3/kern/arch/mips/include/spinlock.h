@@ -46,6 +46,9 @@ SPINLOCK_INLINE
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 SPINLOCK_INLINE
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
+SPINLOCK_INLINE
+spinlock_data_t spinlock_data_fetchadd(volatile spinlock_data_t *sd,
+				       unsigned val);
 
 ////////////////////////////////////////////////////////////
 
@@ -118,5 +121,31 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+/*
+ * Atomically add VAL to a spinlock_data_t and return the old value.
+ * Also LL/SC; unlike test-and-set this can't just report failure, so
+ * if the SC fails, go around again.
+ */
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_fetchadd(volatile spinlock_data_t *sd, unsigned val)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *sd */
+			"addu %1, %0, %3;"	/*   y = x + val */
+			"sc %1, 0(%2);"		/*   *sd = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (sd), "r" (val));
+	} while (y == 0);
+	return x;
+}
+
 
 #endif /* _MIPS_SPINLOCK_H_ */
@@ -117,12 +117,10 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 	/*
 	 * Call proc_exit, creating an exit status that reflects the
 	 * signal number we died on. Since we don't implement core
-	 * dumps, we don't ever use _MKWAIT_CORE().
+	 * dumps, we don't ever use _MKWAIT_CORE(). This takes the
+	 * whole process, and our thread, away.
 	 */
 	proc_exit(_MKWAIT_SIG(sig));
-
-	/* Now, the thread can go away too. */
-	thread_exit();
 }
 
 /*
@@ -203,6 +201,17 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * If another thread has made our process exit, don't
+		 * go back to user mode. Turn interrupts back on (as
+		 * below) first, as this is no longer interrupt work.
+		 */
+		if (!iskern && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			proc_thread_exit();
+		}
 		goto done2;
 	}
 
@@ -323,6 +332,11 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/* As above: don't go back to user mode if we're exiting. */
+	if (!iskern && curproc->p_exiting) {
+		proc_thread_exit();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -34,6 +34,7 @@
 #include <lib.h>
 #include <mips/trapframe.h>
 #include <thread.h>
+#include <cpu.h>
 #include <current.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -89,6 +90,7 @@ syscall(struct trapframe *tf)
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+	pcpu_add(PCPU_SYSCALL, 1);
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -113,6 +115,11 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
 
 	    /* process calls */
 
@@ -142,6 +149,37 @@ syscall(struct trapframe *tf)
 		err = sys_getpid(&retval);
 		break;
 
+	    case SYS_setpriority:
+		err = sys_setpriority(tf->tf_a0, tf->tf_a1);
+		break;
+
+	    case SYS_setaffinity:
+		err = sys_setaffinity(tf->tf_a0, tf->tf_a1);
+		break;
+
+	    case SYS_settickets:
+		err = sys_settickets(tf->tf_a0, tf->tf_a1);
+		break;
+
+	    case SYS_futex:
+		err = sys_futex((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2,
+				&retval);
+		break;
+
+	    case SYS___thread_create:
+		err = sys___thread_create(tf, (userptr_t)tf->tf_a0,
+					  (userptr_t)tf->tf_a1,
+					  (userptr_t)tf->tf_a2, &retval);
+		break;
+
+	    case SYS_thread_join:
+		err = sys_thread_join(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_thread_exit:
+		sys_thread_exit((userptr_t)tf->tf_a0);
+		panic("Returning from thread_exit\n");
+
 
 	    /* file calls */
 
@@ -316,3 +354,25 @@ enter_forked_process(struct trapframe *tf)
 
 	mips_usermode(tf);
 }
+
+/*
+ * Enter user mode for a new thread in an existing process.
+ *
+ * TF is a copy of the creating thread's trapframe, so the global
+ * pointer and such carry over. Start at ENTRYPOINT with ARG0 and ARG1
+ * as the first two arguments, on the stack whose top is STACKPTR,
+ * leaving below that the 16 bytes the calling convention says the
+ * caller provides for spilling a0-a3.
+ */
+void
+enter_new_thread(struct trapframe *tf, vaddr_t entrypoint, vaddr_t stackptr,
+		 userptr_t arg0, userptr_t arg1)
+{
+	tf->tf_epc = entrypoint;
+	tf->tf_sp = stackptr - 16;
+	tf->tf_a0 = (vaddr_t)arg0;
+	tf->tf_a1 = (vaddr_t)arg1;
+	tf->tf_ra = 0;		/* the entry point mustn't return */
+
+	mips_usermode(tf);
+}
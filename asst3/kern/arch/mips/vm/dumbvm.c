@@ -147,8 +147,39 @@ free_kpages(vaddr_t addr)
 	(void)addr;
 }
 
+/* We don't keep per-page data, so kmalloc has to search. */
+void
+kpage_setowner(vaddr_t addr, void *owner)
+{
+	(void)addr;
+	(void)owner;
+}
+
+void *
+kpage_getowner(vaddr_t addr)
+{
+	(void)addr;
+	return KPAGE_UNTRACKED;
+}
+
 #endif
 
+/*
+ * dumbvm doesn't map kseg2, so "non-contiguous" allocations are just
+ * ordinary kmalloc ones.
+ */
+void *
+vmalloc(size_t sz)
+{
+	return kmalloc(sz);
+}
+
+void
+vfree(void *ptr)
+{
+	kfree(ptr);
+}
+
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
@@ -43,6 +43,7 @@ static paddr_t lastpaddr;   /* one past end of last free physical page */
 typedef struct ft_entry {
         unsigned allocated:1; /* the corresponding frame is allocated */
         unsigned not_last:1; /* the frame is part of a multiframe allocation */
+        void *owner; /* kmalloc's tag for the frame, see kpage_setowner */
 } ft_entry_t;
 
 
@@ -56,10 +57,11 @@ static uint32_t last_frame;
 
 
 /* frame_table protected by spinlock (interrupt disabling on
- * uniprocessor) as this implementation does not block.
+ * uniprocessor) as this implementation does not block. It is a
+ * ticket lock so cpus allocating at once take turns.
  */ 
 
-static struct spinlock frame_table_spinlock = SPINLOCK_INITIALIZER;
+static struct spinlock frame_table_spinlock = TICKETLOCK_INITIALIZER;
 
 /*
  * Called very early in system boot to figure out how much physical
@@ -212,6 +214,7 @@ static paddr_t alloc_one_frame(unsigned int npages)
                 if (frame_table[i].allocated == FALSE) {
                         frame_table[i].allocated = TRUE;
                         frame_table[i].not_last = FALSE;
+                        frame_table[i].owner = NULL;
 
                         spinlock_release(&frame_table_spinlock);
 
@@ -254,9 +257,11 @@ static paddr_t alloc_multiple_frames(unsigned int npages)
                 for (j = i; j < i + npages - 1; j++) {
                         frame_table[j].allocated = TRUE; /* mark frame allocated */
                         frame_table[j].not_last = TRUE;  /* as a contiguous block */
+                        frame_table[j].owner = NULL;
                 }
                 frame_table[j].allocated = TRUE;
                 frame_table[j].not_last = FALSE;
+                frame_table[j].owner = NULL;
 
                 spinlock_release(&frame_table_spinlock);
                 
@@ -288,6 +293,7 @@ static void free_frames(vaddr_t vaddr)
         
         while (frame_table[i].allocated == TRUE) { /* otherwise mark block free */
                 frame_table[i].allocated = FALSE;
+                frame_table[i].owner = NULL;
                 if (frame_table[i].not_last == TRUE) {
                         i++;
                 }
@@ -319,3 +325,46 @@ free_kpages(vaddr_t addr)
         free_frames(addr);
 }
 
+/*
+ * Tag an allocated kernel page with an owner pointer. kmalloc uses
+ * this to record which pageref manages a page of subpage blocks, so
+ * kfree can find it by indexing the frame table instead of searching.
+ * The tag is cleared when the page is freed.
+ */
+void
+kpage_setowner(vaddr_t addr, void *owner)
+{
+        uint32_t i;
+
+        KASSERT(addr >= MIPS_KSEG0 && addr < MIPS_KSEG1);
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+        KASSERT(i >= first_frame && i < last_frame);
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        frame_table[i].owner = owner;
+        spinlock_release(&frame_table_spinlock);
+}
+
+/*
+ * Get the tag for the page containing ADDR, or NULL if it has none or
+ * isn't a page we manage.
+ *
+ * No lock: the caller holds a live block on the page, so the page (and
+ * its tag) can't go away underneath it, and a pointer-sized load is
+ * atomic.
+ */
+void *
+kpage_getowner(vaddr_t addr)
+{
+        uint32_t i;
+
+        if (addr < MIPS_KSEG0 || addr >= MIPS_KSEG1) {
+                return NULL;
+        }
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+        if (i < first_frame || i >= last_frame) {
+                return NULL;
+        }
+        return frame_table[i].owner;
+}
@@ -0,0 +1,328 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <vm.h>
+#include <mips/tlb.h>
+
+/*
+ * Non-contiguous kernel allocations ("vmalloc").
+ *
+ * alloc_kpages() hands out kseg0 addresses, so a multi-page request
+ * needs physically contiguous frames. Once the frame table gets
+ * fragmented those requests fail even when plenty of memory is free.
+ *
+ * Here we carve page runs out of kseg2 instead, back each page with
+ * an individual frame from alloc_kpages(1), and record the mapping in
+ * a small kernel page table. kseg2 is TLB-mapped, so vm_fault() calls
+ * kvm_fault() on a kernel TLB miss to load the translation.
+ *
+ * The kernel page table itself lives in kseg0 so that looking it up
+ * can never fault. Entries are written before the address is handed
+ * out and cleared only after the caller has finished with it, so the
+ * fault path reads them without taking a lock. That matters because a
+ * kseg2 miss can happen while the faulting code holds arbitrary
+ * spinlocks (e.g. HPT_lock while walking the HPT).
+ *
+ * Never use this for memory that is touched on the exception path
+ * itself, such as kernel stacks or trapframes.
+ */
+
+/* Software bits in a kernel page table entry (below TLBLO_PPAGE). */
+#define KVM_RESERVED	0x00000001	/* page belongs to an allocation */
+#define KVM_CONTINUED	0x00000002	/* allocation continues on next page */
+
+/* Bits of an entry that are loaded into the TLB. */
+#define KVM_TLBBITS	(TLBLO_PPAGE | TLBLO_DIRTY | TLBLO_VALID)
+
+/* kseg2 runs to the top of the address space. */
+#define KSEG2_PAGES	((0xffffffff - MIPS_KSEG2 + 1) / PAGE_SIZE)
+
+static struct spinlock kvm_lock = SPINLOCK_INITIALIZER;
+
+/* free_kvpages waits for its shootdowns on kvm_freesem, one at a time. */
+static struct lock *kvm_freelock;
+static struct semaphore *kvm_freesem;
+
+static uint32_t *kvm_ptes;	/* one entry per page of the kseg2 window */
+static unsigned kvm_npages;	/* size of the window in pages */
+static unsigned kvm_cursor;	/* next-fit search position */
+
+/*
+ * Set up the kernel page table. The window is twice the size of RAM:
+ * we can never map more than that, and the slack lets the next-fit
+ * search go a long way before it reuses an address.
+ */
+void
+kvm_bootstrap(void)
+{
+	unsigned i;
+
+	kvm_npages = 2 * (ram_getsize() / PAGE_SIZE);
+	if (kvm_npages > KSEG2_PAGES) {
+		kvm_npages = KSEG2_PAGES;
+	}
+
+	kvm_ptes = kmalloc(kvm_npages * sizeof(uint32_t));
+	if (kvm_ptes == NULL) {
+		panic("kvm_bootstrap: Out of memory\n");
+	}
+
+	for (i = 0; i < kvm_npages; i++) {
+		kvm_ptes[i] = 0;
+	}
+	kvm_cursor = 0;
+
+	kvm_freelock = lock_create("free_kvpages");
+	kvm_freesem = sem_create("free_kvpages", 0);
+	if (kvm_freelock == NULL || kvm_freesem == NULL) {
+		panic("kvm_bootstrap: Out of memory\n");
+	}
+}
+
+/*
+ * Find NPAGES consecutive unreserved entries, starting at the cursor
+ * and wrapping around once. Returns the first index, or kvm_npages if
+ * there is no such run.
+ */
+static
+unsigned
+kvm_findrange(unsigned npages)
+{
+	unsigned start, run, i, scanned;
+
+	KASSERT(spinlock_do_i_hold(&kvm_lock));
+
+	start = kvm_cursor;
+	run = 0;
+	for (scanned = 0; scanned < kvm_npages + npages; scanned++) {
+		i = (kvm_cursor + scanned) % kvm_npages;
+		if (i == 0) {
+			/* runs can't wrap past the end of the window */
+			start = 0;
+			run = 0;
+		}
+		if (kvm_ptes[i] & KVM_RESERVED) {
+			start = i + 1;
+			run = 0;
+			continue;
+		}
+		run++;
+		if (run == npages) {
+			return start;
+		}
+	}
+	return kvm_npages;
+}
+
+/*
+ * Release the frames behind entries [first, first+npages) and clear
+ * the entries.
+ */
+static
+void
+kvm_release(unsigned first, unsigned npages)
+{
+	unsigned i;
+	uint32_t pte;
+
+	spinlock_acquire(&kvm_lock);
+	for (i = first; i < first + npages; i++) {
+		pte = kvm_ptes[i];
+		KASSERT(pte & KVM_RESERVED);
+		kvm_ptes[i] = 0;
+		if (pte & TLBLO_VALID) {
+			free_kpages(PADDR_TO_KVADDR(pte & TLBLO_PPAGE));
+		}
+	}
+	spinlock_release(&kvm_lock);
+}
+
+/*
+ * Allocate NPAGES pages of kseg2, each backed by its own frame.
+ * Returns 0 if either address space or frames run out.
+ */
+vaddr_t
+alloc_kvpages(unsigned npages)
+{
+	unsigned first, i;
+	vaddr_t frame;
+	uint32_t pte;
+
+	KASSERT(npages > 0);
+	KASSERT(kvm_ptes != NULL);
+
+	spinlock_acquire(&kvm_lock);
+	first = kvm_findrange(npages);
+	if (first == kvm_npages) {
+		spinlock_release(&kvm_lock);
+		return 0;
+	}
+	for (i = first; i < first + npages; i++) {
+		kvm_ptes[i] = KVM_RESERVED;
+		if (i + 1 < first + npages) {
+			kvm_ptes[i] |= KVM_CONTINUED;
+		}
+	}
+	kvm_cursor = (first + npages) % kvm_npages;
+	spinlock_release(&kvm_lock);
+
+	/*
+	 * The run is reserved, so nobody else will touch these
+	 * entries; fill them in without the lock, since alloc_kpages
+	 * takes the frame table lock.
+	 */
+	for (i = first; i < first + npages; i++) {
+		frame = alloc_kpages(1);
+		if (frame == 0) {
+			kvm_release(first, npages);
+			return 0;
+		}
+		pte = kvm_ptes[i];
+		pte |= KVADDR_TO_PADDR(frame) | TLBLO_DIRTY | TLBLO_VALID;
+		kvm_ptes[i] = pte;
+	}
+
+	return MIPS_KSEG2 + first * PAGE_SIZE;
+}
+
+/*
+ * Free a run previously returned by alloc_kvpages.
+ *
+ * Stale translations are removed from this CPU's TLB straight away
+ * and from the other CPUs by shootdown IPI. As in vm_unmap, the
+ * frames go back only once every CPU has answered; otherwise a CPU
+ * that hasn't got to the IPI yet could still reach a frame through
+ * its old kseg2 entry after someone else has been given it. So this
+ * may sleep.
+ */
+void
+free_kvpages(vaddr_t addr)
+{
+	struct tlbshootdown ts;
+	unsigned first, npages, i, nsent;
+	int spl;
+
+	KASSERT(addr >= MIPS_KSEG2);
+	KASSERT(addr % PAGE_SIZE == 0);
+
+	first = (addr - MIPS_KSEG2) / PAGE_SIZE;
+	KASSERT(first < kvm_npages);
+
+	spinlock_acquire(&kvm_lock);
+	if ((kvm_ptes[first] & KVM_RESERVED) == 0) {
+		panic("free_kvpages: 0x%x is not allocated\n", addr);
+	}
+	if (first > 0 && (kvm_ptes[first - 1] & KVM_CONTINUED)) {
+		panic("free_kvpages: 0x%x is inside an allocation\n", addr);
+	}
+	npages = 1;
+	while (kvm_ptes[first + npages - 1] & KVM_CONTINUED) {
+		npages++;
+	}
+	spinlock_release(&kvm_lock);
+
+	ts.ts_vaddr = addr;
+	ts.ts_npages = npages;
+	ts.ts_done = kvm_freesem;
+
+	lock_acquire(kvm_freelock);
+	/* don't let this thread move cpus in between */
+	spl = splhigh();
+	vm_tlbshootdown(&ts);
+	nsent = ipi_tlbshootdown_broadcast(&ts);
+	splx(spl);
+
+	for (i = 0; i < nsent + 1; i++) {
+		P(kvm_freesem);
+	}
+	lock_release(kvm_freelock);
+
+	kvm_release(first, npages);
+}
+
+/*
+ * Handle a TLB miss on a kseg2 address. Runs in whatever context took
+ * the fault, so it must not take locks; see the comment at the top.
+ */
+int
+kvm_fault(vaddr_t faultaddress)
+{
+	unsigned index;
+	uint32_t pte;
+	int slot, spl;
+
+	KASSERT(faultaddress >= MIPS_KSEG2);
+
+	index = (faultaddress - MIPS_KSEG2) / PAGE_SIZE;
+	if (kvm_ptes == NULL || index >= kvm_npages) {
+		return EFAULT;
+	}
+
+	pte = kvm_ptes[index];
+	if ((pte & TLBLO_VALID) == 0) {
+		return EFAULT;
+	}
+
+	/*
+	 * An interrupt handler may have loaded the same page since we
+	 * took the miss; never put two entries for one page in the TLB.
+	 */
+	faultaddress &= TLBHI_VPAGE;
+	spl = splhigh();
+	slot = tlb_probe(faultaddress, 0);
+	if (slot >= 0) {
+		tlb_write(faultaddress, pte & KVM_TLBBITS, slot);
+	}
+	else {
+		tlb_random(faultaddress, pte & KVM_TLBBITS);
+	}
+	splx(spl);
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Allocate a large, virtually contiguous block. Requests smaller than
+ * a page (or made before kvm_bootstrap) gain nothing from kseg2 and go
+ * to kmalloc instead; vfree tells the two apart by address.
+ */
+void *
+vmalloc(size_t sz)
+{
+	unsigned npages;
+	vaddr_t addr;
+
+	if (sz < PAGE_SIZE || kvm_ptes == NULL) {
+		return kmalloc(sz);
+	}
+
+	npages = DIVROUNDUP(sz, PAGE_SIZE);
+	addr = alloc_kvpages(npages);
+	if (addr == 0) {
+		return NULL;
+	}
+	return (void *)addr;
+}
+
+/*
+ * Free a block previously returned from vmalloc.
+ */
+void
+vfree(void *ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+	if ((vaddr_t)ptr >= MIPS_KSEG2) {
+		free_kvpages((vaddr_t)ptr);
+	}
+	else {
+		kfree(ptr);
+	}
+}
@@ -603,19 +603,12 @@ semfs_reclaim(struct vnode *vn)
 
 	lock_acquire(semfs->semfs_tablelock);
 
-	/* vnode refcount is protected by the vnode's ->vn_countlock */
-	spinlock_acquire(&vn->vn_countlock);
-	if (vn->vn_refcount > 1) {
-		/* consume the reference VOP_DECREF passed us */
-		vn->vn_refcount--;
-
-		spinlock_release(&vn->vn_countlock);
+	if (vnode_decref_unless_last(vn)) {
+		/* consumed the reference VOP_DECREF passed us */
 		lock_release(semfs->semfs_tablelock);
 		return EBUSY;
 	}
 
-	spinlock_release(&vn->vn_countlock);
-
 	/* remove from the table */
 	num = vnodearray_num(semfs->semfs_vnodes);
 	for (i=0; i<num; i++) {
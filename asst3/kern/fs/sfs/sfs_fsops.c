@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <array.h>
 #include <bitmap.h>
+#include <kcache.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
@@ -263,6 +264,7 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 		bitmap_destroy(sfs->sfs_freemap);
 	}
 	vnodearray_destroy(sfs->sfs_vnodes);
+	kcache_destroy(sfs->sfs_vnodecache);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -355,6 +357,12 @@ sfs_fs_create(void)
 	if (sfs->sfs_vnodes == NULL) {
 		goto cleanup_object;
 	}
+	sfs->sfs_vnodecache = kcache_create("sfs_vnode",
+					    sizeof(struct sfs_vnode),
+					    NULL, NULL);
+	if (sfs->sfs_vnodecache == NULL) {
+		goto cleanup_vnodes;
+	}
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
@@ -362,6 +370,8 @@ sfs_fs_create(void)
 
 	return sfs;
 
+cleanup_vnodes:
+	vnodearray_destroy(sfs->sfs_vnodes);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -35,6 +35,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <kcache.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
@@ -80,18 +81,11 @@ sfs_reclaim(struct vnode *v)
 	 * decision was made to reclaim it. (You must also synchronize
 	 * this with sfs_loadvnode.)
 	 */
-	spinlock_acquire(&v->vn_countlock);
-	if (v->vn_refcount != 1) {
-
-		/* consume the reference VOP_DECREF gave us */
-		KASSERT(v->vn_refcount>1);
-		v->vn_refcount--;
-
-		spinlock_release(&v->vn_countlock);
+	if (vnode_decref_unless_last(v)) {
+		/* consumed the reference VOP_DECREF gave us */
 		vfs_biglock_release();
 		return EBUSY;
 	}
-	spinlock_release(&v->vn_countlock);
 
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
@@ -136,7 +130,7 @@ sfs_reclaim(struct vnode *v)
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	kcache_free(sfs->sfs_vnodecache, sv);
 
 	/* Done */
 	return 0;
@@ -184,7 +178,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	sv = kcache_alloc(sfs->sfs_vnodecache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -198,7 +192,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
-		kfree(sv);
+		kcache_free(sfs->sfs_vnodecache, sv);
 		return result;
 	}
 
@@ -235,7 +229,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kcache_free(sfs->sfs_vnodecache, sv);
 		return result;
 	}
 
@@ -246,7 +240,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
 	if (result) {
 		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
+		kcache_free(sfs->sfs_vnodecache, sv);
 		return result;
 	}
 
@@ -36,6 +36,7 @@
 
 
 #include <vm.h>
+#include <spinlock.h>
 #include "opt-dumbvm.h"
 
 #define READABLE 0x1
@@ -71,10 +72,18 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
+        struct spinlock as_lock;        /* for regions; see below */
         struct region *regions;
 #endif
 };
 
+/*
+ * The threads of a process share its address space. Regions are only
+ * added and removed with the process's p_utlock held (or while it has
+ * one thread), but vm_fault can look at them from any of its threads,
+ * so changes to the list, and vm_fault, also hold as_lock.
+ */
+
 /*
  * Functions in addrspace.c:
  *
@@ -112,10 +121,18 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_remove_region - take away a region set up by as_define_region,
+ *                and free its pages. Used for the stacks of user
+ *                threads.
+ *
+ *    as_bootstrap - set up allocation of addrspace and region
+ *                structures. Called once, from vm_bootstrap.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
- * functions are found in dumbvm.c.
+ * functions are found in dumbvm.c. (dumbvm has no as_bootstrap.)
  */
 
+void              as_bootstrap(void);
 struct addrspace *as_create(void);
 int               as_copy(struct addrspace *src, struct addrspace **ret);
 void              as_activate(void);
@@ -130,6 +147,8 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_remove_region(struct addrspace *as,
+                                   vaddr_t vaddr, size_t sz);
 
 
 /*
@@ -0,0 +1,32 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/*
+ * Support for the benchmarks in kern/test.
+ *
+ * bench_start	Note the time.
+ * bench_stop	Note the time elapsed since bench_start.
+ * bench_rate	N events per second over the time between bench_start
+ *		and bench_stop.
+ * bench_report	Print WHAT, the elapsed time, and N UNITs per second,
+ *		as one line.
+ * bench_done	Print "WHAT done" or "WHAT FAILED" as the last line of
+ *		the output, and return what the menu command should:
+ *		0, or EIO if the benchmark's own checks failed.
+ */
+
+#include <clock.h>
+
+struct bench {
+	struct timespec b_start;
+	struct timespec b_elapsed;
+};
+
+void bench_start(struct bench *b);
+void bench_stop(struct bench *b);
+unsigned long long bench_rate(const struct bench *b, unsigned long long n);
+void bench_report(const struct bench *b, const char *what,
+		  unsigned long long n, const char *unit);
+int bench_done(const char *what, bool ok);
+
+#endif /* _BENCH_H_ */
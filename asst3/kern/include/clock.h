@@ -74,9 +74,52 @@ void timespec_sub(const struct timespec *t1,
 		  struct timespec *ret);
 
 /*
+ * Timeouts.
+ *
+ * timeout() arranges for FUNC(ARG) to be called after TICKS
+ * hardclocks (at least one), from the hardclock interrupt of the cpu
+ * that called timeout(). FUNC runs in interrupt context, so it must
+ * not sleep. Delays longer than TIMEOUT_MAXTICKS (about 46 hours) are
+ * cut down to that.
+ *
+ * The caller supplies the struct timeout and must neither free it nor
+ * pass it to timeout() again until FUNC has been called or untimeout()
+ * has cancelled it. untimeout()
+ * returns true if it cancelled the call and false if FUNC has already
+ * run or is about to, in which case the caller has to synchronize
+ * with FUNC itself before freeing TO.
+ *
+ * The fields of struct timeout are private to clock.c.
+ */
+
+#define TIMEOUT_MAXTICKS	((1U << 24) - 1)
+
+struct timerwheel;	/* Opaque; one per cpu. */
+
+struct timeout {
+	struct timeout *to_next;	/* Next in wheel slot */
+	struct timeout **to_prevp;	/* Link to us, or NULL if not pending */
+	struct timerwheel *to_wheel;	/* Wheel we're on */
+	uint64_t to_expires;		/* Hardclock count to fire at */
+	void (*to_func)(void *);
+	void *to_arg;
+};
+
+void timeout(struct timeout *to, void (*func)(void *), void *arg,
+	     unsigned ticks);
+bool untimeout(struct timeout *to);
+
+/* Create the timer wheel for a new cpu. Returns NULL if out of memory. */
+struct timerwheel *timerwheel_create(void);
+
+/*
+ * clock_sleepticks() suspends execution for TICKS hardclocks. Returns
+ * ENOMEM if it can't get a wait channel.
+ *
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
  */
+int clock_sleepticks(unsigned ticks);
 void clocksleep(int seconds);
 
 
@@ -33,8 +33,57 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <workqueue.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+struct addrspace;
+
+/*
+ * Number of scheduler priority levels. Level 0 is the highest; see
+ * the scheduler section of thread.c.
+ */
+#define SCHED_NPRIO	4
+
+/*
+ * Number of stacks of exited threads each cpu keeps for thread_fork
+ * to reuse.
+ */
+#define THREAD_STACKCACHE	8
+
+/*
+ * Per-cpu counters.
+ *
+ * Each cpu has its own copy of every counter, so counting something
+ * takes no lock and causes no cache-line contention. Reading a counter
+ * adds up all the cpus' copies; the total is exact only if nothing is
+ * counting at the same time, which is fine for statistics.
+ *
+ * To add a counter, add a slot here and its name to pcpu_names[] in
+ * thread.c.
+ *
+ * pcpu_add - add N to the current cpu's copy of counter CTR.
+ * pcpu_read - sum of CTR over all cpus.
+ * pcpu_printstats - print all counters (menu "ctr").
+ */
+enum pcpu_counter {
+	PCPU_KMALLOC,		/* kmalloc calls */
+	PCPU_KFREE,		/* kfree calls */
+	PCPU_KMALLOC_PAGES,	/* whole pages allocated by kmalloc */
+	PCPU_VMFAULT,		/* calls to vm_fault */
+	PCPU_SYSCALL,		/* system calls */
+	PCPU_STEAL,		/* successful thread_steal calls */
+	PCPU_MIGRATE,		/* threads moved here by thread_steal */
+	PCPU_LOCK_SPIN,		/* locks acquired by spinning */
+	PCPU_LOCK_SLEEP,	/* lock_acquire calls that slept */
+	PCPU_STACK_HIT,		/* thread stacks taken from c_stacks */
+	PCPU_STACK_MISS,	/* thread stacks from kmalloc */
+	PCPU_NCOUNTERS		/* must be last */
+};
+
+void pcpu_add(enum pcpu_counter ctr, unsigned long n);
+unsigned long pcpu_read(enum pcpu_counter ctr);
+void pcpu_printstats(void);
+
 
 /*
  * Per-cpu structure
@@ -59,15 +108,23 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_migrating;	/* Threads leaving this cpu */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	unsigned long c_counters[PCPU_NCOUNTERS]; /* See pcpu_add */
+	void *c_stacks[THREAD_STACKCACHE]; /* Free thread stacks */
+	unsigned c_nstacks;		/* Number in c_stacks[] */
+	unsigned c_qsbr_readers;	/* Depth of qsbr read-side sections */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NPRIO]; /* Run queues, by priority */
+	struct threadlist c_strideq;	/* Runnable stride-class threads */
+	uint64_t c_tspass;		/* Stride pass of the default class */
+	uint64_t c_vtime;		/* Pass of the last client picked */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -88,6 +145,31 @@ struct cpu {
 	unsigned c_numshootdown;
 	struct spinlock c_ipi_lock;
 
+	/*
+	 * Accessed by other cpus. Protected inside clock.c.
+	 */
+	struct timerwheel *c_timers;	/* Pending timeouts */
+
+	/*
+	 * Accessed by other cpus. Protected inside workqueue.c.
+	 */
+	struct workqueue *c_workqueue;	/* Deferred work for our worker */
+	struct work c_migratework;	/* Wakes it to push out migrants */
+
+	/*
+	 * Written only by this cpu, with interrupts off; read by
+	 * others without a lock to decide whom to send shootdowns.
+	 * Kernel threads leave the last user address space loaded,
+	 * so this is the one whose translations may be in the TLB.
+	 */
+	struct addrspace *c_curas;	/* User address space in the MMU */
+
+	/*
+	 * Written only by this cpu; read by others without a lock.
+	 * See qsbr.c.
+	 */
+	volatile unsigned c_qsbr_gen;	/* Grace period at last quiescent state */
+
 	/*
 	 * Accessed by other cpus. Protected inside hangman.c.
 	 */
@@ -112,6 +194,13 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Number of cpus in the system; c_number runs from 0 to this less one.
+ * cpu_get returns the cpu with c_number NUM.
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned num);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -155,6 +244,9 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_broadcast sends that to all CPUs except the current one.
+ * ipi_tlbshootdown_as sends it to the other CPUs that have a given
+ * address space loaded. Both return how many CPUs they sent to.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -169,6 +261,9 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_as(struct addrspace *as,
+			     const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
@@ -35,6 +35,7 @@
 #define _FILETABLE_H_
 
 #include <limits.h> /* for OPEN_MAX */
+#include <spinlock.h>
 
 
 /*
@@ -48,14 +49,15 @@
  * or even to make it dynamic with the limit being user-settable. (See
  * setrlimit(2) on a Unix machine.)
  *
- * Because we only have single-threaded processes, the file table is
- * never shared and so it doesn't require synchronization. On fork,
- * the table is copied. Another exercise: what would you need to do to
- * make this code safe for multithreaded processes? What happens if
- * one thread calls close() while another one is in the middle of e.g.
- * read() using the same file handle?
+ * The threads of a process share its file table, so the slots are
+ * protected by ft_lock. So that one thread can close() a file while
+ * another is in the middle of read() on it, filetable_get hands out
+ * its own reference to the openfile, which filetable_put drops; the
+ * file goes away when the last of those is put back. On fork, the
+ * table is copied.
  */
 struct filetable {
+	struct spinlock ft_lock;
 	struct openfile *ft_openfiles[OPEN_MAX];
 };
 
@@ -68,7 +70,8 @@ struct filetable {
  * okfd -    Check if a file handle is in range.
  * get/put - Retrieve a fd for use and put it back when done. (Checks
  *           okfd and also fails on files not open; returned openfile
- *           is not NULL.) Call put with the file returned from get.
+ *           is not NULL.) Call put with the file returned from get;
+ *           it stays valid until then even if the fd is closed.
  * place -   Insert a file and return the fd.
  * placeat - Insert a file at a specific slot and return the file
  *           previously there.
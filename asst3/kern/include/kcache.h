@@ -0,0 +1,44 @@
+#ifndef _KCACHE_H_
+#define _KCACHE_H_
+
+/*
+ * Object caches ("slab allocator").
+ *
+ * A kcache hands out fixed-size objects of one type. Objects are
+ * carved from single pages (slabs), so freeing one is a mask of the
+ * address rather than a search of the kmalloc heap, and each CPU
+ * keeps a small stash of free objects so the common case takes no
+ * lock at all.
+ *
+ * If a constructor is given, it is run once when an object's slab is
+ * created and the destructor once when the slab is given back. In
+ * between, objects are handed out and returned in their constructed
+ * state: kcache_alloc does not reinitialize them, and callers must
+ * put them back the way they found them (e.g. locks released) before
+ * calling kcache_free. A constructor returns 0 or an error code.
+ *
+ * Functions:
+ *     kcache_create   - create a cache named NAME for objects of SIZE
+ *                       bytes. CTOR and DTOR may be NULL. NAME is not
+ *                       copied. Returns NULL if out of memory.
+ *     kcache_destroy  - destroy a cache. All its objects must have
+ *                       been freed.
+ *     kcache_alloc    - get an object. Returns NULL if out of memory.
+ *     kcache_free     - return an object to the cache it came from.
+ *     kcache_printstats - print per-cache statistics (menu "kh").
+ */
+
+struct kcache;	/* Opaque. */
+
+struct kcache *kcache_create(const char *name, size_t size,
+			     int (*ctor)(void *obj),
+			     void (*dtor)(void *obj));
+void kcache_destroy(struct kcache *kc);
+
+void *kcache_alloc(struct kcache *kc);
+void kcache_free(struct kcache *kc, void *obj);
+
+void kcache_printstats(void);
+
+
+#endif /* _KCACHE_H_ */
@@ -0,0 +1,10 @@
+#ifndef _KERN_FUTEX_H_
+#define _KERN_FUTEX_H_
+
+/*
+ * Operations for futex().
+ */
+#define FUTEX_WAIT	0	/* Sleep if *uaddr is still val */
+#define FUTEX_WAKE	1	/* Wake up to val sleepers on uaddr */
+
+#endif /* _KERN_FUTEX_H_ */
@@ -92,7 +92,7 @@
 //#define SYS_setrlimit  37
 //                              (process priority control)
 //#define SYS_getpriority 38
-//#define SYS_setpriority 39
+#define SYS_setpriority  39
 //                              (process groups, sessions, and job control)
 //#define SYS_getpgid    40
 //#define SYS_setpgid    41
@@ -197,6 +197,17 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- OS/161-specific scheduling --
+#define SYS_setaffinity  121
+#define SYS_settickets   122
+
+//                              -- OS/161-specific synchronization --
+#define SYS_futex        123
+//                              -- OS/161-specific threads --
+#define SYS___thread_create 124
+#define SYS_thread_join  125
+#define SYS_thread_exit  126
+
 /*CALLEND*/
 
 
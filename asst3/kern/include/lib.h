@@ -125,6 +125,8 @@ uint32_t random(void);
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ * kheap_profile likewise needs heap profiling; it prints the TOPN
+ * allocation sites with the most memory allocated.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
@@ -132,6 +134,18 @@ void kheap_printstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+void kheap_profile(unsigned topn);
+
+/*
+ * Allocation of large buffers that don't need to be physically
+ * contiguous (e.g. tables and bitmaps sized by RAM or disk). Like
+ * kmalloc/kfree, but multi-page blocks are assembled from individual
+ * frames so fragmentation can't make them fail. Not for anything
+ * touched on the exception path, such as kernel stacks. vfree may
+ * sleep.
+ */
+void *vmalloc(size_t size);
+void vfree(void *ptr);
 
 /*
  * C string functions.
@@ -34,7 +34,7 @@
 #ifndef _OPENFILE_H_
 #define _OPENFILE_H_
 
-#include <spinlock.h>
+#include <atomic.h>
 
 
 /*
@@ -46,7 +46,8 @@
  *
  * Open files are reference-counted because they get shared via fork
  * and dup2 calls. And they need locking because that sharing can be
- * among multiple concurrent processes.
+ * among multiple concurrent processes. The refcount is atomic, so
+ * that part needs no lock.
  */
 struct openfile {
 	struct vnode *of_vnode;
@@ -55,10 +56,12 @@ struct openfile {
 	struct lock *of_offsetlock;	/* lock for of_offset */
 	off_t of_offset;
 
-	struct spinlock of_reflock;	/* lock for of_refcount */
-	int of_refcount;
+	atomic_t of_refcount;
 };
 
+/* set up openfile allocation (called once during boot) */
+void openfile_bootstrap(void);
+
 /* open a file (args must be kernel pointers; destroys filename) */
 int openfile_open(char *filename, int openflags, mode_t mode,
 		  struct openfile **ret);
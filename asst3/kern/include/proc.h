@@ -41,12 +41,32 @@
 
 struct addrspace;
 struct vnode;
+struct lock;
+struct cv;
+
+/*
+ * User-level threads (see syscall/thread_syscalls.c). The thread a
+ * process starts with has id 0 and the ones it creates get ids 1 to
+ * UTHREAD_MAX, each with a slot in p_uthreads and a user stack of its
+ * own. A slot's stack stays mapped until the thread is joined.
+ */
+#define UTHREAD_MAX	16
+
+#define UT_FREE		0	/* Slot not in use */
+#define UT_RUNNING	1	/* Thread hasn't exited */
+#define UT_EXITED	2	/* Exited, waiting to be joined */
+
+struct uthread {
+	unsigned ut_state;		/* UT_* */
+	bool ut_mapped;			/* Stack region is defined */
+	userptr_t ut_retval;		/* Value given to thread_exit */
+};
 
 /*
  * Process structure.
  *
- * Note that unless you implement multithreaded processes, p_threads
- * will only contain one thread for all processes other than kproc.
+ * p_threads holds the kernel threads running the process's user
+ * threads; the address space and file table are shared among them.
  *
  * Note: you can't protect p_threads with a spinlock because it needs
  * to be able to call kmalloc.
@@ -65,6 +85,17 @@ struct proc {
 	struct vnode *p_cwd;		/* current working directory */
 	struct filetable *p_filetable;	/* table of open files */
 
+	/* Scheduling (see the stride class in thread.c) */
+	unsigned p_tickets;		/* stride tickets; 0 = default class */
+	uint64_t p_pass;		/* stride pass value */
+
+	/* User-level threads */
+	struct lock *p_utlock;		/* Lock for p_uthreads */
+	struct cv *p_utcv;		/* For thread_join, on p_utlock */
+	struct uthread p_uthreads[UTHREAD_MAX];
+	bool p_exiting;			/* Exiting; other threads must go */
+	int p_exitstatus;		/* Status to exit with */
+
 	/* add more material here as needed */
 };
 
@@ -88,12 +119,28 @@ void proc_destroy(struct proc *proc);
 
 /*
  * Cause the current process to exit. The current thread switches
- * itself into the kernel process.
+ * itself into the kernel process and exits; any other threads leave
+ * the next time they would go back to user mode, and the last one
+ * out finishes the job.
  *
  * The status code should be prepared with one of the _MKWAIT macros
- * defined in <kern/wait.h>.
+ * defined in <kern/wait.h>. If more than one thread calls this, the
+ * first one's status wins.
+ */
+__DEAD void proc_exit(int status);
+
+/*
+ * Make the current thread leave its process and exit. If it was the
+ * last one, the process exits too: with the status passed to
+ * proc_exit, or with 0 if nobody called that.
  */
-void proc_exit(int status);
+__DEAD void proc_thread_exit(void);
+
+/* Return how many threads PROC has. */
+unsigned proc_numthreads(struct proc *proc);
+
+/* Forget the current process's user threads, after exec. */
+void proc_execthreads(void);
 
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
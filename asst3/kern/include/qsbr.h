@@ -0,0 +1,43 @@
+#ifndef _QSBR_H_
+#define _QSBR_H_
+
+/*
+ * Quiescent-state-based reclamation (an RCU flavour).
+ *
+ * For read-mostly structures: readers look things up without taking
+ * any lock, and writers, who still lock against each other, unlink
+ * objects and hand them to qsbr_defer() instead of freeing them. The
+ * object is freed once every cpu has passed through a quiescent
+ * state, which is to say a context switch or the idle loop, so no
+ * reader can still be looking at it.
+ *
+ * qsbr_read_lock	Start a read-side section. Readers may not sleep
+ *			or yield until qsbr_read_unlock; like holding a
+ *			spinlock, this turns interrupts off so that we
+ *			can't be preempted. Sections nest.
+ * qsbr_read_unlock	End a read-side section.
+ * qsbr_defer		Call FUNC(ARG) after a grace period, from the
+ *			work queue (see workqueue.h), so FUNC may sleep.
+ *			The caller supplies QH, normally inside the
+ *			object being freed, and must already have made
+ *			the object unreachable for new readers.
+ * qsbr_quiescent	Note a quiescent state on this cpu. Called by
+ *			thread_switch; nothing else needs to.
+ *
+ * Writers publish a new object by filling it in, then calling
+ * membar_store_store(), then storing the pointer to it.
+ */
+
+struct qsbr_head {
+	struct qsbr_head *qh_next;	/* Next waiting callback */
+	unsigned qh_gen;		/* Grace period to wait for */
+	void (*qh_func)(void *);
+	void *qh_arg;
+};
+
+void qsbr_read_lock(void);
+void qsbr_read_unlock(void);
+void qsbr_defer(struct qsbr_head *qh, void (*func)(void *), void *arg);
+void qsbr_quiescent(void);
+
+#endif /* _QSBR_H_ */
@@ -42,6 +42,8 @@
 #include <fs.h>
 #include <vnode.h>
 
+struct kcache; /* in kcache.h */
+
 /*
  * Get on-disk structures and constants that are made available to
  * userland for the benefit of mksfs, dumpsfs, etc.
@@ -67,6 +69,7 @@ struct sfs_fs {
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct kcache *sfs_vnodecache;  /* allocator for struct sfs_vnode */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
 };
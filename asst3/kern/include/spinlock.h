@@ -51,30 +51,49 @@
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * A spinlock is either a test-and-set lock or a ticket lock, chosen
+ * when it is initialized. Test-and-set is cheapest when the lock is
+ * rarely contended, but nothing decides who gets it next when it is
+ * released, so with several cpus after it one can lose over and over,
+ * and every waiter's test-and-set writes the lock word. A ticket lock
+ * takes a number (splk_lock) and waits, only reading, until
+ * splk_serving reaches it, so cpus get the lock in the order they
+ * asked. Use it for locks that are hot on multiprocessors.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+	volatile spinlock_data_t splk_serving; /* Ticket lock: whose turn. */
+	bool splk_ticket;		    /* Ticket lock? */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
 };
 
 /*
- * Initializer for cases where a spinlock needs to be static or global.
+ * Initializers for cases where a spinlock needs to be static or global.
  */
 #ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, false, NULL, \
+				  HANGMAN_LOCKABLE_INITIALIZER }
+#define TICKETLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, true, NULL, \
 				  HANGMAN_LOCKABLE_INITIALIZER }
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, false, NULL }
+#define TICKETLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, true, NULL }
 #endif
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * init_ticket	Same, but make it a ticket lock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
@@ -84,6 +103,7 @@ struct spinlock {
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_ticket(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
@@ -37,6 +37,12 @@
 
 #include <spinlock.h>
 
+/*
+ * Initialize allocation of synchronization primitives. Called once
+ * during boot.
+ */
+void synch_bootstrap(void);
+
 /*
  * Dijkstra-style semaphore.
  *
@@ -71,6 +77,16 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Locks are adaptive: if the holder is running on another cpu, it
+ * will probably let go soon, so lock_acquire spins for a while
+ * before going to sleep. lk_spins counts acquisitions that were won
+ * by spinning and lk_sleeps the times a thread had to sleep; both are
+ * protected by lk_lock.
+ *
+ * Locks also do priority inheritance: a thread that blocks on a lock
+ * lends its scheduling priority to the holder until it is released.
+ * lk_waiters and lk_heldnext are for that; see synch.c.
  */
 struct lock {
         char *lk_name;
@@ -78,6 +94,10 @@ struct lock {
         struct wchan *lk_wchan;
         struct spinlock lk_lock;
         struct thread *volatile lk_holder;
+        unsigned long lk_spins;
+        unsigned long lk_sleeps;
+        struct thread *lk_waiters;      /* Threads blocked on the lock. */
+        struct lock *lk_heldnext;       /* Next lock the holder holds. */
 };
 
 struct lock *lock_create(const char *name);
@@ -87,6 +107,8 @@ void lock_destroy(struct lock *);
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
  *                   same time.
+ *    lock_tryacquire - Get the lock if nobody holds it, without waiting.
+ *                   Returns true if it got the lock.
  *    lock_release - Free the lock. Only the thread holding the lock may do
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock;
@@ -95,6 +117,7 @@ void lock_destroy(struct lock *);
  * These operations must be atomic. You get to write them.
  */
 void lock_acquire(struct lock *);
+bool lock_tryacquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 
@@ -115,8 +138,7 @@ bool lock_do_i_hold(struct lock *);
 
 struct cv {
         char *cv_name;
-        struct wchan *cv_wchan;
-        struct spinlock cv_wchanlock;
+        struct wchan *cv_wchan;         /* Protected by the lock's lk_lock. */
 };
 
 struct cv *cv_create(const char *name);
@@ -130,8 +152,12 @@ void cv_destroy(struct cv *);
  *    cv_broadcast - Wake up all threads sleeping on this CV.
  *
  * For all three operations, the current thread must hold the lock passed
- * in. Note that under normal circumstances the same lock should be used
- * on all operations with any particular CV.
+ * in. All threads waiting on a CV at the same time must use the same
+ * lock, since the CV borrows the lock's spinlock.
+ *
+ * cv_signal and cv_broadcast do not wake anyone up directly; they move
+ * waiters over to the lock, and each of them wakes up when the lock is
+ * released to it.
  *
  * These operations must be atomic. You get to write them.
  */
@@ -140,4 +166,53 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers can hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers queue
+ * up behind it. So that readers can't be starved in turn, a writer
+ * that releases the lock hands it straight to all the readers that
+ * were waiting, and writers and batches of readers take turns.
+ *
+ * A thread must not acquire the read side again while it holds it;
+ * if a writer has arrived in between, that deadlocks.
+ *
+ * The deadlock detector only sees the write side, since it can only
+ * record one holder: cycles through readers are not reported.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * (should be) made internally.
+ */
+struct rwlock {
+        char *rw_name;
+        HANGMAN_LOCKABLE(rw_hangman);   /* Deadlock detector hook. */
+        struct spinlock rw_lock;
+        struct wchan *rw_rwchan;        /* Readers wait here. */
+        struct wchan *rw_wwchan;        /* Writers wait here. */
+        struct thread *rw_writer;       /* Write holder, if any. */
+        unsigned rw_readers;            /* Number of read holders. */
+        unsigned rw_rwaiting;           /* Readers waiting. */
+        unsigned rw_wwaiting;           /* Writers waiting. */
+        unsigned rw_handoffs;           /* Hand-offs to readers so far. */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock shared.
+ *    rwlock_acquire_write - Get the lock exclusively.
+ *    rwlock_release       - Free the lock, whichever way it is held.
+ *    rwlock_do_i_hold     - Return true if the current thread holds
+ *                           the lock exclusively. There is no way to
+ *                           ask about read holds.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release(struct rwlock *);
+bool rwlock_do_i_hold(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
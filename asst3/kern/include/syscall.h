@@ -47,6 +47,10 @@ void syscall(struct trapframe *tf);
 /* Helper for fork(). You write this. */
 void enter_forked_process(struct trapframe *tf);
 
+/* Helper for thread_create(). Does not return. */
+__DEAD void enter_new_thread(struct trapframe *tf, vaddr_t entrypoint,
+			     vaddr_t stackptr, userptr_t arg0, userptr_t arg1);
+
 /* Enter user mode. Does not return. */
 __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 		       vaddr_t stackptr, vaddr_t entrypoint);
@@ -54,6 +58,17 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 /* Setup function for exec. */
 void exec_bootstrap(void);
 
+/*
+ * Initialize the futex wait table.
+ */
+void futex_bootstrap(void);
+
+/*
+ * Wake all futex sleepers in an address space, for process exit.
+ */
+struct addrspace;
+void futex_wakeall(struct addrspace *as);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -64,12 +79,21 @@ void exec_bootstrap(void);
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t req, userptr_t rem);
 
 int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t prog, userptr_t args);
 __DEAD void sys__exit(int code);
 int sys_waitpid(pid_t pid, userptr_t returncode, int flags, pid_t *retval);
 int sys_getpid(pid_t *retval);
+int sys_setpriority(pid_t pid, int prio);
+int sys_setaffinity(pid_t pid, uint32_t mask);
+int sys_settickets(pid_t pid, int tickets);
+int sys_futex(userptr_t uaddr, int op, int val, int32_t *retval);
+int sys___thread_create(struct trapframe *tf, userptr_t start,
+			userptr_t func, userptr_t arg, int32_t *retval);
+int sys_thread_join(int tid, userptr_t retp);
+__DEAD void sys_thread_exit(userptr_t ret);
 
 int sys_open(const_userptr_t filename, int flags, mode_t mode, int *retval);
 int sys_dup2(int oldfd, int newfd, int *retval);
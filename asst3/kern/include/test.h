@@ -57,6 +57,14 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int cvbench(int, char **);
+int pitest(int, char **);
+int rwtest(int, char **);
+int rwbench(int, char **);
+int spinbench(int, char **);
+int atomicbench(int, char **);
+int workqueuetest(int, char **);
+int forkbench(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -56,6 +56,9 @@ struct cpu;
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
 
+/* Affinity mask allowing every cpu. MAXCPUS must not exceed 32. */
+#define THREAD_AFFINITY_ALL	0xffffffff
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -85,6 +88,26 @@ struct thread {
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
+	/*
+	 * Scheduler fields. Changed only with interrupts off, and for
+	 * a thread on a run queue only with that queue's lock held.
+	 */
+	unsigned t_priority;		/* Current level; 0 is highest */
+	unsigned t_basepri;		/* Level set by setpriority */
+	unsigned t_ticks;		/* Hardclocks used at this level */
+	uint32_t t_affinity;		/* Cpus it may run on, by c_number */
+	unsigned t_migrations;		/* Times moved to another cpu */
+
+	/*
+	 * Priority inheritance (see synch.c). All but t_heldlocks are
+	 * protected by the inheritance spinlock there; t_inherit also
+	 * follows the rules for the scheduler fields above.
+	 */
+	unsigned t_inherit;		/* Inherited level, or SCHED_NPRIO */
+	struct lock *t_blockedon;	/* Lock we are waiting for */
+	struct thread *t_pinext;	/* Next waiter for that lock */
+	struct lock *t_heldlocks;	/* Locks we hold (only we touch) */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -106,6 +129,8 @@ struct thread {
 	 * Public fields
 	 */
 
+	unsigned t_utid;		/* User thread id in t_proc */
+
 	/* add more here as needed */
 };
 
@@ -164,10 +189,65 @@ void thread_yield(void);
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Charge the current thread for one timer tick. Returns true if it
+ * should yield the cpu. Called from the timer interrupt.
+ */
+bool thread_tick(void);
+
+/*
+ * Set the current thread's base scheduling priority, from 0 (highest)
+ * to SCHED_NPRIO-1. Threads it forks afterwards inherit it.
+ */
+void thread_setpriority(unsigned prio);
+
+/*
+ * Return the level thread T is scheduled at: its own, or the one it
+ * has inherited through a lock if that is higher.
+ */
+unsigned thread_getpriority(struct thread *t);
+
+/*
+ * Set the level thread T inherits, or SCHED_NPRIO for none. If T is
+ * waiting to run, it is moved to the matching run queue. Only for the
+ * lock code.
+ */
+void thread_setinherit(struct thread *t, unsigned prio);
+
+/*
+ * Put process P in the proportional-share (stride) class with TICKETS
+ * tickets, at most SCHED_MAXTICKETS, or back in the default class if
+ * TICKETS is 0. The default class counts as SCHED_TSTICKETS tickets
+ * on each cpu.
+ */
+#define SCHED_TSTICKETS		100
+#define SCHED_MAXTICKETS	10000
+void thread_settickets(struct proc *p, unsigned tickets);
+
+/*
+ * Give a newly forked process CHILD the stride tickets and pass of
+ * process PARENT.
+ */
+void thread_forktickets(struct proc *parent, struct proc *child);
+
+/*
+ * Restrict thread T to the cpus in MASK (bit N is the cpu with
+ * c_number N). Returns EINVAL if MASK names no cpu that exists. If T
+ * is the current thread and its cpu is no longer allowed, it moves at
+ * the next context switch.
+ */
+int thread_setaffinity(struct thread *t, uint32_t mask);
+
+/*
+ * Turn the per-cpu cache of thread stacks used by thread_fork on or
+ * off (it starts on). For benchmarking; see thread.c.
+ */
+void thread_stackcache_enable(bool on);
+
+/*
+ * Print the run queues and the running thread of every cpu, with
+ * per-thread priority, affinity, and migration count (menu "sched").
  */
-void thread_consider_migration(void);
+void thread_printsched(void);
 
 
 #endif /* _THREAD_H_ */
@@ -42,6 +42,7 @@ struct HPT {
   vaddr_t vpn;
   paddr_t entry_lo; 
   int32_t next; 
+  int32_t prev;   /* entry whose next is this one, or -1 */
 };
 
 
@@ -61,10 +62,34 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 int copy_HPT(uint32_t old, uint32_t new);
 void remove_HPT(uint32_t pid);
 
+/* Unmap and free user pages; the TLBs of all cpus are shot down first */
+struct addrspace;
+void vm_unmap(struct addrspace *as, vaddr_t vaddr, unsigned npages);
+
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Per-page owner tag for kernel pages, kept in the frame table (used
+ * by kmalloc to find a block's pageref in constant time). Pages start
+ * out with no owner (NULL). kpage_getowner returns KPAGE_UNTRACKED if
+ * the page allocator keeps no per-page data.
+ */
+#define KPAGE_UNTRACKED ((void *)1)
+void kpage_setowner(vaddr_t addr, void *owner);
+void *kpage_getowner(vaddr_t addr);
+
+/*
+ * Allocate/free kernel pages that are virtually but not physically
+ * contiguous (called by vmalloc/vfree). These live in kseg2 and are
+ * mapped by kvm_fault on a kernel TLB miss.
+ */
+void kvm_bootstrap(void);
+vaddr_t alloc_kvpages(unsigned npages);
+void free_kvpages(vaddr_t addr);
+int kvm_fault(vaddr_t faultaddress);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
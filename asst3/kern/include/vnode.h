@@ -30,7 +30,7 @@
 #ifndef _VNODE_H_
 #define _VNODE_H_
 
-#include <spinlock.h>
+#include <atomic.h>
 struct uio;
 struct stat;
 
@@ -49,8 +49,7 @@ struct stat;
  * Note: vn_fs may be null if the vnode refers to a device.
  */
 struct vnode {
-	int vn_refcount;                /* Reference count */
-	struct spinlock vn_countlock;   /* Lock for vn_refcount */
+	atomic_t vn_refcount;           /* Reference count */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
@@ -259,9 +258,15 @@ void vnode_check(struct vnode *, const char *op);
 
 /*
  * Reference count manipulation (handled above filesystem level)
+ *
+ * vnode_decref_unless_last drops a reference if it isn't the last
+ * one, and returns whether it did. VOP_RECLAIM uses it to give back
+ * the reference VOP_DECREF passed it, if someone else has picked the
+ * vnode up in the meantime.
  */
 void vnode_incref(struct vnode *);
 void vnode_decref(struct vnode *);
+bool vnode_decref_unless_last(struct vnode *);
 
 #define VOP_INCREF(vn) 			vnode_incref(vn)
 #define VOP_DECREF(vn) 			vnode_decref(vn)
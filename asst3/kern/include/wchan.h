@@ -38,6 +38,11 @@
 struct spinlock; /* in spinlock.h */
 struct wchan; /* Opaque */
 
+/*
+ * Initialize wait channel allocation. Called once during boot.
+ */
+void wchan_bootstrap(void);
+
 /*
  * Create a wait channel. Use NAME as a symbolic name for the channel.
  * NAME should be a string constant; if not, the caller is responsible
@@ -76,5 +81,15 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Move one thread sleeping on wait channel FROM over to wait channel
+ * TO without waking it. Both channels must use the same spinlock LK,
+ * which should be locked. Returns the thread moved, or NULL if there
+ * was none, so the caller can account for it (the CV code puts it on
+ * the lock's list of waiters); it stays asleep until LK is dropped.
+ */
+struct thread *wchan_moveone(struct wchan *from, struct wchan *to,
+			     struct spinlock *lk);
+
 
 #endif /* _WCHAN_H_ */
@@ -0,0 +1,56 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Deferred work.
+ *
+ * Each cpu has a worker thread, bound to it, that runs functions
+ * handed to it by workqueue_enqueue(). This lets interrupt handlers
+ * and other hot paths push work that may sleep, or just takes a
+ * while, out to thread context.
+ *
+ * workqueue_enqueue() arranges for FUNC(ARG) to be called soon by the
+ * worker of the calling cpu. It does not sleep or take any locks
+ * unless the worker is asleep, so it can be called from interrupt
+ * handlers. workqueue_enqueue_delayed() is the same, but waits TICKS
+ * hardclocks first (see timeout() in clock.h).
+ *
+ * As with struct timeout, the caller supplies the struct work and
+ * must not free it until FUNC has been called. It must start out
+ * zeroed, as static ones are. If W is still waiting to run,
+ * enqueueing it again does nothing and returns false; the pending
+ * call will happen, and it should pick up whatever this call was for.
+ * The worker marks W not pending just before calling FUNC, so FUNC
+ * may enqueue it again.
+ *
+ * The fields of struct work are private to workqueue.c.
+ */
+
+#include <clock.h>
+#include <atomic.h>
+
+struct workqueue;	/* Opaque; one per cpu. */
+
+struct work {
+	struct work *w_next;		/* Next on queue */
+	atomic_t w_pending;		/* 1 if queued or waiting on timer */
+	void (*w_func)(void *);
+	void *w_arg;
+	struct timespec w_queued;	/* When enqueued, for statistics */
+	struct timeout w_timeout;	/* For the delayed variant */
+};
+
+bool workqueue_enqueue(struct work *w, void (*func)(void *), void *arg);
+bool workqueue_enqueue_delayed(struct work *w, void (*func)(void *),
+			       void *arg, unsigned ticks);
+
+/* Create the queue for a new cpu. Returns NULL if out of memory. */
+struct workqueue *workqueue_create(void);
+
+/* Start the worker threads, once all the cpus are up. */
+void workqueue_bootstrap(void);
+
+/* Print queue depth and latency statistics. */
+void workqueue_printstats(void);
+
+#endif /* _WORKQUEUE_H_ */
@@ -64,7 +64,8 @@ bitmap_create(unsigned nbits)
         if (b == NULL) {
                 return NULL;
         }
-        b->v = kmalloc(words*sizeof(WORD_TYPE));
+        /* Filesystem freemaps can be large; they needn't be contiguous. */
+        b->v = vmalloc(words*sizeof(WORD_TYPE));
         if (b->v == NULL) {
                 kfree(b);
                 return NULL;
@@ -171,6 +172,6 @@ bitmap_isset(struct bitmap *b, unsigned index)
 void
 bitmap_destroy(struct bitmap *b)
 {
-        kfree(b->v);
+        vfree(b->v);
         kfree(b);
 }
@@ -42,12 +42,15 @@
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
 #include <vm.h>
 #include <mainbus.h>
 #include <vfs.h>
 #include <device.h>
 #include <pid.h>
 #include <syscall.h>
+#include <openfile.h>
+#include <workqueue.h>
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
@@ -109,6 +112,8 @@ boot(void)
 
 	/* Early initialization. */
 	ram_bootstrap();
+	wchan_bootstrap();
+	synch_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
 	pid_bootstrap();
@@ -130,7 +135,10 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	exec_bootstrap();
+	futex_bootstrap();
+	openfile_bootstrap();
 	thread_start_cpus();
+	workqueue_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
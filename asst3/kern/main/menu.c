@@ -37,12 +37,15 @@
 #include <uio.h>
 #include <clock.h>
 #include <mainbus.h>
+#include <cpu.h>
 #include <synch.h>
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
 #include <sfs.h>
 #include <pid.h>
+#include <kcache.h>
+#include <workqueue.h>
 #include <syscall.h>
 #include <test.h>
 #include "opt-sfs.h"
@@ -467,6 +470,7 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+	kcache_printstats();
 
 	return 0;
 }
@@ -576,6 +580,14 @@ static const char *testmenu[] = {
 	"[sy2] Lock test                     ",
 	"[sy3] CV test                       ",
 	"[sy4] CV test #2                    ",
+	"[sy5] CV contention benchmark       ",
+	"[pi]  Priority inheritance test     ",
+	"[rwt1] Reader-writer lock test      ",
+	"[rwt2] Reader-writer lock benchmark ",
+	"[spb] Spinlock benchmark            ",
+	"[atb] Atomic counter benchmark      ",
+	"[wqt] Work queue test               ",
+	"[ftb] Thread fork benchmark         ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[wt]  waitpid test                  ",
 	"[fs1] Filesystem test               ",
@@ -600,12 +612,73 @@ cmd_testmenu(int n, char **a)
 	return 0;
 }
 
+static
+int
+cmd_kheapprofile(int nargs, char **args)
+{
+	unsigned topn = 10;
+
+	if (nargs == 2) {
+		topn = atoi(args[1]);
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: khprof [count]\n");
+		return EINVAL;
+	}
+	kheap_profile(topn);
+	/* kcache objects aren't in the profile; show them alongside */
+	kcache_printstats();
+	kprintf("\n");
+
+	return 0;
+}
+
+static
+int
+cmd_counters(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	pcpu_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_sched(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printsched();
+
+	return 0;
+}
+
+static
+int
+cmd_workqueue(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	workqueue_printstats();
+
+	return 0;
+}
+
 static const char *mainmenu[] = {
 	"[?o] Operations menu                ",
 	"[?t] Tests menu                     ",
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[khprof] Kernel heap profile        ",
+	"[ctr] Kernel event counters         ",
+	"[sched] Run queues and threads      ",
+	"[wq] Work queue stats               ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -657,6 +730,10 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "khprof",     cmd_kheapprofile },
+	{ "ctr",        cmd_counters },
+	{ "sched",      cmd_sched },
+	{ "wq",         cmd_workqueue },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -679,6 +756,14 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	cvbench },
+	{ "pi",		pitest },
+	{ "rwt1",	rwtest },
+	{ "rwt2",	rwbench },
+	{ "spb",	spinbench },
+	{ "atb",	atomicbench },
+	{ "wqt",	workqueuetest },
+	{ "ftb",	forkbench },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
@@ -38,10 +38,14 @@
 #include <lib.h>
 #include <array.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
+#include <kcache.h>
+#include <membar.h>
+#include <qsbr.h>
 #include <pid.h>
 
 /*
@@ -50,13 +54,17 @@
  * If pi_ppid is INVALID_PID, the parent has gone away and will not be
  * waiting. If pi_ppid is INVALID_PID and pi_exited is true, the
  * structure can be freed.
+ *
+ * pi_exited and pi_exitstatus are set with pidlock held, and waiters
+ * sleep on pi_cv with pidlock.
  */
 struct pidinfo {
 	pid_t pi_pid;			// process id of this thread
-	pid_t pi_ppid;			// process id of parent thread
+	volatile pid_t pi_ppid;		// process id of parent thread
 	volatile bool pi_exited;	// true if thread has exited
 	int pi_exitstatus;		// status (only valid if exited)
 	struct cv *pi_cv;		// use to wait for thread exit
+	struct qsbr_head pi_qsbr;	// for freeing after a grace period
 };
 
 
@@ -67,11 +75,44 @@ struct pidinfo {
  * (pid % PROCS_MAX), and only allows one process per slot. If a
  * new pid allocation would cause a hash collision, we just don't
  * use that pid.
+ *
+ * Changes to the table are made holding pidlock. Lookups that only
+ * read can instead use a qsbr read-side section (see qsbr.h): a
+ * pidinfo is filled in before it is put in the table, and once taken
+ * out it isn't freed until every cpu has been through a context
+ * switch, so a reader never sees one half made or already freed.
  */
 static struct lock *pidlock;		// lock for global exit data
-static struct pidinfo *pidinfo[PROCS_MAX]; // actual pid info
+static struct pidinfo *volatile pidinfo[PROCS_MAX]; // actual pid info
 static pid_t nextpid;			// next candidate pid
 static int nprocs;			// number of allocated pids
+static struct kcache *pidinfo_cache;	// pidinfo allocation, with pi_cv
+
+/*
+ * Constructor/destructor for cached pidinfo structures: the cv is made
+ * once per object rather than once per process.
+ */
+static
+int
+pidinfo_ctor(void *obj)
+{
+	struct pidinfo *pi = obj;
+
+	pi->pi_cv = cv_create("pidinfo cv");
+	if (pi->pi_cv == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+pidinfo_dtor(void *obj)
+{
+	struct pidinfo *pi = obj;
+
+	cv_destroy(pi->pi_cv);
+}
 
 
 
@@ -86,17 +127,11 @@ pidinfo_create(pid_t pid, pid_t ppid)
 
 	KASSERT(pid != INVALID_PID);
 
-	pi = kmalloc(sizeof(struct pidinfo));
+	pi = kcache_alloc(pidinfo_cache);
 	if (pi==NULL) {
 		return NULL;
 	}
 
-	pi->pi_cv = cv_create("pidinfo cv");
-	if (pi->pi_cv == NULL) {
-		kfree(pi);
-		return NULL;
-	}
-
 	pi->pi_pid = pid;
 	pi->pi_ppid = ppid;
 	pi->pi_exited = false;
@@ -114,8 +149,17 @@ pidinfo_destroy(struct pidinfo *pi)
 {
 	KASSERT(pi->pi_exited == true);
 	KASSERT(pi->pi_ppid == INVALID_PID);
-	cv_destroy(pi->pi_cv);
-	kfree(pi);
+	kcache_free(pidinfo_cache, pi);
+}
+
+/*
+ * qsbr callback to destroy a pidinfo once no reader can have it.
+ */
+static
+void
+pidinfo_reclaim(void *data)
+{
+	pidinfo_destroy(data);
 }
 
 ////////////////////////////////////////////////////////////
@@ -133,6 +177,12 @@ pid_bootstrap(void)
 		panic("Out of memory creating pid lock\n");
 	}
 
+	pidinfo_cache = kcache_create("pidinfo", sizeof(struct pidinfo),
+				      pidinfo_ctor, pidinfo_dtor);
+	if (pidinfo_cache == NULL) {
+		panic("Out of memory creating pidinfo cache\n");
+	}
+
 	/* not really necessary - should start zeroed */
 	for (i=0; i<PROCS_MAX; i++) {
 		pidinfo[i] = NULL;
@@ -148,7 +198,8 @@ pid_bootstrap(void)
 }
 
 /*
- * pi_get: look up a pidinfo in the process table.
+ * pi_get: look up a pidinfo in the process table. The caller must
+ * hold pidlock or be in a qsbr read-side section.
  */
 static
 struct pidinfo *
@@ -158,12 +209,13 @@ pi_get(pid_t pid)
 
 	KASSERT(pid>=0);
 	KASSERT(pid != INVALID_PID);
-	KASSERT(lock_do_i_hold(pidlock));
+	KASSERT(lock_do_i_hold(pidlock) || curcpu->c_qsbr_readers > 0);
 
 	pi = pidinfo[pid % PROCS_MAX];
 	if (pi==NULL) {
 		return NULL;
 	}
+	membar_load_load();
 	if (pi->pi_pid != pid) {
 		return NULL;
 	}
@@ -183,14 +235,16 @@ pi_put(pid_t pid, struct pidinfo *pi)
 	KASSERT(pid != INVALID_PID);
 
 	KASSERT(pidinfo[pid % PROCS_MAX] == NULL);
+	/* finish filling it in before lockless readers can see it */
+	membar_store_store();
 	pidinfo[pid % PROCS_MAX] = pi;
 	nprocs++;
 }
 
 /*
  * pi_drop: remove a pidinfo structure from the process table and free
- * it. It should reflect a process that has already exited and been
- * waited for.
+ * it once no lockless reader can be looking at it. It should reflect
+ * a process that has already exited and been waited for.
  */
 static
 void
@@ -204,8 +258,10 @@ pi_drop(pid_t pid)
 	KASSERT(pi != NULL);
 	KASSERT(pi->pi_pid == pid);
 
-	pidinfo_destroy(pi);
+	KASSERT(pi->pi_exited == true);
+	KASSERT(pi->pi_ppid == INVALID_PID);
 	pidinfo[pid % PROCS_MAX] = NULL;
+	qsbr_defer(&pi->pi_qsbr, pidinfo_reclaim, pi);
 	nprocs--;
 }
 
@@ -302,6 +358,9 @@ pid_unalloc(pid_t theirpid)
 	them->pi_exited = true;
 	them->pi_ppid = INVALID_PID;
 
+	/* another of our threads may already be waiting for it */
+	cv_broadcast(them->pi_cv, pidlock);
+
 	pi_drop(theirpid);
 
 	lock_release(pidlock);
@@ -368,14 +427,12 @@ pid_setexitstatus(int status)
 
 	us->pi_exitstatus = status;
 	us->pi_exited = true;
+	cv_broadcast(us->pi_cv, pidlock);
 
 	if (us->pi_ppid == INVALID_PID) {
 		/* no parent */
 		pi_drop(curproc->p_pid);
 	}
-	else {
-		cv_broadcast(us->pi_cv, pidlock);
-	}
 
 	curproc->p_pid = INVALID_PID;
 	lock_release(pidlock);
@@ -415,11 +472,18 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 		return EINVAL;
 	}
 
-	lock_acquire(pidlock);
+	/*
+	 * Do the lookup and checks without pidlock, so waits that fail
+	 * or find nothing to collect (WNOHANG polling) don't hold up
+	 * anyone else. THEM is only good until qsbr_read_unlock: once
+	 * we might sleep, a grace period can pass and it can be freed,
+	 * so everything after that looks it up again under pidlock.
+	 */
+	qsbr_read_lock();
 
 	them = pi_get(theirpid);
 	if (them==NULL) {
-		lock_release(pidlock);
+		qsbr_read_unlock();
 		return ESRCH;
 	}
 
@@ -427,20 +491,36 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 
 	/* Only allow waiting for own children. */
 	if (them->pi_ppid != curproc->p_pid) {
-		lock_release(pidlock);
+		qsbr_read_unlock();
 		return EPERM;
 	}
 
-	if (them->pi_exited == false) {
-		if (flags == WNOHANG) {
+	if (them->pi_exited == false && flags == WNOHANG) {
+		qsbr_read_unlock();
+		KASSERT(ret != NULL);
+		*ret = 0;
+		return 0;
+	}
+	qsbr_read_unlock();
+
+	/*
+	 * Another thread of this process may be waiting for the same
+	 * child and collect it first, so THEM may be dropped whenever
+	 * we don't hold pidlock. Look it up again each time we get the
+	 * lock back, and give up if it's gone; only the thread that
+	 * finds it exited collects the status and drops it.
+	 */
+	lock_acquire(pidlock);
+	while (1) {
+		them = pi_get(theirpid);
+		if (them == NULL || them->pi_ppid != curproc->p_pid) {
 			lock_release(pidlock);
-			KASSERT(ret != NULL);
-			*ret = 0;
-			return 0;
+			return ECHILD;
+		}
+		if (them->pi_exited) {
+			break;
 		}
-		/* don't need to loop on this */
 		cv_wait(them->pi_cv, pidlock);
-		KASSERT(them->pi_exited == true);
 	}
 
 	if (status != NULL) {
@@ -457,7 +537,7 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 		*ret = theirpid;
 	}
 
-	them->pi_ppid = 0;
+	them->pi_ppid = INVALID_PID;
 	pi_drop(them->pi_pid);
 
 	lock_release(pidlock);
@@ -38,26 +38,72 @@
  * things they point to. Rearrange this (and/or change it to be a
  * regular lock) as needed.
  *
- * Unless you're implementing multithreaded user processes, the only
- * process that will have more than one thread is the kernel process.
+ * User processes can have more than one thread too; see
+ * syscall/thread_syscalls.c.
  */
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/wait.h>
 #include <spl.h>
 #include <synch.h>
+#include <kcache.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <pid.h>
 #include <filetable.h>
+#include <syscall.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+/*
+ * Cache of proc structures. Objects in the cache keep p_lock,
+ * p_threadslock, p_utlock, and p_utcv initialized; see proc_ctor.
+ */
+static struct kcache *proc_cache;
+
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	proc->p_threadslock = lock_create("p_threads");
+	if (proc->p_threadslock == NULL) {
+		return ENOMEM;
+	}
+	proc->p_utlock = lock_create("p_uthreads");
+	if (proc->p_utlock == NULL) {
+		lock_destroy(proc->p_threadslock);
+		return ENOMEM;
+	}
+	proc->p_utcv = cv_create("thread_join");
+	if (proc->p_utcv == NULL) {
+		lock_destroy(proc->p_utlock);
+		lock_destroy(proc->p_threadslock);
+		return ENOMEM;
+	}
+	spinlock_init(&proc->p_lock);
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	spinlock_cleanup(&proc->p_lock);
+	cv_destroy(proc->p_utcv);
+	lock_destroy(proc->p_utlock);
+	lock_destroy(proc->p_threadslock);
+}
+
 /*
  * Create a proc structure.
  */
@@ -66,26 +112,21 @@ struct proc *
 proc_create(const char *name)
 {
 	struct proc *proc;
+	unsigned i;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kcache_alloc(proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kcache_free(proc_cache, proc);
 		return NULL;
 	}
 
-	proc->p_threadslock = lock_create("p_threads");
-	if (proc->p_threadslock == NULL) {
-		kfree(proc->p_name);
-		kfree(proc);
-		return NULL;
-	}
+	/* p_threadslock and p_lock come initialized from the cache */
 	threadarray_init(&proc->p_threads);
 
-	spinlock_init(&proc->p_lock);
 	proc->p_pid = INVALID_PID;
 
 	/* VM fields */
@@ -95,6 +136,19 @@ proc_create(const char *name)
 	proc->p_cwd = NULL;
 	proc->p_filetable = NULL;
 
+	/* Scheduling fields */
+	proc->p_tickets = 0;
+	proc->p_pass = 0;
+
+	/* User-level threads */
+	for (i=0; i<UTHREAD_MAX; i++) {
+		proc->p_uthreads[i].ut_state = UT_FREE;
+		proc->p_uthreads[i].ut_mapped = false;
+		proc->p_uthreads[i].ut_retval = NULL;
+	}
+	proc->p_exiting = false;
+	proc->p_exitstatus = 0;
+
 	return proc;
 }
 
@@ -183,12 +237,12 @@ proc_destroy(struct proc *proc)
 	}
 
 	KASSERT(proc->p_pid == INVALID_PID);
-	spinlock_cleanup(&proc->p_lock);
 	threadarray_cleanup(&proc->p_threads);
-	lock_destroy(proc->p_threadslock);
+
+	/* the locks and p_utcv stay initialized in the cache */
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kcache_free(proc_cache, proc);
 }
 
 /*
@@ -197,6 +251,12 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	proc_cache = kcache_create("proc", sizeof(struct proc),
+				   proc_ctor, proc_dtor);
+	if (proc_cache == NULL) {
+		panic("proc_bootstrap: Out of memory\n");
+	}
+
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
@@ -268,6 +328,7 @@ proc_fork(struct proc **ret)
 	struct proc *newproc;
 	struct addrspace *as;
 	struct filetable *tbl;
+	unsigned i;
 	int result;
 
 	newproc = proc_create(curproc->p_name);
@@ -291,11 +352,16 @@ proc_fork(struct proc **ret)
 	}
 #endif
 
-	/* VM fields */
+	/*
+	 * VM fields. Hold p_utlock so that other threads can't add or
+	 * remove thread stacks while we copy.
+	 */
+	lock_acquire(curproc->p_utlock);
 	as = proc_getas();
 	if (as != NULL) {
 		result = as_copy(as, &newproc->p_addrspace);
 		if (result) {
+			lock_release(curproc->p_utlock);
 			pid_unalloc(newproc->p_pid);
 			newproc->p_pid = INVALID_PID;
 			proc_destroy(newproc);
@@ -303,6 +369,20 @@ proc_fork(struct proc **ret)
 		}
 	}
 
+	/*
+	 * Only the calling thread goes with the new process. The other
+	 * threads' stacks were copied along with everything else, so
+	 * mark those slots free but mapped, for reuse.
+	 */
+	for (i=0; i<UTHREAD_MAX; i++) {
+		newproc->p_uthreads[i].ut_mapped =
+			curproc->p_uthreads[i].ut_mapped;
+		if (i + 1 == curthread->t_utid) {
+			newproc->p_uthreads[i].ut_state = UT_RUNNING;
+		}
+	}
+	lock_release(curproc->p_utlock);
+
 	/* VFS fields */
 	tbl = curproc->p_filetable;
 	if (tbl != NULL) {
@@ -329,6 +409,9 @@ proc_fork(struct proc **ret)
 	}
 	spinlock_release(&curproc->p_lock);
 
+	/* Inherit the scheduling share. */
+	thread_forktickets(curproc, newproc);
+
 	*ret = newproc;
 	return 0;
 }
@@ -344,6 +427,50 @@ proc_unfork(struct proc *newproc)
 	proc_destroy(newproc);
 }
 
+/*
+ * Remove a thread from its process's thread array. The caller holds
+ * p_threadslock.
+ */
+static
+void
+proc_remthread_locked(struct proc *proc, struct thread *t)
+{
+	unsigned num, i;
+
+	KASSERT(lock_do_i_hold(proc->p_threadslock));
+
+	/* ugh: find the thread in the array */
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		if (threadarray_get(&proc->p_threads, i) == t) {
+			threadarray_remove(&proc->p_threads, i);
+			return;
+		}
+	}
+	/* Did not find it. */
+	lock_release(proc->p_threadslock);
+	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
+}
+
+/*
+ * Clear t_proc once the thread is out of the array.
+ *
+ * Turn off interrupts on the local cpu while changing t_proc, in
+ * case it's current, to protect against the as_activate call in
+ * the timer interrupt context switch, and any other implicit uses
+ * of "curproc".
+ */
+static
+void
+proc_clearthread(struct thread *t)
+{
+	int spl;
+
+	spl = splhigh();
+	t->t_proc = NULL;
+	splx(spl);
+}
+
 /*
  * Make the current process exit.
  */
@@ -355,6 +482,60 @@ proc_exit(int status)
 	/* The kernel isn't supposed to exit. */
 	KASSERT(proc != kproc);
 
+	spinlock_acquire(&proc->p_lock);
+	if (!proc->p_exiting) {
+		proc->p_exiting = true;
+		proc->p_exitstatus = status;
+	}
+	spinlock_release(&proc->p_lock);
+
+	/*
+	 * Get the other threads out of the waits they can be woken
+	 * from; they check p_exiting afterwards. Threads sleeping
+	 * elsewhere in the kernel finish that first.
+	 */
+	lock_acquire(proc->p_utlock);
+	cv_broadcast(proc->p_utcv, proc->p_utlock);
+	lock_release(proc->p_utlock);
+	futex_wakeall(proc_getas());
+
+	proc_thread_exit();
+}
+
+/*
+ * Make the current thread leave its process.
+ */
+void
+proc_thread_exit(void)
+{
+	struct proc *proc = curproc;
+	bool last;
+	int status;
+
+	KASSERT(proc != kproc);
+
+	/*
+	 * Only threads in the process add threads to it, so once we're
+	 * the only one we stay that way. Deciding and leaving under the
+	 * same lock means exactly one thread ends up last.
+	 */
+	lock_acquire(proc->p_threadslock);
+	last = threadarray_num(&proc->p_threads) == 1;
+	if (!last) {
+		proc_remthread_locked(proc, curthread);
+	}
+	lock_release(proc->p_threadslock);
+
+	if (!last) {
+		proc_clearthread(curthread);
+		proc_addthread(kproc, curthread);
+		thread_exit();
+	}
+
+	spinlock_acquire(&proc->p_lock);
+	status = proc->p_exiting ? proc->p_exitstatus : _MKWAIT_EXIT(0);
+	spinlock_release(&proc->p_lock);
+
 	/* Set exit status and wake up anyone waiting for us. */
 	pid_setexitstatus(status);
 
@@ -406,49 +587,61 @@ proc_addthread(struct proc *proc, struct thread *t)
 /*
  * Remove a thread from its process. Either the thread or the process
  * might or might not be current.
- *
- * Turn off interrupts on the local cpu while changing t_proc, in
- * case it's current, to protect against the as_activate call in
- * the timer interrupt context switch, and any other implicit uses
- * of "curproc".
  */
 void
 proc_remthread(struct thread *t)
 {
 	struct proc *proc;
-	unsigned num, i;
-	int spl;
 
 	proc = t->t_proc;
 	KASSERT(proc != NULL);
 
 	lock_acquire(proc->p_threadslock);
-	/* ugh: find the thread in the array */
+	proc_remthread_locked(proc, t);
+	lock_release(proc->p_threadslock);
+
+	proc_clearthread(t);
+}
+
+/*
+ * Return the number of threads in a process.
+ */
+unsigned
+proc_numthreads(struct proc *proc)
+{
+	unsigned num;
+
+	lock_acquire(proc->p_threadslock);
 	num = threadarray_num(&proc->p_threads);
-	for (i=0; i<num; i++) {
-		if (threadarray_get(&proc->p_threads, i) == t) {
-			threadarray_remove(&proc->p_threads, i);
-			lock_release(proc->p_threadslock);
-			goto finish;
-		}
-	}
-	/* Did not find it. */
 	lock_release(proc->p_threadslock);
-	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
+	return num;
+}
 
-finish:
-	spl = splhigh();
-	t->t_proc = NULL;
-	splx(spl);
+/*
+ * After exec: the old address space and the thread stacks in it are
+ * gone, and the caller (the only thread) becomes thread 0.
+ */
+void
+proc_execthreads(void)
+{
+	struct proc *proc = curproc;
+	unsigned i;
+
+	lock_acquire(proc->p_utlock);
+	for (i=0; i<UTHREAD_MAX; i++) {
+		proc->p_uthreads[i].ut_state = UT_FREE;
+		proc->p_uthreads[i].ut_mapped = false;
+	}
+	curthread->t_utid = 0;
+	lock_release(proc->p_utlock);
 }
 
 /*
  * Fetch the address space of (the current) process.
  *
- * Caution: address spaces aren't refcounted. If you implement
- * multithreaded processes, make sure to set up a refcount scheme or
- * some other method to make this safe. Otherwise the returned address
- * space might disappear under you.
+ * Address spaces aren't refcounted. That's safe because all the threads
+ * sharing one are in the same process, the last of them destroys it,
+ * and exec only replaces it when there's just one thread.
  */
 struct addrspace *
 proc_getas(void)
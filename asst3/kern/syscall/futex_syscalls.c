@@ -0,0 +1,215 @@
+/*
+ * Futexes: user-level sleep and wakeup on a word of memory.
+ *
+ * User code does its locking with atomic instructions on a word of
+ * its own memory and only comes here when it has to wait, or when
+ * someone might be waiting. FUTEX_WAIT sleeps if the word still holds
+ * the value the caller last saw; FUTEX_WAKE wakes sleepers on it.
+ *
+ * Sleepers are found by (address space, user address) in a hashed
+ * wait table. Each bucket has a spinlock and a FIFO list of waiter
+ * records, which live on the sleeping threads' stacks.
+ *
+ * Reading the word means copyin, which can fault and sleep, so it
+ * can't be done under the bucket lock. Instead a waiter goes on the
+ * list first and reads the word afterwards. Wakers change the word
+ * before they call in, so either the waiter sees the new value, or
+ * the waker finds the waiter on the list.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+#define FUTEX_HASHSIZE	64
+
+struct futex_waiter {
+	struct addrspace *fw_as;	/* key: address space */
+	userptr_t fw_uaddr;		/* key: user address */
+	struct wchan *fw_wchan;		/* where we sleep */
+	bool fw_woken;			/* set by futex_wake */
+	struct futex_waiter *fw_next;	/* bucket list */
+};
+
+struct futex_bucket {
+	struct spinlock fb_lock;
+	struct futex_waiter *fb_waiters;
+};
+
+static struct futex_bucket futex_table[FUTEX_HASHSIZE];
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_HASHSIZE; i++) {
+		spinlock_init(&futex_table[i].fb_lock);
+		futex_table[i].fb_waiters = NULL;
+	}
+}
+
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, userptr_t uaddr)
+{
+	uintptr_t h;
+
+	h = (uintptr_t)uaddr / sizeof(int);
+	h ^= (uintptr_t)as / sizeof(void *);
+	return &futex_table[h % FUTEX_HASHSIZE];
+}
+
+/*
+ * Sleep on UADDR if it holds VAL. Returns EAGAIN if it doesn't.
+ */
+static
+int
+futex_wait(userptr_t uaddr, int val)
+{
+	struct futex_waiter fw, **fwp;
+	struct futex_bucket *fb;
+	int cur, result;
+
+	fw.fw_as = proc_getas();
+	fw.fw_uaddr = uaddr;
+	fw.fw_woken = false;
+	fw.fw_next = NULL;
+	fw.fw_wchan = wchan_create("futex");
+	if (fw.fw_wchan == NULL) {
+		return ENOMEM;
+	}
+
+	fb = futex_hash(fw.fw_as, uaddr);
+	spinlock_acquire(&fb->fb_lock);
+	for (fwp = &fb->fb_waiters; *fwp != NULL; fwp = &(*fwp)->fw_next) {
+		/* nothing */
+	}
+	*fwp = &fw;
+	spinlock_release(&fb->fb_lock);
+
+	result = copyin((const_userptr_t)uaddr, &cur, sizeof(cur));
+	if (result == 0 && cur != val) {
+		result = EAGAIN;
+	}
+
+	spinlock_acquire(&fb->fb_lock);
+	if (result == 0 && curproc->p_exiting) {
+		/* Don't hold up the process exiting (see futex_wakeall) */
+		result = EINTR;
+	}
+	if (fw.fw_woken) {
+		/* Someone already took us off the list; count it. */
+		result = 0;
+	}
+	else if (result) {
+		fwp = &fb->fb_waiters;
+		while (*fwp != &fw) {
+			KASSERT(*fwp != NULL);
+			fwp = &(*fwp)->fw_next;
+		}
+		*fwp = fw.fw_next;
+	}
+	else {
+		while (!fw.fw_woken) {
+			wchan_sleep(fw.fw_wchan, &fb->fb_lock);
+		}
+	}
+	spinlock_release(&fb->fb_lock);
+
+	wchan_destroy(fw.fw_wchan);
+	return result;
+}
+
+/*
+ * Wake up to COUNT sleepers on UADDR, oldest first. Returns the number
+ * woken in RETVAL.
+ */
+static
+int
+futex_wake(userptr_t uaddr, int count, int32_t *retval)
+{
+	struct futex_waiter *fw, **fwp;
+	struct futex_bucket *fb;
+	struct addrspace *as;
+	int woken;
+
+	as = proc_getas();
+	fb = futex_hash(as, uaddr);
+
+	woken = 0;
+	spinlock_acquire(&fb->fb_lock);
+	fwp = &fb->fb_waiters;
+	while (*fwp != NULL && woken < count) {
+		fw = *fwp;
+		if (fw->fw_as != as || fw->fw_uaddr != uaddr) {
+			fwp = &fw->fw_next;
+			continue;
+		}
+		*fwp = fw->fw_next;
+		fw->fw_woken = true;
+		wchan_wakeone(fw->fw_wchan, &fb->fb_lock);
+		woken++;
+	}
+	spinlock_release(&fb->fb_lock);
+
+	*retval = woken;
+	return 0;
+}
+
+/*
+ * Wake every sleeper in address space AS, because its process is
+ * exiting. Threads that get to futex_wait after this see p_exiting
+ * and don't sleep.
+ */
+void
+futex_wakeall(struct addrspace *as)
+{
+	struct futex_waiter *fw, **fwp;
+	struct futex_bucket *fb;
+	unsigned i;
+
+	for (i=0; i<FUTEX_HASHSIZE; i++) {
+		fb = &futex_table[i];
+		spinlock_acquire(&fb->fb_lock);
+		fwp = &fb->fb_waiters;
+		while (*fwp != NULL) {
+			fw = *fwp;
+			if (fw->fw_as != as) {
+				fwp = &fw->fw_next;
+				continue;
+			}
+			*fwp = fw->fw_next;
+			fw->fw_woken = true;
+			wchan_wakeone(fw->fw_wchan, &fb->fb_lock);
+		}
+		spinlock_release(&fb->fb_lock);
+	}
+}
+
+int
+sys_futex(userptr_t uaddr, int op, int val, int32_t *retval)
+{
+	if ((uintptr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+
+	*retval = 0;
+	switch (op) {
+	    case FUTEX_WAIT:
+		return futex_wait(uaddr, val);
+	    case FUTEX_WAKE:
+		if (val < 0) {
+			return EINVAL;
+		}
+		return futex_wake(uaddr, val, retval);
+	}
+	return EINVAL;
+}
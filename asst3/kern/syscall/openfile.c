@@ -36,9 +36,51 @@
 #include <kern/fcntl.h>
 #include <lib.h>
 #include <synch.h>
+#include <kcache.h>
 #include <vfs.h>
 #include <openfile.h>
 
+static struct kcache *openfile_cache;
+
+/*
+ * Cache constructor/destructor: of_offsetlock stays initialized while
+ * the object sits in the cache.
+ */
+static
+int
+openfile_ctor(void *obj)
+{
+	struct openfile *file = obj;
+
+	file->of_offsetlock = lock_create("openfile");
+	if (file->of_offsetlock == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+openfile_dtor(void *obj)
+{
+	struct openfile *file = obj;
+
+	lock_destroy(file->of_offsetlock);
+}
+
+/*
+ * Set up the openfile cache.
+ */
+void
+openfile_bootstrap(void)
+{
+	openfile_cache = kcache_create("openfile", sizeof(struct openfile),
+				       openfile_ctor, openfile_dtor);
+	if (openfile_cache == NULL) {
+		panic("openfile_bootstrap: Out of memory\n");
+	}
+}
+
 /*
  * Constructor for struct openfile.
  */
@@ -53,23 +95,15 @@ openfile_create(struct vnode *vn, int accmode)
 		accmode == O_WRONLY ||
 		accmode == O_RDWR);
 
-	file = kmalloc(sizeof(struct openfile));
+	file = kcache_alloc(openfile_cache);
 	if (file == NULL) {
 		return NULL;
 	}
 
-	file->of_offsetlock = lock_create("openfile");
-	if (file->of_offsetlock == NULL) {
-		kfree(file);
-		return NULL;
-	}
-
-	spinlock_init(&file->of_reflock);
-
 	file->of_vnode = vn;
 	file->of_accmode = accmode;
 	file->of_offset = 0;
-	file->of_refcount = 1;
+	atomic_set(&file->of_refcount, 1);
 
 	return file;
 }
@@ -85,9 +119,7 @@ openfile_destroy(struct openfile *file)
 	/* balance vfs_open with vfs_close (not VOP_DECREF) */
 	vfs_close(file->of_vnode);
 
-	spinlock_cleanup(&file->of_reflock);
-	lock_destroy(file->of_offsetlock);
-	kfree(file);
+	kcache_free(openfile_cache, file);
 }
 
 /*
@@ -122,9 +154,7 @@ openfile_open(char *filename, int openflags, mode_t mode,
 void
 openfile_incref(struct openfile *file)
 {
-	spinlock_acquire(&file->of_reflock);
-	file->of_refcount++;
-	spinlock_release(&file->of_reflock);
+	atomic_add(&file->of_refcount, 1);
 }
 
 /*
@@ -134,16 +164,13 @@ openfile_incref(struct openfile *file)
 void
 openfile_decref(struct openfile *file)
 {
-	spinlock_acquire(&file->of_reflock);
+	int old;
+
+	old = atomic_fetch_add(&file->of_refcount, -1);
+	KASSERT(old > 0);
 
 	/* if this is the last close of this file, free it up */
-	if (file->of_refcount == 1) {
-		spinlock_release(&file->of_reflock);
+	if (old == 1) {
 		openfile_destroy(file);
 	}
-	else {
-		KASSERT(file->of_refcount > 1);
-		file->of_refcount--;
-		spinlock_release(&file->of_reflock);
-	}
 }
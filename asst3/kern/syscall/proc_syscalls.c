@@ -37,9 +37,11 @@
 #include <lib.h>
 #include <machine/trapframe.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
+#include <synch.h>
 #include <copyinout.h>
 #include <pid.h>
 #include <syscall.h>
@@ -58,19 +60,90 @@ sys_getpid(pid_t *retval)
 	return 0;
 }
 
+/*
+ * sys_setpriority
+ *
+ * Set the scheduling priority of the calling thread to PRIO: 0 is the
+ * highest and SCHED_NPRIO-1 the lowest. There is no way to name some
+ * other process, so PID must be 0 or the caller's own pid; anything
+ * else is EINVAL. Threads and processes it forks afterwards inherit
+ * the new priority.
+ */
+int
+sys_setpriority(pid_t pid, int prio)
+{
+	if (pid != 0 && pid != curproc->p_pid) {
+		return EINVAL;
+	}
+	if (prio < 0 || prio >= SCHED_NPRIO) {
+		return EINVAL;
+	}
+	thread_setpriority(prio);
+	return 0;
+}
+
+/*
+ * sys_setaffinity
+ *
+ * Restrict the threads of the calling process to the cpus in MASK
+ * (bit N for cpu N). PID is as for setpriority, and threads forked
+ * afterwards inherit the mask.
+ */
+int
+sys_setaffinity(pid_t pid, uint32_t mask)
+{
+	struct proc *p;
+	unsigned i;
+	int result;
+
+	p = curproc;
+	if (pid != 0 && pid != p->p_pid) {
+		return EINVAL;
+	}
+
+	result = 0;
+	lock_acquire(p->p_threadslock);
+	for (i=0; i < threadarray_num(&p->p_threads) && result == 0; i++) {
+		result = thread_setaffinity(threadarray_get(&p->p_threads, i),
+					    mask);
+	}
+	lock_release(p->p_threadslock);
+	return result;
+}
+
+/*
+ * sys_settickets
+ *
+ * Give the calling process TICKETS tickets in the proportional-share
+ * scheduling class, or put it back in the default class if TICKETS is
+ * 0. PID is as for setpriority; processes it forks afterwards inherit
+ * the tickets.
+ */
+int
+sys_settickets(pid_t pid, int tickets)
+{
+	if (pid != 0 && pid != curproc->p_pid) {
+		return EINVAL;
+	}
+	if (tickets < 0 || tickets > SCHED_MAXTICKETS) {
+		return EINVAL;
+	}
+	thread_settickets(curproc, tickets);
+	return 0;
+}
+
 /*
  * sys__exit()
  *
- * The process-level work (exit status, waking up waiters, etc.)
- * happens in proc_exit(). Then call thread_exit() to make our thread
- * go away too.
+ * The process-level work (exit status, waking up waiters, getting
+ * rid of other threads, etc.) happens in proc_exit(), which also
+ * makes our thread go away.
  */
 __DEAD
 void
 sys__exit(int status)
 {
 	proc_exit(_MKWAIT_EXIT(status));
-	thread_exit();
 }
 
 /*
@@ -81,12 +154,13 @@ sys__exit(int status)
 
 static
 void
-fork_newthread(void *vtf, unsigned long junk)
+fork_newthread(void *vtf, unsigned long utid)
 {
 	struct trapframe mytf;
 	struct trapframe *ntf = vtf;
 
-	(void)junk;
+	/* We keep the id of the thread that called fork */
+	curthread->t_utid = utid;
 
 	/*
 	 * Now copy the trapframe to our stack, so we can free the one
@@ -127,7 +201,7 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	*retval = newproc->p_pid;
 
 	result = thread_fork(curthread->t_name, newproc,
-			     fork_newthread, ntf, 0);
+			     fork_newthread, ntf, curthread->t_utid);
 	if (result) {
 		proc_unfork(newproc);
 		kfree(ntf);
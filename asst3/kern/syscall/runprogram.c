@@ -106,7 +106,7 @@ void
 argbuf_cleanup(struct argbuf *buf)
 {
 	if (buf->data != NULL) {
-		kfree(buf->data);
+		vfree(buf->data);
 		buf->data = NULL;
 	}
 	buf->len = 0;
@@ -125,7 +125,7 @@ static
 int
 argbuf_allocate(struct argbuf *buf, size_t size)
 {
-	buf->data = kmalloc(size);
+	buf->data = vmalloc(size);
 	if (buf->data == NULL) {
 		return ENOMEM;
 	}
@@ -560,6 +560,15 @@ sys_execv(userptr_t prog, userptr_t uargv)
 	int argc;
 	int result;
 
+	/*
+	 * The old image goes away, so other threads can't be using it.
+	 * Only threads in the process make more, so if we're alone
+	 * now we stay that way.
+	 */
+	if (proc_numthreads(curproc) > 1) {
+		return EBUSY;
+	}
+
 	path = kmalloc(PATH_MAX);
 	if (!path) {
 		return ENOMEM;
@@ -594,6 +603,9 @@ sys_execv(userptr_t prog, userptr_t uargv)
 	/* don't need this any more */
 	kfree(path);
 
+	/* the thread stacks went with the old address space */
+	proc_execthreads();
+
 	/* Send the argv strings to the process. */
 	result = argbuf_copyout(&kargv, &stackptr, &argc, &uargv);
 	if (result) {
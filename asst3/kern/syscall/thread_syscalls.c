@@ -0,0 +1,212 @@
+/*
+ * User-level threads.
+ *
+ * A process can run more than one thread. They share its address
+ * space and file table; each gets a kernel thread of its own, so they
+ * run in parallel on different cpus and one blocking in the kernel
+ * doesn't hold up the others.
+ *
+ * __thread_create starts a thread at a user entry point on a stack
+ * the kernel sets up for it. The stacks go below the main one, one
+ * slot per thread id, with an unmapped guard page above each so that
+ * overflowing one faults instead of running into the next. A thread's
+ * stack is unmapped when it is joined, which means other cpus running
+ * the process have to drop it from their TLBs; see vm_unmap.
+ *
+ * thread_exit ends one thread. _exit, or a fatal fault, ends them all
+ * (see proc_exit): the others leave when they next return to user
+ * mode, or wake up in thread_join or futex.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <machine/trapframe.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+#define UTHREAD_STACKSIZE	(STACK_PAGE * PAGE_SIZE)
+#define UTHREAD_SLOTSIZE	(UTHREAD_STACKSIZE + PAGE_SIZE)	/* + guard */
+
+/*
+ * What a new thread needs to get going; handed over from the creator.
+ */
+struct newthread {
+	struct trapframe nt_tf;		/* Creator's, for gp and friends */
+	vaddr_t nt_entry;		/* Where to start */
+	vaddr_t nt_stack;		/* Top of its stack */
+	userptr_t nt_func;		/* First argument */
+	userptr_t nt_arg;		/* Second argument */
+};
+
+/*
+ * Bottom of the stack for thread id TID (1 to UTHREAD_MAX).
+ */
+static
+vaddr_t
+uthread_stackbase(unsigned tid)
+{
+	return USERSTACK - STACK_PAGE * PAGE_SIZE - tid * UTHREAD_SLOTSIZE;
+}
+
+/*
+ * The new thread starts here, in the kernel, and goes to user mode.
+ */
+static
+void
+uthread_start(void *vnt, unsigned long tid)
+{
+	struct newthread *nt = vnt;
+	struct trapframe tf;
+	vaddr_t entry, stack;
+	userptr_t func, arg;
+
+	/* The trapframe we go to user mode with must be on our stack */
+	tf = nt->nt_tf;
+	entry = nt->nt_entry;
+	stack = nt->nt_stack;
+	func = nt->nt_func;
+	arg = nt->nt_arg;
+	kfree(nt);
+
+	curthread->t_utid = tid;
+	enter_new_thread(&tf, entry, stack, func, arg);
+}
+
+/*
+ * sys___thread_create
+ *
+ * Start a thread running START(FUNC, ARG) and return its id. Userlevel
+ * wraps this so START calls FUNC(ARG) and then thread_exit.
+ */
+int
+sys___thread_create(struct trapframe *tf, userptr_t start, userptr_t func,
+		    userptr_t arg, int32_t *retval)
+{
+	struct proc *proc = curproc;
+	struct newthread *nt;
+	struct uthread *ut;
+	unsigned tid;
+	vaddr_t base;
+	int result;
+
+	nt = kmalloc(sizeof(*nt));
+	if (nt == NULL) {
+		return ENOMEM;
+	}
+	nt->nt_tf = *tf;
+	nt->nt_entry = (vaddr_t)start;
+	nt->nt_func = func;
+	nt->nt_arg = arg;
+
+	lock_acquire(proc->p_utlock);
+	for (tid=1; tid<=UTHREAD_MAX; tid++) {
+		if (proc->p_uthreads[tid-1].ut_state == UT_FREE) {
+			break;
+		}
+	}
+	if (tid > UTHREAD_MAX) {
+		lock_release(proc->p_utlock);
+		kfree(nt);
+		return EAGAIN;
+	}
+	ut = &proc->p_uthreads[tid-1];
+
+	base = uthread_stackbase(tid);
+	if (!ut->ut_mapped) {
+		result = as_define_region(proc_getas(), base,
+					  UTHREAD_STACKSIZE, 1, 1, 0);
+		if (result) {
+			lock_release(proc->p_utlock);
+			kfree(nt);
+			return result;
+		}
+		ut->ut_mapped = true;
+	}
+	nt->nt_stack = base + UTHREAD_STACKSIZE;
+
+	ut->ut_state = UT_RUNNING;
+	ut->ut_retval = NULL;
+	result = thread_fork(curthread->t_name, proc, uthread_start, nt, tid);
+	if (result) {
+		/* Leave the stack mapped; the next thread can have it */
+		ut->ut_state = UT_FREE;
+		lock_release(proc->p_utlock);
+		kfree(nt);
+		return result;
+	}
+	lock_release(proc->p_utlock);
+
+	*retval = tid;
+	return 0;
+}
+
+/*
+ * sys_thread_join
+ *
+ * Wait for thread TID to exit, collect the value it passed to
+ * thread_exit, and unmap its stack. Thread 0 can't be joined.
+ */
+int
+sys_thread_join(int tid, userptr_t retp)
+{
+	struct proc *proc = curproc;
+	struct uthread *ut;
+	userptr_t ret;
+
+	if (tid < 1 || tid > UTHREAD_MAX || (unsigned)tid == curthread->t_utid) {
+		return EINVAL;
+	}
+	ut = &proc->p_uthreads[tid-1];
+
+	lock_acquire(proc->p_utlock);
+	while (ut->ut_state == UT_RUNNING && !proc->p_exiting) {
+		cv_wait(proc->p_utcv, proc->p_utlock);
+	}
+	if (ut->ut_state != UT_EXITED) {
+		lock_release(proc->p_utlock);
+		return proc->p_exiting ? EINTR : ESRCH;
+	}
+	ret = ut->ut_retval;
+
+	/* Nobody else is using the stack now; give it back. */
+	as_remove_region(proc_getas(), uthread_stackbase(tid),
+			 UTHREAD_STACKSIZE);
+	ut->ut_mapped = false;
+	ut->ut_state = UT_FREE;
+	lock_release(proc->p_utlock);
+
+	if (retp != NULL) {
+		return copyout(&ret, retp, sizeof(ret));
+	}
+	return 0;
+}
+
+/*
+ * sys_thread_exit
+ *
+ * End the calling thread, leaving RET for thread_join. If it's the
+ * last thread the process exits with status 0.
+ */
+__DEAD
+void
+sys_thread_exit(userptr_t ret)
+{
+	struct proc *proc = curproc;
+	struct uthread *ut;
+
+	if (curthread->t_utid != 0) {
+		ut = &proc->p_uthreads[curthread->t_utid - 1];
+		lock_acquire(proc->p_utlock);
+		ut->ut_retval = ret;
+		ut->ut_state = UT_EXITED;
+		cv_broadcast(proc->p_utcv, proc->p_utlock);
+		lock_release(proc->p_utlock);
+	}
+	proc_thread_exit();
+}
@@ -28,6 +28,8 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +58,51 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Longest piece of a sleep handed to clock_sleepticks at once; keeps
+ * the tick count well inside an unsigned.
+ */
+#define NANOSLEEP_MAXSECS	1000000
+
+/*
+ * Sleep for the time in REQ, rounded up to whole hardclocks. Nothing
+ * can interrupt the sleep, so the remaining time is always zero and
+ * REM is never written.
+ */
+int
+sys_nanosleep(const_userptr_t req, userptr_t rem)
+{
+	struct timespec ts;
+	unsigned secs, ticks;
+	int result;
+
+	(void)rem;
+
+	result = copyin(req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	while (ts.tv_sec > 0) {
+		secs = ts.tv_sec < NANOSLEEP_MAXSECS ?
+			ts.tv_sec : NANOSLEEP_MAXSECS;
+		result = clock_sleepticks(secs * HZ);
+		if (result) {
+			return result;
+		}
+		ts.tv_sec -= secs;
+	}
+
+	ticks = DIVROUNDUP((unsigned)ts.tv_nsec, 1000000000 / HZ);
+	if (ticks > 0) {
+		result = clock_sleepticks(ticks);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
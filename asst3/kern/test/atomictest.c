@@ -0,0 +1,156 @@
+/*
+ * Atomic counter benchmark.
+ *
+ * Threads bump a shared counter up and down, the way reference counts
+ * get used, first under a sleep lock (as the asst1 counter did), then
+ * under a spinlock (as openfile and vnode refcounts did), then with
+ * atomic_add/atomic_sub. We check the count comes out right and print
+ * the time and operations per second for each.
+ *
+ * Usage: atb [threads [operations per thread]]
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <atomic.h>
+#include <thread.h>
+#include <synch.h>
+#include <bench.h>
+#include <test.h>
+
+enum atb_kind {
+	ATB_LOCK,
+	ATB_SPINLOCK,
+	ATB_ATOMIC,
+};
+
+static const char *const atb_names[] = {
+	"lock",
+	"spinlock",
+	"atomic",
+};
+
+static enum atb_kind atb_kind;
+static unsigned long atb_nops;
+static struct semaphore *atb_donesem;
+static struct lock *atb_lock;
+static struct spinlock atb_spinlock = SPINLOCK_INITIALIZER;
+static volatile int atb_plaincount;
+static atomic_t atb_count;
+
+static
+void
+atb_add(int n)
+{
+	switch (atb_kind) {
+	    case ATB_LOCK:
+		lock_acquire(atb_lock);
+		atb_plaincount += n;
+		lock_release(atb_lock);
+		break;
+	    case ATB_SPINLOCK:
+		spinlock_acquire(&atb_spinlock);
+		atb_plaincount += n;
+		spinlock_release(&atb_spinlock);
+		break;
+	    case ATB_ATOMIC:
+		atomic_add(&atb_count, n);
+		break;
+	}
+}
+
+static
+void
+atb_thread(void *junk, unsigned long num)
+{
+	unsigned long i;
+
+	(void)junk;
+	(void)num;
+
+	/* up twice, down once, so a lost update shows in the total */
+	for (i=0; i<atb_nops; i++) {
+		atb_add(1);
+		atb_add(1);
+		atb_add(-1);
+	}
+	V(atb_donesem);
+}
+
+static
+bool
+atb_run(enum atb_kind kind, unsigned nthreads)
+{
+	struct bench b;
+	unsigned i;
+	int result, count;
+
+	atb_kind = kind;
+	atb_plaincount = 0;
+	atomic_set(&atb_count, 0);
+
+	bench_start(&b);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("atb", NULL, atb_thread, NULL, i);
+		if (result) {
+			panic("atb: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(atb_donesem);
+	}
+	bench_stop(&b);
+	bench_report(&b, atb_names[kind],
+		     (unsigned long long)nthreads * atb_nops * 3, "ops");
+
+	count = kind == ATB_ATOMIC ? atomic_read(&atb_count) : atb_plaincount;
+	if ((unsigned long)count != nthreads * atb_nops) {
+		kprintf("atb: count is %d, not %lu\n", count,
+			nthreads * atb_nops);
+		return false;
+	}
+	return true;
+}
+
+int
+atomicbench(int nargs, char **args)
+{
+	unsigned nthreads = 8;
+	bool ok;
+
+	if (nargs > 3) {
+		kprintf("Usage: atb [threads [operations]]\n");
+		return EINVAL;
+	}
+	atb_nops = 10000;
+	if (nargs > 1) {
+		nthreads = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		atb_nops = atoi(args[2]);
+	}
+	if (nthreads == 0) {
+		kprintf("atb: need at least one thread\n");
+		return EINVAL;
+	}
+
+	atb_donesem = sem_create("atb", 0);
+	atb_lock = lock_create("atb");
+	if (atb_donesem == NULL || atb_lock == NULL) {
+		panic("atb: out of memory\n");
+	}
+
+	kprintf("%u threads, %lu x 3 operations each\n", nthreads, atb_nops);
+	ok = atb_run(ATB_LOCK, nthreads);
+	ok = atb_run(ATB_SPINLOCK, nthreads) && ok;
+	ok = atb_run(ATB_ATOMIC, nthreads) && ok;
+
+	lock_destroy(atb_lock);
+	sem_destroy(atb_donesem);
+
+	return bench_done("Atomic counter benchmark", ok);
+}
@@ -0,0 +1,53 @@
+/*
+ * Benchmark support. See <bench.h>.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <bench.h>
+
+void
+bench_start(struct bench *b)
+{
+	gettime(&b->b_start);
+	b->b_elapsed.tv_sec = 0;
+	b->b_elapsed.tv_nsec = 0;
+}
+
+void
+bench_stop(struct bench *b)
+{
+	struct timespec end;
+
+	gettime(&end);
+	timespec_sub(&end, &b->b_start, &b->b_elapsed);
+}
+
+unsigned long long
+bench_rate(const struct bench *b, unsigned long long n)
+{
+	uint64_t nsecs;
+
+	nsecs = (uint64_t)b->b_elapsed.tv_sec * 1000000000
+		+ b->b_elapsed.tv_nsec;
+	return nsecs ? n * 1000000000 / nsecs : 0;
+}
+
+void
+bench_report(const struct bench *b, const char *what,
+	     unsigned long long n, const char *unit)
+{
+	kprintf("%-9s %llu.%09lu seconds, %llu %s/s\n", what,
+		(unsigned long long)b->b_elapsed.tv_sec,
+		(unsigned long)b->b_elapsed.tv_nsec,
+		bench_rate(b, n), unit);
+}
+
+int
+bench_done(const char *what, bool ok)
+{
+	kprintf("%s %s\n", what, ok ? "done" : "FAILED");
+	return ok ? 0 : EIO;
+}
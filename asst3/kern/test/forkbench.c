@@ -0,0 +1,111 @@
+/*
+ * Thread fork benchmark.
+ *
+ * Fork kernel threads that exit straight away, BATCH at a time,
+ * waiting for each batch before starting the next, until THREADS
+ * have run. This is done once with the per-cpu stack cache turned
+ * off, so every thread_fork gets a new stack from kmalloc, and once
+ * with it on. For each we print the time, threads per second, and
+ * how many stacks were reused and how many allocated.
+ *
+ * Usage: ftb [threads [batch]]
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <synch.h>
+#include <bench.h>
+#include <test.h>
+
+static struct semaphore *ftb_sem;
+
+static
+void
+ftb_thread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(ftb_sem);
+}
+
+static
+bool
+ftb_run(const char *name, bool cache, unsigned nthreads, unsigned batch)
+{
+	struct bench b;
+	unsigned long hits, misses;
+	unsigned i, j, n;
+	int result;
+
+	hits = pcpu_read(PCPU_STACK_HIT);
+	misses = pcpu_read(PCPU_STACK_MISS);
+
+	bench_start(&b);
+	for (i=0; i<nthreads; i+=n) {
+		n = nthreads - i < batch ? nthreads - i : batch;
+		for (j=0; j<n; j++) {
+			result = thread_fork("ftb", NULL, ftb_thread, NULL, j);
+			if (result) {
+				panic("ftb: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (j=0; j<n; j++) {
+			P(ftb_sem);
+		}
+	}
+	bench_stop(&b);
+
+	hits = pcpu_read(PCPU_STACK_HIT) - hits;
+	misses = pcpu_read(PCPU_STACK_MISS) - misses;
+	bench_report(&b, name, nthreads, "threads");
+	kprintf("          %lu stacks reused, %lu allocated\n", hits, misses);
+
+	if (!cache && hits != 0) {
+		kprintf("ftb: stacks reused with the cache off\n");
+		return false;
+	}
+	return true;
+}
+
+int
+forkbench(int nargs, char **args)
+{
+	unsigned nthreads = 2000, batch = 4;
+	bool ok;
+
+	if (nargs > 3) {
+		kprintf("Usage: ftb [threads [batch]]\n");
+		return EINVAL;
+	}
+	if (nargs > 1) {
+		nthreads = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		batch = atoi(args[2]);
+	}
+	if (nthreads == 0 || batch == 0) {
+		kprintf("ftb: need at least one thread\n");
+		return EINVAL;
+	}
+
+	ftb_sem = sem_create("ftb", 0);
+	if (ftb_sem == NULL) {
+		panic("ftb: out of memory\n");
+	}
+
+	kprintf("%u threads, %u at a time\n", nthreads, batch);
+	thread_stackcache_enable(false);
+	ok = ftb_run("no cache", false, nthreads, batch);
+	thread_stackcache_enable(true);
+	ok = ftb_run("cache", true, nthreads, batch) && ok;
+
+	sem_destroy(ftb_sem);
+
+	return bench_done("Thread fork benchmark", ok);
+}
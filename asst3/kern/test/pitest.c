@@ -0,0 +1,238 @@
+/*
+ * Priority inheritance test.
+ *
+ * The classic inversion, with a chain: on one cpu, a low-priority
+ * thread holds lock A; a middle thread holds lock B and blocks on A;
+ * then a high-priority thread blocks on B while a CPU hog at an
+ * in-between priority runs. Without inheritance the hog keeps the
+ * low thread off the cpu and the high thread waits as long as the
+ * hog runs. With it, the low thread runs at high priority until it
+ * lets go of A, so the high thread gets B soon after.
+ *
+ * The order doesn't depend on timing. The menu thread moves onto the
+ * test cpu at the lowest level, so it only runs when every test
+ * thread is blocked: after forking one, it gets back control once
+ * that thread has got its lock, or is sleeping on one. The low thread
+ * waits on a semaphore holding A until the chain is set up, and the
+ * hog is started only after that.
+ *
+ * We check that the high thread's level reached the low thread
+ * through the middle one, that the low thread was seen running at
+ * the top level, and that the high thread got its lock before the
+ * hog finished.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <bench.h>
+#include <test.h>
+
+#define PI_LOWPRI	(SCHED_NPRIO - 1)
+#define PI_MIDPRI	(SCHED_NPRIO - 2)
+#define PI_HOGPRI	1
+#define PI_HIGHPRI	0
+
+#define PI_LOWWORK	2000000		/* low thread's critical section */
+#define PI_HOGWORK	100000000	/* hog's running time, roughly */
+
+static struct lock *locka, *lockb;
+static struct semaphore *pisem, *pigo;
+static struct thread *pilowthread;
+static uint32_t picpu;
+static volatile unsigned lowbest;
+static volatile bool hogdone, highdone, highlate;
+static struct timespec highwait;
+
+/*
+ * Move onto the test cpu at the given level.
+ */
+static
+void
+pi_setup(unsigned prio)
+{
+	int result;
+
+	result = thread_setaffinity(curthread, picpu);
+	if (result) {
+		panic("pitest: thread_setaffinity: %s\n", strerror(result));
+	}
+	thread_setpriority(prio);
+}
+
+static
+void
+pi_low(void *junk, unsigned long num)
+{
+	volatile unsigned long i;
+	unsigned prio;
+
+	(void)junk;
+	(void)num;
+
+	pi_setup(PI_LOWPRI);
+	lock_acquire(locka);
+	pilowthread = curthread;
+	V(pisem);
+	P(pigo);
+
+	lowbest = PI_LOWPRI;
+	for (i=0; i<PI_LOWWORK; i++) {
+		if (i % 1000 == 0) {
+			prio = thread_getpriority(curthread);
+			if (prio < lowbest) {
+				lowbest = prio;
+			}
+		}
+	}
+
+	lock_release(locka);
+	V(pisem);
+}
+
+static
+void
+pi_mid(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	pi_setup(PI_MIDPRI);
+	lock_acquire(lockb);
+	V(pisem);
+	lock_acquire(locka);
+	lock_release(locka);
+	lock_release(lockb);
+	V(pisem);
+}
+
+static
+void
+pi_hog(void *junk, unsigned long num)
+{
+	volatile unsigned long i;
+
+	(void)junk;
+	(void)num;
+
+	pi_setup(PI_HOGPRI);
+	for (i=0; i<PI_HOGWORK && !highdone; i++) {
+		/* nothing */
+	}
+	hogdone = true;
+	V(pisem);
+}
+
+static
+void
+pi_high(void *junk, unsigned long num)
+{
+	struct timespec start, end;
+
+	(void)junk;
+	(void)num;
+
+	pi_setup(PI_HIGHPRI);
+	gettime(&start);
+	lock_acquire(lockb);
+	gettime(&end);
+	highdone = true;
+	highlate = hogdone;
+	lock_release(lockb);
+	timespec_sub(&end, &start, &highwait);
+	V(pisem);
+}
+
+static
+void
+pi_fork(const char *name, void (*func)(void *, unsigned long))
+{
+	int result;
+
+	result = thread_fork(name, NULL, func, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+int
+pitest(int nargs, char **args)
+{
+	uint32_t oldaffinity;
+	unsigned oldpri, chainpri;
+	bool ok;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	locka = lock_create("pitest A");
+	lockb = lock_create("pitest B");
+	pisem = sem_create("pitest", 0);
+	pigo = sem_create("pitest go", 0);
+	if (locka == NULL || lockb == NULL || pisem == NULL || pigo == NULL) {
+		panic("pitest: out of memory\n");
+	}
+	picpu = (uint32_t)1 << curcpu->c_number;
+	hogdone = highdone = highlate = false;
+
+	kprintf("Starting priority inheritance test...\n");
+
+	oldaffinity = curthread->t_affinity;
+	oldpri = curthread->t_basepri;
+	pi_setup(SCHED_NPRIO - 1);
+
+	/*
+	 * Each P, and the yield, returns only once the new thread has
+	 * its lock and everything on the cpu is blocked again: low on
+	 * pigo, mid on A, high on B.
+	 */
+	pi_fork("pitest low", pi_low);
+	P(pisem);
+	pi_fork("pitest mid", pi_mid);
+	P(pisem);
+	pi_fork("pitest high", pi_high);
+	thread_yield();
+	chainpri = thread_getpriority(pilowthread);
+
+	V(pigo);
+	pi_fork("pitest hog", pi_hog);
+
+	for (i=0; i<4; i++) {
+		P(pisem);
+	}
+
+	thread_setpriority(oldpri);
+	result = thread_setaffinity(curthread, oldaffinity);
+	KASSERT(result == 0);
+
+	ok = true;
+	if (chainpri != PI_HIGHPRI) {
+		kprintf("Low thread inherited level %u, not %u\n",
+			chainpri, PI_HIGHPRI);
+		ok = false;
+	}
+	kprintf("High thread waited %llu.%09lu seconds\n",
+		(unsigned long long)highwait.tv_sec,
+		(unsigned long)highwait.tv_nsec);
+	if (lowbest != PI_HIGHPRI) {
+		kprintf("Low thread ran at best at level %u, not %u\n",
+			lowbest, PI_HIGHPRI);
+		ok = false;
+	}
+	if (highlate) {
+		kprintf("High thread had to wait for the hog\n");
+		ok = false;
+	}
+
+	sem_destroy(pigo);
+	sem_destroy(pisem);
+	lock_destroy(lockb);
+	lock_destroy(locka);
+
+	return bench_done("Priority inheritance test", ok);
+}
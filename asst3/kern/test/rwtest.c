@@ -0,0 +1,288 @@
+/*
+ * Reader-writer lock tests.
+ *
+ * rwt1 checks that readers see consistent data while writers update
+ * it, that readers really do share the lock, and that writers get in
+ * while readers keep arriving.
+ *
+ * rwt2 is a benchmark: threads look things up in a small table, like
+ * pid_wait does in the pid table, and now and then change an entry.
+ * It runs once with the table under a plain lock and once under an
+ * rwlock, and prints the time taken by each.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <bench.h>
+#include <test.h>
+
+#define NTHREADS	16
+#define NREADLOOPS	200
+#define NWRITERS	4
+#define NWRITELOOPS	20
+
+#define TABLESIZE	64
+#define NLOOKUPS	2000
+#define WRITEEVERY	100	/* one operation in this many is a write */
+
+static struct rwlock *testrw;
+static struct lock *testlock;
+static struct semaphore *donesem;
+
+static volatile unsigned long testval1;
+static volatile unsigned long testval2;
+static volatile unsigned readers_in;
+static volatile unsigned max_readers_in;
+static volatile unsigned writes_done;
+static struct spinlock count_lock = SPINLOCK_INITIALIZER;
+static volatile bool failed;
+
+static unsigned long table[TABLESIZE];
+
+static
+void
+inititems(void)
+{
+	if (testrw == NULL) {
+		testrw = rwlock_create("rwtest");
+		if (testrw == NULL) {
+			panic("rwtest: rwlock_create failed\n");
+		}
+	}
+	if (testlock == NULL) {
+		testlock = lock_create("rwtest lock");
+		if (testlock == NULL) {
+			panic("rwtest: lock_create failed\n");
+		}
+	}
+	if (donesem == NULL) {
+		donesem = sem_create("rwtest donesem", 0);
+		if (donesem == NULL) {
+			panic("rwtest: sem_create failed\n");
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// rwt1
+
+static
+void
+rwt1_reader(void *junk, unsigned long num)
+{
+	int i, j;
+
+	(void)junk;
+
+	for (i=0; i<NREADLOOPS; i++) {
+		rwlock_acquire_read(testrw);
+
+		spinlock_acquire(&count_lock);
+		readers_in++;
+		if (readers_in > max_readers_in) {
+			max_readers_in = readers_in;
+		}
+		spinlock_release(&count_lock);
+
+		for (j=0; j<10; j++) {
+			if (testval2 != testval1 * testval1) {
+				kprintf("rwt1: reader %lu saw a partial "
+					"update\n", num);
+				failed = true;
+			}
+			thread_yield();
+		}
+
+		spinlock_acquire(&count_lock);
+		readers_in--;
+		spinlock_release(&count_lock);
+
+		rwlock_release(testrw);
+	}
+	V(donesem);
+}
+
+static
+void
+rwt1_writer(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NWRITELOOPS; i++) {
+		rwlock_acquire_write(testrw);
+		KASSERT(rwlock_do_i_hold(testrw));
+		if (readers_in != 0) {
+			kprintf("rwt1: writer %lu got in with %u readers\n",
+				num, readers_in);
+			failed = true;
+		}
+		testval1 = num + i;
+		thread_yield();
+		testval2 = testval1 * testval1;
+		writes_done++;
+		rwlock_release(testrw);
+		thread_yield();
+	}
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock test...\n");
+
+	testval1 = testval2 = 0;
+	readers_in = max_readers_in = 0;
+	writes_done = 0;
+	failed = false;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("rwt1 reader", NULL, rwt1_reader, NULL, i);
+		if (result) {
+			panic("rwt1: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NWRITERS; i++) {
+		result = thread_fork("rwt1 writer", NULL, rwt1_writer, NULL, i);
+		if (result) {
+			panic("rwt1: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS + NWRITERS; i++) {
+		P(donesem);
+	}
+
+	if (max_readers_in < 2) {
+		kprintf("rwt1: readers never shared the lock\n");
+		failed = true;
+	}
+	if (writes_done != NWRITERS * NWRITELOOPS) {
+		kprintf("rwt1: only %u of %u writes done\n", writes_done,
+			NWRITERS * NWRITELOOPS);
+		failed = true;
+	}
+
+	kprintf("Up to %u readers at once\n", max_readers_in);
+	return bench_done("rwlock test", !failed);
+}
+
+////////////////////////////////////////////////////////////
+// rwt2
+
+/*
+ * Look up a key the slow way, as a stand-in for real work done under
+ * the lock.
+ */
+static
+bool
+table_find(unsigned long key)
+{
+	unsigned i;
+
+	for (i=0; i<TABLESIZE; i++) {
+		if (table[i] == key) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static
+void
+rwt2_thread(void *usersw, unsigned long num)
+{
+	bool userw = usersw != NULL;
+	unsigned i;
+	unsigned long key;
+
+	for (i=0; i<NLOOKUPS; i++) {
+		key = (num * NLOOKUPS + i) % (TABLESIZE * 2);
+		if (i % WRITEEVERY == 0) {
+			if (userw) {
+				rwlock_acquire_write(testrw);
+			}
+			else {
+				lock_acquire(testlock);
+			}
+			table[key % TABLESIZE] = key;
+		}
+		else {
+			if (userw) {
+				rwlock_acquire_read(testrw);
+			}
+			else {
+				lock_acquire(testlock);
+			}
+			(void)table_find(key);
+		}
+		if (userw) {
+			rwlock_release(testrw);
+		}
+		else {
+			lock_release(testlock);
+		}
+	}
+	V(donesem);
+}
+
+static
+void
+rwt2_run(bool userw, const char *name)
+{
+	struct bench b;
+	unsigned long i;
+	int result;
+
+	bench_start(&b);
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("rwt2", NULL, rwt2_thread,
+				     userw ? testrw : NULL, i);
+		if (result) {
+			panic("rwt2: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+	bench_stop(&b);
+	bench_report(&b, name, (unsigned long long)NTHREADS * NLOOKUPS,
+		     "lookups");
+}
+
+int
+rwbench(int nargs, char **args)
+{
+	unsigned i;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	for (i=0; i<TABLESIZE; i++) {
+		table[i] = i;
+	}
+
+	kprintf("rwt2: %u threads, %u lookups each, 1 in %u a write\n",
+		NTHREADS, NLOOKUPS, WRITEEVERY);
+
+	rwt2_run(false, "lock");
+	rwt2_run(true, "rwlock");
+
+	kprintf("rwt2 done.\n");
+	return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * Spinlock benchmark.
+ *
+ * One thread per cpu, each bound to its cpu, takes the same spinlock
+ * over and over for a while, doing a little work with it held and a
+ * little without. This is run with 1 cpu, then 2, and so on up to all
+ * of them, once with a test-and-set lock and once with a ticket lock.
+ *
+ * For each run we print the total acquisitions per second, and the
+ * fewest any one cpu got as a percentage of the most: 100% is
+ * perfectly fair, and a low number means some cpu was starved. We
+ * also count acquisitions under the lock, to check that it works.
+ *
+ * Usage: spb [seconds]
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <bench.h>
+#include <test.h>
+
+#define SB_MAXCPUS	32	/* affinity masks are 32 bits */
+#define SB_INSIDE	20	/* work done holding the lock */
+#define SB_OUTSIDE	20	/* work done between acquisitions */
+
+static struct spinlock sb_taslock = SPINLOCK_INITIALIZER;
+static struct spinlock sb_ticketlock = TICKETLOCK_INITIALIZER;
+
+static struct spinlock *sb_lock;
+static struct semaphore *sb_readysem;
+static struct semaphore *sb_donesem;
+static volatile bool sb_go, sb_stop;
+static volatile unsigned long sb_shared;
+static unsigned long sb_counts[SB_MAXCPUS];
+
+static
+void
+sb_thread(void *junk, unsigned long cpu)
+{
+	volatile unsigned i;
+	unsigned long n;
+	int result;
+
+	(void)junk;
+
+	result = thread_setaffinity(curthread, (uint32_t)1 << cpu);
+	if (result) {
+		panic("spb: thread_setaffinity: %s\n", strerror(result));
+	}
+	/* move to that cpu now */
+	thread_yield();
+	V(sb_readysem);
+
+	while (!sb_go) {
+		/* wait for everyone */
+	}
+
+	n = 0;
+	while (!sb_stop) {
+		spinlock_acquire(sb_lock);
+		sb_shared++;
+		for (i=0; i<SB_INSIDE; i++) {
+			/* nothing */
+		}
+		spinlock_release(sb_lock);
+		n++;
+		for (i=0; i<SB_OUTSIDE; i++) {
+			/* nothing */
+		}
+	}
+	sb_counts[cpu] = n;
+	V(sb_donesem);
+}
+
+/*
+ * Run on NCPUS cpus with LK and print the results.
+ */
+static
+bool
+sb_run(unsigned ncpus, struct spinlock *lk, const char *name, int seconds)
+{
+	struct bench b;
+	unsigned long total, min, max;
+	unsigned i;
+	int result;
+
+	sb_lock = lk;
+	sb_go = sb_stop = false;
+	sb_shared = 0;
+
+	for (i=0; i<ncpus; i++) {
+		result = thread_fork("spb", NULL, sb_thread, NULL, i);
+		if (result) {
+			panic("spb: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<ncpus; i++) {
+		P(sb_readysem);
+	}
+
+	bench_start(&b);
+	sb_go = true;
+	clocksleep(seconds);
+	sb_stop = true;
+	bench_stop(&b);
+
+	for (i=0; i<ncpus; i++) {
+		P(sb_donesem);
+	}
+
+	total = 0;
+	min = max = sb_counts[0];
+	for (i=0; i<ncpus; i++) {
+		total += sb_counts[i];
+		if (sb_counts[i] < min) {
+			min = sb_counts[i];
+		}
+		if (sb_counts[i] > max) {
+			max = sb_counts[i];
+		}
+	}
+
+	kprintf("%4u   %-7s %12llu    %3lu%%\n", ncpus, name,
+		bench_rate(&b, total), max ? min * 100 / max : 0);
+
+	if (sb_shared != total) {
+		kprintf("spb: %lu acquisitions but %lu counted under the "
+			"lock\n", total, sb_shared);
+		return false;
+	}
+	return true;
+}
+
+int
+spinbench(int nargs, char **args)
+{
+	unsigned ncpus, n;
+	int seconds;
+	bool ok;
+
+	if (nargs > 2) {
+		kprintf("Usage: spb [seconds]\n");
+		return EINVAL;
+	}
+	seconds = nargs == 2 ? atoi(args[1]) : 1;
+	if (seconds < 1) {
+		seconds = 1;
+	}
+
+	sb_readysem = sem_create("spb ready", 0);
+	sb_donesem = sem_create("spb done", 0);
+	if (sb_readysem == NULL || sb_donesem == NULL) {
+		panic("spb: sem_create failed\n");
+	}
+
+	ncpus = cpu_count();
+	if (ncpus > SB_MAXCPUS) {
+		ncpus = SB_MAXCPUS;
+	}
+
+	kprintf("Spinlock benchmark, %d second%s per run\n", seconds,
+		seconds == 1 ? "" : "s");
+	kprintf("cpus   lock       acquires/s   fairness\n");
+	ok = true;
+	for (n=1; n<=ncpus; n++) {
+		ok = sb_run(n, &sb_taslock, "tas", seconds) && ok;
+		ok = sb_run(n, &sb_ticketlock, "ticket", seconds) && ok;
+	}
+
+	sem_destroy(sb_donesem);
+	sem_destroy(sb_readysem);
+
+	return bench_done("Spinlock benchmark", ok);
+}
@@ -37,6 +37,7 @@
 #include <clock.h>
 #include <thread.h>
 #include <synch.h>
+#include <bench.h>
 #include <test.h>
 
 #define NSEMLOOPS     63
@@ -400,3 +401,112 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * CV contention benchmark.
+ *
+ * NTHREADS threads all wait on one CV, the main thread broadcasts,
+ * and each woken thread does a little work under the lock and goes
+ * back to wait for the next round. This is the thundering herd that
+ * wait morphing is meant to tame: how many times the woken threads
+ * had to go back to sleep in lock_acquire shows up in the lock's
+ * lk_sleeps count.
+ */
+
+#define NCVBROUNDS	100
+#define CVBWORK		200
+
+static struct lock *cvblock;
+static struct cv *cvbcv;
+static struct cv *cvbdonecv;
+static volatile unsigned cvbround;
+static volatile unsigned cvbarrived;
+
+static
+void
+cvbthread(void *junk, unsigned long num)
+{
+	unsigned r;
+	volatile unsigned j;
+
+	(void)junk;
+	(void)num;
+
+	for (r=1; r<=NCVBROUNDS; r++) {
+		lock_acquire(cvblock);
+		cvbarrived++;
+		if (cvbarrived % NTHREADS == 0) {
+			cv_signal(cvbdonecv, cvblock);
+		}
+		while (cvbround < r) {
+			cv_wait(cvbcv, cvblock);
+		}
+		for (j=0; j<CVBWORK; j++) {
+			/* nothing */
+		}
+		lock_release(cvblock);
+	}
+	V(donesem);
+}
+
+int
+cvbench(int nargs, char **args)
+{
+	struct bench b;
+	unsigned long sleeps, spins;
+	unsigned r;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	cvblock = lock_create("cvbench lock");
+	cvbcv = cv_create("cvbench cv");
+	cvbdonecv = cv_create("cvbench done cv");
+	if (cvblock == NULL || cvbcv == NULL || cvbdonecv == NULL) {
+		panic("cvbench: out of memory\n");
+	}
+	cvbround = 0;
+	cvbarrived = 0;
+
+	kprintf("cvbench: %d threads, %d broadcasts\n", NTHREADS, NCVBROUNDS);
+
+	bench_start(&b);
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("cvbench", NULL, cvbthread, NULL, i);
+		if (result) {
+			panic("cvbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	for (r=1; r<=NCVBROUNDS; r++) {
+		lock_acquire(cvblock);
+		while (cvbarrived < r * NTHREADS) {
+			cv_wait(cvbdonecv, cvblock);
+		}
+		cvbround = r;
+		cv_broadcast(cvbcv, cvblock);
+		lock_release(cvblock);
+	}
+
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+	bench_stop(&b);
+
+	sleeps = cvblock->lk_sleeps;
+	spins = cvblock->lk_spins;
+	bench_report(&b, "cvbench", NCVBROUNDS * NTHREADS, "wakeups");
+	kprintf("%d wakeups; lock_acquire slept %lu times, spun %lu times\n",
+		NCVBROUNDS * NTHREADS, sleeps, spins);
+
+	cv_destroy(cvbdonecv);
+	cv_destroy(cvbcv);
+	lock_destroy(cvblock);
+
+	return bench_done("CV benchmark", true);
+}
@@ -0,0 +1,106 @@
+/*
+ * Work queue test.
+ *
+ * Enqueue a batch of work items, every other one delayed by a few
+ * ticks so that it gets enqueued again from the hardclock interrupt.
+ * Each one counts itself, so we can check they all ran exactly once.
+ * We also check that enqueueing an item that is still pending is
+ * refused. Then print the time taken and the queue statistics.
+ *
+ * Usage: wqt [items]
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <atomic.h>
+#include <synch.h>
+#include <workqueue.h>
+#include <bench.h>
+#include <test.h>
+
+static struct semaphore *wqt_sem;
+static atomic_t wqt_count;
+
+static
+void
+wqt_func(void *arg)
+{
+	atomic_t *ran = arg;
+
+	atomic_add(ran, 1);
+	atomic_add(&wqt_count, 1);
+	V(wqt_sem);
+}
+
+int
+workqueuetest(int nargs, char **args)
+{
+	struct work *works;
+	atomic_t *ran;
+	struct bench b;
+	unsigned nitems, i;
+	bool ok;
+
+	if (nargs > 2) {
+		kprintf("Usage: wqt [items]\n");
+		return EINVAL;
+	}
+	nitems = nargs == 2 ? atoi(args[1]) : 1000;
+	if (nitems == 0) {
+		kprintf("wqt: need at least one item\n");
+		return EINVAL;
+	}
+
+	wqt_sem = sem_create("wqt", 0);
+	works = kmalloc(nitems * sizeof(*works));
+	ran = kmalloc(nitems * sizeof(*ran));
+	if (wqt_sem == NULL || works == NULL || ran == NULL) {
+		panic("wqt: out of memory\n");
+	}
+	bzero(works, nitems * sizeof(*works));
+	for (i=0; i<nitems; i++) {
+		atomic_set(&ran[i], 0);
+	}
+	atomic_set(&wqt_count, 0);
+	ok = true;
+
+	kprintf("Enqueueing %u items, half of them delayed...\n", nitems);
+	bench_start(&b);
+	for (i=0; i<nitems; i++) {
+		if (i % 2) {
+			workqueue_enqueue_delayed(&works[i], wqt_func, &ran[i],
+						  i % 10 + 1);
+			/* still waiting on the timer, so this must fail */
+			if (workqueue_enqueue(&works[i], wqt_func, &ran[i])) {
+				kprintf("wqt: item %u enqueued twice\n", i);
+				ok = false;
+				P(wqt_sem);
+			}
+		}
+		else {
+			workqueue_enqueue(&works[i], wqt_func, &ran[i]);
+		}
+	}
+	for (i=0; i<nitems; i++) {
+		P(wqt_sem);
+	}
+	bench_stop(&b);
+
+	for (i=0; i<nitems; i++) {
+		if (atomic_read(&ran[i]) != 1) {
+			kprintf("wqt: item %u ran %d times\n", i,
+				atomic_read(&ran[i]));
+			ok = false;
+		}
+	}
+	bench_report(&b, "wqt", atomic_read(&wqt_count), "items");
+	workqueue_printstats();
+
+	kfree(ran);
+	kfree(works);
+	sem_destroy(wqt_sem);
+
+	return bench_done("Work queue test", ok);
+}
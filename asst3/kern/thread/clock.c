@@ -28,8 +28,11 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
@@ -38,26 +41,16 @@
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
- *
- * A real kernel also has to maintain the time of day; in OS/161 we
- * skimp on that because we have a known-good hardware clock.
+ * This is pretty primitive. A real kernel also has to maintain the
+ * time of day; in OS/161 we skimp on that because we have a
+ * known-good hardware clock.
  */
 
 /*
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
-
-/*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
- */
-static struct wchan *lbolt;
-static struct spinlock lbolt_lock;
+#define SCHEDULE_HARDCLOCKS	100	/* Boost priorities every 100 hardclocks. */
 
 /*
  * Setup.
@@ -65,26 +58,222 @@ static struct spinlock lbolt_lock;
 void
 hardclock_bootstrap(void)
 {
-	spinlock_init(&lbolt_lock);
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
-	}
+	/* Nothing to do; each cpu's timer wheel comes with the cpu. */
 }
 
 /*
  * This is called once per second, on one processor, by the timer
- * code.
+ * code. Timed sleeps go through the timer wheel below, so there is
+ * nothing to do here.
  */
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	spinlock_acquire(&lbolt_lock);
-	wchan_wakeall(lbolt, &lbolt_lock);
-	spinlock_release(&lbolt_lock);
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Timer wheel.
+ *
+ * Each cpu has a hierarchical timing wheel of TW_LEVELS levels with
+ * TW_SLOTS slots each. Level 0 holds timeouts due within TW_SLOTS
+ * ticks, one slot per tick; level 1 those due within TW_SLOTS^2
+ * ticks, one slot per TW_SLOTS ticks; and so on. Every hardclock
+ * advances the wheel by one tick and runs whatever is in the current
+ * level 0 slot. Whenever level N wraps around, the current slot of
+ * level N+1 is emptied and its timeouts are put back in at a lower
+ * level ("cascading").
+ *
+ * So adding, cancelling and expiring a timeout are all constant
+ * time, and each tick only looks at the timeouts that are actually
+ * due (plus, once every TW_SLOTS ticks, one slot's worth of cascade).
+ *
+ * Each wheel has its own lock. timeout() uses the calling cpu's
+ * wheel, so in the common case nothing is shared between cpus.
+ */
+
+#define TW_LEVELS	4
+#define TW_BITS		6
+#define TW_SLOTS	(1U << TW_BITS)
+#define TW_MASK		(TW_SLOTS - 1)
+
+struct timerwheel {
+	struct spinlock tw_lock;
+	uint64_t tw_now;		/* Ticks processed */
+	struct timeout *tw_slots[TW_LEVELS][TW_SLOTS];
+};
+
+struct timerwheel *
+timerwheel_create(void)
+{
+	struct timerwheel *tw;
+	unsigned i, j;
+
+	tw = kmalloc(sizeof(*tw));
+	if (tw == NULL) {
+		return NULL;
+	}
+	spinlock_init(&tw->tw_lock);
+	tw->tw_now = 0;
+	for (i=0; i<TW_LEVELS; i++) {
+		for (j=0; j<TW_SLOTS; j++) {
+			tw->tw_slots[i][j] = NULL;
+		}
+	}
+	return tw;
+}
+
+/*
+ * Put TO in the right slot for its expiry time.
+ */
+static
+void
+tw_insert(struct timerwheel *tw, struct timeout *to)
+{
+	uint64_t delta;
+	unsigned level, slot;
+	struct timeout **head;
+
+	KASSERT(spinlock_do_i_hold(&tw->tw_lock));
+
+	delta = to->to_expires > tw->tw_now ? to->to_expires - tw->tw_now : 0;
+	for (level = 0; level < TW_LEVELS - 1; level++) {
+		if (delta < (1ULL << ((level + 1) * TW_BITS))) {
+			break;
+		}
+	}
+	slot = (to->to_expires >> (level * TW_BITS)) & TW_MASK;
+
+	head = &tw->tw_slots[level][slot];
+	to->to_next = *head;
+	if (*head != NULL) {
+		(*head)->to_prevp = &to->to_next;
+	}
+	to->to_prevp = head;
+	*head = to;
 }
 
+/*
+ * Take TO out of whatever slot it's in.
+ */
+static
+void
+tw_remove(struct timeout *to)
+{
+	KASSERT(spinlock_do_i_hold(&to->to_wheel->tw_lock));
+	KASSERT(to->to_prevp != NULL);
+
+	*to->to_prevp = to->to_next;
+	if (to->to_next != NULL) {
+		to->to_next->to_prevp = to->to_prevp;
+	}
+	to->to_next = NULL;
+	to->to_prevp = NULL;
+}
+
+/*
+ * Move everything in the current slot of LEVEL down.
+ */
+static
+void
+tw_cascade(struct timerwheel *tw, unsigned level)
+{
+	struct timeout *list, *to;
+	unsigned slot;
+
+	slot = (tw->tw_now >> (level * TW_BITS)) & TW_MASK;
+	list = tw->tw_slots[level][slot];
+	tw->tw_slots[level][slot] = NULL;
+	while ((to = list) != NULL) {
+		list = to->to_next;
+		tw_insert(tw, to);
+	}
+}
+
+/*
+ * Advance this cpu's wheel by a tick and run what's due. The due list
+ * is detached under the lock, but the functions are called without
+ * it so that they can call timeout() again.
+ */
+static
+void
+tw_tick(void)
+{
+	struct timerwheel *tw;
+	struct timeout *list, *to, *next;
+	unsigned level, slot;
+
+	tw = curcpu->c_timers;
+
+	spinlock_acquire(&tw->tw_lock);
+	tw->tw_now++;
+	for (level = 1; level < TW_LEVELS; level++) {
+		if (((tw->tw_now >> ((level - 1) * TW_BITS)) & TW_MASK) != 0) {
+			break;
+		}
+		tw_cascade(tw, level);
+	}
+	slot = tw->tw_now & TW_MASK;
+	list = tw->tw_slots[0][slot];
+	tw->tw_slots[0][slot] = NULL;
+	for (to = list; to != NULL; to = to->to_next) {
+		/* Not pending any more, so untimeout will fail. */
+		to->to_prevp = NULL;
+	}
+	spinlock_release(&tw->tw_lock);
+
+	/* Don't touch a timeout after its function has been called. */
+	for (to = list; to != NULL; to = next) {
+		next = to->to_next;
+		to->to_func(to->to_arg);
+	}
+}
+
+void
+timeout(struct timeout *to, void (*func)(void *), void *arg, unsigned ticks)
+{
+	struct timerwheel *tw;
+	int spl;
+
+	if (ticks == 0) {
+		ticks = 1;
+	}
+	if (ticks > TIMEOUT_MAXTICKS) {
+		ticks = TIMEOUT_MAXTICKS;
+	}
+
+	/* Stay on one cpu while we pick its wheel. */
+	spl = splhigh();
+	tw = curcpu->c_timers;
+	spinlock_acquire(&tw->tw_lock);
+	to->to_func = func;
+	to->to_arg = arg;
+	to->to_wheel = tw;
+	to->to_expires = tw->tw_now + ticks;
+	tw_insert(tw, to);
+	spinlock_release(&tw->tw_lock);
+	splx(spl);
+}
+
+bool
+untimeout(struct timeout *to)
+{
+	struct timerwheel *tw;
+	bool cancelled;
+
+	tw = to->to_wheel;
+	spinlock_acquire(&tw->tw_lock);
+	cancelled = (to->to_prevp != NULL);
+	if (cancelled) {
+		tw_remove(to);
+	}
+	spinlock_release(&tw->tw_lock);
+	return cancelled;
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * This is called HZ times a second (on each processor) by the timer
  * code.
@@ -97,25 +286,95 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
-	}
+	tw_tick();
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	if (thread_tick()) {
+		thread_yield();
+	}
+}
+
+/*
+ * Timed sleep. The timeout wakes just the one thread, on a wait
+ * channel of its own.
+ */
+struct tsleep {
+	struct spinlock ts_lock;
+	struct wchan *ts_wchan;
+	bool ts_done;
+};
+
+static
+void
+tsleep_wakeup(void *data)
+{
+	struct tsleep *ts = data;
+
+	/*
+	 * Once we let go of ts_lock, the sleeper can return and its
+	 * stack (where TS lives) can go away.
+	 */
+	spinlock_acquire(&ts->ts_lock);
+	ts->ts_done = true;
+	wchan_wakeall(ts->ts_wchan, &ts->ts_lock);
+	spinlock_release(&ts->ts_lock);
+}
+
+int
+clock_sleepticks(unsigned ticks)
+{
+	struct tsleep ts;
+	struct timeout to;
+	unsigned chunk;
+
+	ts.ts_wchan = wchan_create("tsleep");
+	if (ts.ts_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&ts.ts_lock);
+
+	while (ticks > 0) {
+		chunk = ticks < TIMEOUT_MAXTICKS ? ticks : TIMEOUT_MAXTICKS;
+		ticks -= chunk;
+
+		ts.ts_done = false;
+		timeout(&to, tsleep_wakeup, &ts, chunk);
+		spinlock_acquire(&ts.ts_lock);
+		while (!ts.ts_done) {
+			wchan_sleep(ts.ts_wchan, &ts.ts_lock);
+		}
+		spinlock_release(&ts.ts_lock);
+	}
+
+	spinlock_cleanup(&ts.ts_lock);
+	wchan_destroy(ts.ts_wchan);
+	return 0;
 }
 
 /*
  * Suspend execution for n seconds.
+ *
+ * If there's no memory for a wait channel, fall back to yielding
+ * until the time is up.
  */
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
+	struct timespec now, end;
+
+	if (num_secs <= 0) {
+		return;
+	}
+	if (clock_sleepticks(num_secs * HZ) == 0) {
+		return;
 	}
-	spinlock_release(&lbolt_lock);
+
+	gettime(&end);
+	end.tv_sec += num_secs;
+	do {
+		thread_yield();
+		gettime(&now);
+	} while (now.tv_sec < end.tv_sec ||
+		 (now.tv_sec == end.tv_sec && now.tv_nsec < end.tv_nsec));
 }
@@ -180,3 +180,31 @@ hangman_release(struct hangman_actor *a,
 
 	spinlock_release(&hangman_lock);
 }
+
+/*
+ * Note that a has stopped waiting for l without becoming its holder.
+ * This is for locks that can be shared, such as the read side of an
+ * rwlock: we only keep track of one holder per lockable, so shared
+ * holders are not recorded at all.
+ */
+void
+hangman_cancel(struct hangman_actor *a,
+	       struct hangman_lockable *l)
+{
+	if (l == &hangman_lock.splk_hangman) {
+		/* don't recurse */
+		return;
+	}
+
+	spinlock_acquire(&hangman_lock);
+
+	if (a->a_waiting != l) {
+		spinlock_release(&hangman_lock);
+		panic("hangman_cancel: not waiting for lock %s (%p)\n",
+		      l->l_name, l);
+	}
+
+	a->a_waiting = NULL;
+
+	spinlock_release(&hangman_lock);
+}
@@ -0,0 +1,149 @@
+/*
+ * Quiescent-state-based reclamation. See <qsbr.h> for the interface.
+ *
+ * There is a global grace period number, qsbr_gen. Each cpu copies it
+ * into c_qsbr_gen whenever it passes a quiescent state. qsbr_defer
+ * bumps qsbr_gen to G and tags the callback with G; once every cpu's
+ * c_qsbr_gen has reached G, each cpu has been through a quiescent
+ * state since the object was unlinked, so no read-side section can
+ * still hold a pointer to it. Idle cpus aren't in any read-side
+ * section, so they count as having reached every G.
+ *
+ * Callbacks wait on one list, in order of G since qsbr_lock covers
+ * both the bump and the append. They are run from a delayed work item
+ * that checks the cpus every QSBR_TICKS hardclocks while anything is
+ * waiting.
+ *
+ * Grace period numbers wrap; compare them by the sign of the
+ * difference.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <current.h>
+#include <workqueue.h>
+#include <qsbr.h>
+
+#define QSBR_TICKS	1
+
+static struct spinlock qsbr_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned qsbr_gen;
+static struct qsbr_head *qsbr_head, **qsbr_tailp = &qsbr_head;
+static struct work qsbr_work;
+
+#define QSBR_REACHED(seen, g)	((int)((seen) - (g)) >= 0)
+
+void
+qsbr_read_lock(void)
+{
+	splraise(IPL_NONE, IPL_HIGH);
+	curcpu->c_qsbr_readers++;
+}
+
+void
+qsbr_read_unlock(void)
+{
+	KASSERT(curcpu->c_qsbr_readers > 0);
+	curcpu->c_qsbr_readers--;
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+void
+qsbr_quiescent(void)
+{
+	KASSERT(curcpu->c_qsbr_readers == 0);
+
+	/* Finish our reads before saying so, and see unlinks after. */
+	membar_any_any();
+	curcpu->c_qsbr_gen = qsbr_gen;
+	membar_any_any();
+}
+
+/*
+ * The oldest grace period every cpu has reached.
+ */
+static
+unsigned
+qsbr_reached(unsigned gen)
+{
+	struct cpu *c;
+	unsigned i, seen;
+
+	membar_any_any();
+	for (i=0; i < cpu_count(); i++) {
+		c = cpu_get(i);
+		if (c->c_isidle) {
+			continue;
+		}
+		seen = c->c_qsbr_gen;
+		if (!QSBR_REACHED(seen, gen)) {
+			gen = seen;
+		}
+	}
+	return gen;
+}
+
+static
+void
+qsbr_reclaim(void *unused)
+{
+	struct qsbr_head *list, *qh, *next;
+	unsigned gen;
+	bool more;
+
+	(void)unused;
+
+	/* We're in no read-side section here, so this cpu is done. */
+	qsbr_quiescent();
+	gen = qsbr_reached(qsbr_gen);
+
+	/* Take the callbacks whose grace period is over. */
+	list = NULL;
+	spinlock_acquire(&qsbr_lock);
+	if (qsbr_head != NULL && QSBR_REACHED(gen, qsbr_head->qh_gen)) {
+		list = qsbr_head;
+		qh = list;
+		while (qh->qh_next != NULL &&
+		       QSBR_REACHED(gen, qh->qh_next->qh_gen)) {
+			qh = qh->qh_next;
+		}
+		qsbr_head = qh->qh_next;
+		qh->qh_next = NULL;
+		if (qsbr_head == NULL) {
+			qsbr_tailp = &qsbr_head;
+		}
+	}
+	more = qsbr_head != NULL;
+	spinlock_release(&qsbr_lock);
+
+	if (more) {
+		workqueue_enqueue_delayed(&qsbr_work, qsbr_reclaim, NULL,
+					  QSBR_TICKS);
+	}
+
+	for (qh = list; qh != NULL; qh = next) {
+		next = qh->qh_next;
+		qh->qh_func(qh->qh_arg);
+	}
+}
+
+void
+qsbr_defer(struct qsbr_head *qh, void (*func)(void *), void *arg)
+{
+	qh->qh_next = NULL;
+	qh->qh_func = func;
+	qh->qh_arg = arg;
+
+	spinlock_acquire(&qsbr_lock);
+	qh->qh_gen = ++qsbr_gen;
+	*qsbr_tailp = qh;
+	qsbr_tailp = &qh->qh_next;
+	spinlock_release(&qsbr_lock);
+
+	/* Does nothing if it's already coming. */
+	workqueue_enqueue_delayed(&qsbr_work, qsbr_reclaim, NULL, QSBR_TICKS);
+}
@@ -51,10 +51,22 @@ void
 spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_serving, 0);
+	splk->splk_ticket = false;
 	splk->splk_holder = NULL;
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
 }
 
+/*
+ * Initialize spinlock as a ticket lock.
+ */
+void
+spinlock_init_ticket(struct spinlock *splk)
+{
+	spinlock_init(splk);
+	splk->splk_ticket = true;
+}
+
 /*
  * Clean up spinlock.
  */
@@ -62,7 +74,58 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	if (splk->splk_ticket) {
+		KASSERT(spinlock_data_get(&splk->splk_lock) ==
+			spinlock_data_get(&splk->splk_serving));
+	}
+	else {
+		KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	}
+}
+
+/*
+ * Wait for a test-and-set lock.
+ */
+static
+void
+spinlock_wait_tas(struct spinlock *splk)
+{
+	while (1) {
+		/*
+		 * Do test-test-and-set, that is, read first before
+		 * doing test-and-set, to reduce bus contention.
+		 *
+		 * Test-and-set is a machine-level atomic operation
+		 * that writes 1 into the lock word and returns the
+		 * previous value. If that value was 0, the lock was
+		 * previously unheld and we now own it. If it was 1,
+		 * we don't.
+		 */
+		if (spinlock_data_get(&splk->splk_lock) != 0) {
+			continue;
+		}
+		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
+			continue;
+		}
+		break;
+	}
+}
+
+/*
+ * Wait for a ticket lock: take the next number, and wait for it to
+ * come up. Nobody but the holder writes splk_serving, so waiting is
+ * only reads.
+ */
+static
+void
+spinlock_wait_ticket(struct spinlock *splk)
+{
+	spinlock_data_t ticket;
+
+	ticket = spinlock_data_fetchadd(&splk->splk_lock, 1);
+	while (spinlock_data_get(&splk->splk_serving) != ticket) {
+		/* spin */
+	}
 }
 
 /*
@@ -93,24 +156,11 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
-		}
-		break;
+	if (splk->splk_ticket) {
+		spinlock_wait_ticket(splk);
+	}
+	else {
+		spinlock_wait_tas(splk);
 	}
 
 	membar_store_any();
@@ -137,7 +187,14 @@ spinlock_release(struct spinlock *splk)
 
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	if (splk->splk_ticket) {
+		/* Next, please */
+		spinlock_data_set(&splk->splk_serving,
+				  spinlock_data_get(&splk->splk_serving) + 1);
+	}
+	else {
+		spinlock_data_set(&splk->splk_lock, 0);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -35,11 +35,37 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <kcache.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
 
+static struct kcache *sem_cache;
+static struct kcache *lock_cache;
+static struct kcache *cv_cache;
+static struct kcache *rwlock_cache;
+
+/*
+ * Set up the object caches. Called early in boot, before anything
+ * creates a lock.
+ */
+void
+synch_bootstrap(void)
+{
+	sem_cache = kcache_create("semaphore", sizeof(struct semaphore),
+				  NULL, NULL);
+	lock_cache = kcache_create("lock", sizeof(struct lock), NULL, NULL);
+	cv_cache = kcache_create("cv", sizeof(struct cv), NULL, NULL);
+	rwlock_cache = kcache_create("rwlock", sizeof(struct rwlock),
+				     NULL, NULL);
+	if (sem_cache == NULL || lock_cache == NULL || cv_cache == NULL ||
+	    rwlock_cache == NULL) {
+		panic("synch_bootstrap: Out of memory\n");
+	}
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -49,21 +75,21 @@ sem_create(const char *name, unsigned initial_count)
 {
 	struct semaphore *sem;
 	
-	sem = kmalloc(sizeof(*sem));
+	sem = kcache_alloc(sem_cache);
 	if (sem == NULL) {
 		return NULL;
 	}
 	
 	sem->sem_name = kstrdup(name);
 	if (sem->sem_name == NULL) {
-		kfree(sem);
+		kcache_free(sem_cache, sem);
 		return NULL;
 	}
 
 	sem->sem_wchan = wchan_create(sem->sem_name);
 	if (sem->sem_wchan == NULL) {
 		kfree(sem->sem_name);
-		kfree(sem);
+		kcache_free(sem_cache, sem);
 		return NULL;
 	}
 
@@ -82,7 +108,7 @@ sem_destroy(struct semaphore *sem)
 	spinlock_cleanup(&sem->sem_lock);
 	wchan_destroy(sem->sem_wchan);
 	kfree(sem->sem_name);
-	kfree(sem);
+	kcache_free(sem_cache, sem);
 }
 
 void
@@ -143,14 +169,14 @@ lock_create(const char *name)
 {
 	struct lock *lock;
 
-	lock = kmalloc(sizeof(*lock));
+	lock = kcache_alloc(lock_cache);
 	if (lock == NULL) {
 		return NULL;
 	}
 
 	lock->lk_name = kstrdup(name);
 	if (lock->lk_name == NULL) {
-		kfree(lock);
+		kcache_free(lock_cache, lock);
 		return NULL;
 	}
 
@@ -159,11 +185,15 @@ lock_create(const char *name)
 	lock->lk_wchan = wchan_create(lock->lk_name);
 	if (lock->lk_wchan == NULL) {
 		kfree(lock->lk_name);
-		kfree(lock);
+		kcache_free(lock_cache, lock);
 		return NULL;
 	}
 	spinlock_init(&lock->lk_lock);
 	lock->lk_holder = NULL;
+	lock->lk_spins = 0;
+	lock->lk_sleeps = 0;
+	lock->lk_waiters = NULL;
+	lock->lk_heldnext = NULL;
 
 	return lock;
 }
@@ -174,51 +204,318 @@ lock_destroy(struct lock *lock)
 	KASSERT(lock != NULL);
 
 	KASSERT(lock->lk_holder == NULL);
+	KASSERT(lock->lk_waiters == NULL);
 	spinlock_cleanup(&lock->lk_lock);
 	wchan_destroy(lock->lk_wchan);
 
 	kfree(lock->lk_name);
-	kfree(lock);
+	kcache_free(lock_cache, lock);
+}
+
+/*
+ * Priority inheritance.
+ *
+ * A thread that blocks on a lock lends its priority to the holder,
+ * and on down the chain if the holder is itself blocked on a lock, so
+ * that a low-priority holder can't be kept off the cpu by middling
+ * threads while a high-priority one waits for it.
+ *
+ * Each lock keeps a list of the threads blocked on it (lk_waiters,
+ * linked through t_pinext), and each thread a list of the locks it
+ * holds (t_heldlocks, linked through lk_heldnext). A thread inherits
+ * the best level of any waiter on any lock it holds: that is worked
+ * out afresh when it takes a lock that has waiters and when it
+ * releases a lock while boosted. Waiters are looked at as they are
+ * now, so a waiter that is itself boosted passes that on too.
+ *
+ * pi_lock protects the waiter lists, t_blockedon, and t_inherit. It
+ * must also be held to change the holder of a lock that has waiters,
+ * so that the holder of a lock found by following t_blockedon stays
+ * put. It nests inside lk_lock, and outside the run queue locks.
+ *
+ * Inheritance only affects the default scheduling class; threads of
+ * stride-class processes run on their tickets regardless.
+ */
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Return the best level among the threads blocked on LOCK, or
+ * SCHED_NPRIO if there are none.
+ */
+static
+unsigned
+pi_waitprio(struct lock *lock)
+{
+	struct thread *t;
+	unsigned prio, best;
+
+	KASSERT(spinlock_do_i_hold(&pi_lock));
+
+	best = SCHED_NPRIO;
+	for (t = lock->lk_waiters; t != NULL; t = t->t_pinext) {
+		prio = thread_getpriority(t);
+		if (prio < best) {
+			best = prio;
+		}
+	}
+	return best;
+}
+
+/*
+ * Thread T is about to block on LOCK, either the current thread in
+ * lock_acquire or a CV waiter being moved onto the lock's wait channel:
+ * join its waiters and pass T's priority down the chain of holders.
+ */
+static
+void
+pi_block(struct lock *lock, struct thread *t)
+{
+	struct thread *holder;
+	unsigned prio;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	spinlock_acquire(&pi_lock);
+
+	KASSERT(t->t_blockedon == NULL);
+	t->t_blockedon = lock;
+	t->t_pinext = lock->lk_waiters;
+	lock->lk_waiters = t;
+
+	prio = thread_getpriority(t);
+	while (lock != NULL && (holder = lock->lk_holder) != NULL &&
+	       thread_getpriority(holder) > prio) {
+		thread_setinherit(holder, prio);
+		lock = holder->t_blockedon;
+	}
+
+	spinlock_release(&pi_lock);
 }
 
+/*
+ * Make the current thread the holder of LOCK, which is free. If we
+ * were blocked on it we aren't any more, and if others still are we
+ * take on their priority.
+ */
+static
 void
-lock_acquire(struct lock *lock)
+lock_sethold(struct lock *lock)
 {
-	DEBUGASSERT(lock != NULL);
-	KASSERT(curthread->t_in_interrupt == false);
+	struct thread **tp;
+	unsigned prio;
 
-	spinlock_acquire(&lock->lk_lock);
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+	KASSERT(lock->lk_holder == NULL);
+
+	if (curthread->t_blockedon == NULL && lock->lk_waiters == NULL) {
+		lock->lk_holder = curthread;
+	}
+	else {
+		spinlock_acquire(&pi_lock);
+		if (curthread->t_blockedon != NULL) {
+			KASSERT(curthread->t_blockedon == lock);
+			tp = &lock->lk_waiters;
+			while (*tp != curthread) {
+				KASSERT(*tp != NULL);
+				tp = &(*tp)->t_pinext;
+			}
+			*tp = curthread->t_pinext;
+			curthread->t_pinext = NULL;
+			curthread->t_blockedon = NULL;
+		}
+		lock->lk_holder = curthread;
+		prio = pi_waitprio(lock);
+		if (prio < curthread->t_inherit) {
+			thread_setinherit(curthread, prio);
+		}
+		spinlock_release(&pi_lock);
+	}
+
+	lock->lk_heldnext = curthread->t_heldlocks;
+	curthread->t_heldlocks = lock;
+}
+
+/*
+ * Give up LOCK, and with it whatever priority we inherited through it.
+ */
+static
+void
+lock_clearhold(struct lock *lock)
+{
+	struct lock **lp, *l;
+	unsigned prio, best;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+	KASSERT(lock->lk_holder == curthread);
+
+	/* Locks are mostly released last-in first-out. */
+	lp = &curthread->t_heldlocks;
+	while (*lp != lock) {
+		KASSERT(*lp != NULL);
+		lp = &(*lp)->lk_heldnext;
+	}
+	*lp = lock->lk_heldnext;
+	lock->lk_heldnext = NULL;
+
+	if (lock->lk_waiters == NULL && curthread->t_inherit == SCHED_NPRIO) {
+		lock->lk_holder = NULL;
+		return;
+	}
+
+	spinlock_acquire(&pi_lock);
+	lock->lk_holder = NULL;
+	best = SCHED_NPRIO;
+	for (l = curthread->t_heldlocks; l != NULL; l = l->lk_heldnext) {
+		prio = pi_waitprio(l);
+		if (prio < best) {
+			best = prio;
+		}
+	}
+	if (best != curthread->t_inherit) {
+		thread_setinherit(curthread, best);
+	}
+	spinlock_release(&pi_lock);
+}
+
+/*
+ * How many times lock_acquire polls a lock whose holder is running
+ * before giving up and sleeping. This should be somewhat more than a
+ * short critical section and well under the cost of the two context
+ * switches that sleeping costs.
+ */
+#define LOCK_SPINS	1000
+#define LOCK_SPINCHECK	100
+
+/*
+ * Check if thread T is running on some other cpu right now. This is
+ * only a hint: nothing stops it from changing straight afterwards.
+ */
+static
+bool
+lock_holder_running(struct thread *t)
+{
+	return t->t_state == S_RUN && t->t_cpu != curcpu &&
+		t->t_cpu->c_curthread == t;
+}
+
+/*
+ * The guts of lock_acquire. Called with lk_lock held, and returns with
+ * it held again; cv_wait uses this too.
+ */
+static
+void
+lock_acquire_locked(struct lock *lock)
+{
+	struct thread *holder;
+	unsigned spins;
+	bool slept;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
 
 	/* Call this (atomically) before waiting for a lock */
 	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
 
 	KASSERT(lock->lk_holder != curthread);
-	while (lock->lk_holder != NULL) {
-		/* As in the semaphore. */
+	spins = 0;
+	slept = false;
+	while ((holder = lock->lk_holder) != NULL) {
+		if (spins < LOCK_SPINS && lock_holder_running(holder)) {
+			/*
+			 * Wait for the holder to let go, without lk_lock
+			 * so it can. Come back every LOCK_SPINCHECK polls
+			 * to see if it is still running; that has to be
+			 * done under lk_lock, since once the holder lets
+			 * go it may exit and its thread be freed.
+			 */
+			spinlock_release(&lock->lk_lock);
+			do {
+				spins++;
+			} while (spins % LOCK_SPINCHECK != 0 &&
+				 lock->lk_holder == holder);
+			spinlock_acquire(&lock->lk_lock);
+			continue;
+		}
+		/*
+		 * As in the semaphore. A CV waiter was already put on
+		 * the waiters by cv_signal or cv_broadcast.
+		 */
+		if (!slept && curthread->t_blockedon == NULL) {
+			pi_block(lock, curthread);
+		}
+		slept = true;
+		lock->lk_sleeps++;
 		wchan_sleep(lock->lk_wchan, &lock->lk_lock);
 	}
-	lock->lk_holder = curthread;
+	lock_sethold(lock);
+	if (spins > 0 && !slept) {
+		lock->lk_spins++;
+	}
 
 	/* Call this (atomically) once the lock is acquired */
 	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
 
-	spinlock_release(&lock->lk_lock);
+	if (slept) {
+		pcpu_add(PCPU_LOCK_SLEEP, 1);
+	}
+	else if (spins > 0) {
+		pcpu_add(PCPU_LOCK_SPIN, 1);
+	}
 }
 
 void
-lock_release(struct lock *lock)
+lock_acquire(struct lock *lock)
 {
 	DEBUGASSERT(lock != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
 
 	spinlock_acquire(&lock->lk_lock);
+	lock_acquire_locked(lock);
+	spinlock_release(&lock->lk_lock);
+}
 
-	KASSERT(lock->lk_holder == curthread);
-	lock->lk_holder = NULL;
+bool
+lock_tryacquire(struct lock *lock)
+{
+	bool got;
+
+	DEBUGASSERT(lock != NULL);
+
+	spinlock_acquire(&lock->lk_lock);
+	KASSERT(lock->lk_holder != curthread);
+	got = (lock->lk_holder == NULL);
+	if (got) {
+		lock_sethold(lock);
+		HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+		HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	}
+	spinlock_release(&lock->lk_lock);
+
+	return got;
+}
+
+/*
+ * The guts of lock_release, for callers that hold lk_lock.
+ */
+static
+void
+lock_release_locked(struct lock *lock)
+{
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	lock_clearhold(lock);
 	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
 
 	/* Call this (atomically) when the lock is released */
 	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
+}
 
+void
+lock_release(struct lock *lock)
+{
+	DEBUGASSERT(lock != NULL);
+
+	spinlock_acquire(&lock->lk_lock);
+	lock_release_locked(lock);
 	spinlock_release(&lock->lk_lock);
 }
 
@@ -239,6 +536,17 @@ lock_do_i_hold(struct lock *lock)
 ////////////////////////////////////////////////////////////
 //
 // CV
+//
+// The CV's wait channel is protected by the spinlock inside the lock
+// it is used with, lk_lock. That lets cv_wait release the lock and go
+// to sleep under one spinlock, and lets cv_signal and cv_broadcast
+// move waiters straight over to the lock's wait channel ("wait
+// morphing") instead of waking them: they could not run anyway until
+// the signaller releases the lock, and each lock_release then wakes
+// exactly one of them. Waking them all at once would only have them
+// pile up in lock_acquire and go back to sleep.
+//
+// The price is that all waiters on a CV must use the same lock.
 
 
 struct cv *
@@ -246,25 +554,24 @@ cv_create(const char *name)
 {
 	struct cv *cv;
 
-	cv = kmalloc(sizeof(*cv));
+	cv = kcache_alloc(cv_cache);
 	if (cv == NULL) {
 		return NULL;
 	}
 
 	cv->cv_name = kstrdup(name);
 	if (cv->cv_name==NULL) {
-		kfree(cv);
+		kcache_free(cv_cache, cv);
 		return NULL;
 	}
 
 	cv->cv_wchan = wchan_create(cv->cv_name);
 	if (cv->cv_wchan == NULL) {
 		kfree(cv->cv_name);
-		kfree(cv);
+		kcache_free(cv_cache, cv);
 		return NULL;
 	}
 
-	spinlock_init(&cv->cv_wchanlock);
 	return cv;
 }
 
@@ -273,45 +580,224 @@ cv_destroy(struct cv *cv)
 {
 	KASSERT(cv != NULL);
 
-	spinlock_cleanup(&cv->cv_wchanlock);
 	wchan_destroy(cv->cv_wchan);
 
 	kfree(cv->cv_name);
-	kfree(cv);
+	kcache_free(cv_cache, cv);
 }
 
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
-	spinlock_acquire(&cv->cv_wchanlock);
-	lock_release(lock);
-	wchan_sleep(cv->cv_wchan, &cv->cv_wchanlock);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&lock->lk_lock);
+	lock_release_locked(lock);
+	wchan_sleep(cv->cv_wchan, &lock->lk_lock);
 	/*
-	 * It is kind of silly to acquire this spinlock in wchan_sleep
-	 * and then release it right away. If we were going for
-	 * performance we might pass a flag to avoid that in this
-	 * case. Or we might use lock->lk_lock to protect the wchan
-	 * and separate out enough of the lock_acquire/lock_release
-	 * logic to make that work cleanly.
+	 * By now we have normally been moved to the lock's wait
+	 * channel and woken by lock_release, so the lock is probably
+	 * free; but someone may have beaten us to it.
 	 */
-	spinlock_release(&cv->cv_wchanlock);
-	lock_acquire(lock);
+	lock_acquire_locked(lock);
+	spinlock_release(&lock->lk_lock);
 }
 
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
-	(void)lock;
-	spinlock_acquire(&cv->cv_wchanlock);
-	wchan_wakeone(cv->cv_wchan, &cv->cv_wchanlock);
-	spinlock_release(&cv->cv_wchanlock);
+	struct thread *t;
+
+	spinlock_acquire(&lock->lk_lock);
+	KASSERT(lock->lk_holder == curthread);
+	t = wchan_moveone(cv->cv_wchan, lock->lk_wchan, &lock->lk_lock);
+	if (t != NULL) {
+		pi_block(lock, t);
+	}
+	spinlock_release(&lock->lk_lock);
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-	(void)lock;
-	spinlock_acquire(&cv->cv_wchanlock);
-	wchan_wakeall(cv->cv_wchan, &cv->cv_wchanlock);
-	spinlock_release(&cv->cv_wchanlock);
+	struct thread *t;
+
+	spinlock_acquire(&lock->lk_lock);
+	KASSERT(lock->lk_holder == curthread);
+	while ((t = wchan_moveone(cv->cv_wchan, lock->lk_wchan,
+				  &lock->lk_lock)) != NULL) {
+		pi_block(lock, t);
+	}
+	spinlock_release(&lock->lk_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kcache_alloc(rwlock_cache);
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rw_name = kstrdup(name);
+	if (rw->rw_name == NULL) {
+		kcache_free(rwlock_cache, rw);
+		return NULL;
+	}
+
+	HANGMAN_LOCKABLEINIT(&rw->rw_hangman, rw->rw_name);
+
+	rw->rw_rwchan = wchan_create(rw->rw_name);
+	if (rw->rw_rwchan == NULL) {
+		kfree(rw->rw_name);
+		kcache_free(rwlock_cache, rw);
+		return NULL;
+	}
+	rw->rw_wwchan = wchan_create(rw->rw_name);
+	if (rw->rw_wwchan == NULL) {
+		wchan_destroy(rw->rw_rwchan);
+		kfree(rw->rw_name);
+		kcache_free(rwlock_cache, rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_writer = NULL;
+	rw->rw_readers = 0;
+	rw->rw_rwaiting = 0;
+	rw->rw_wwaiting = 0;
+	rw->rw_handoffs = 0;
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_rwaiting == 0);
+	KASSERT(rw->rw_wwaiting == 0);
+
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_wwchan);
+	wchan_destroy(rw->rw_rwchan);
+
+	kfree(rw->rw_name);
+	kcache_free(rwlock_cache, rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	unsigned handoffs;
+
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	HANGMAN_WAIT(&curthread->t_hangman, &rw->rw_hangman);
+
+	KASSERT(rw->rw_writer != curthread);
+	if (rw->rw_writer != NULL || rw->rw_wwaiting > 0) {
+		/*
+		 * Wait for the next writer to hand the lock over. It
+		 * counts us into rw_readers when it does, so check
+		 * rw_handoffs rather than the lock state: by the time we
+		 * run, another writer may be waiting again.
+		 */
+		handoffs = rw->rw_handoffs;
+		rw->rw_rwaiting++;
+		while (rw->rw_handoffs == handoffs) {
+			wchan_sleep(rw->rw_rwchan, &rw->rw_lock);
+		}
+	}
+	else {
+		rw->rw_readers++;
+	}
+
+	HANGMAN_CANCEL(&curthread->t_hangman, &rw->rw_hangman);
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	HANGMAN_WAIT(&curthread->t_hangman, &rw->rw_hangman);
+
+	KASSERT(rw->rw_writer != curthread);
+	if (rw->rw_writer != NULL || rw->rw_readers > 0) {
+		rw->rw_wwaiting++;
+		while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+			wchan_sleep(rw->rw_wwchan, &rw->rw_lock);
+		}
+		rw->rw_wwaiting--;
+	}
+	rw->rw_writer = curthread;
+
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &rw->rw_hangman);
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	if (rw->rw_writer == curthread) {
+		rw->rw_writer = NULL;
+		HANGMAN_RELEASE(&curthread->t_hangman, &rw->rw_hangman);
+
+		if (rw->rw_rwaiting > 0) {
+			/* Readers' turn; let them all in at once. */
+			rw->rw_readers += rw->rw_rwaiting;
+			rw->rw_rwaiting = 0;
+			rw->rw_handoffs++;
+			wchan_wakeall(rw->rw_rwchan, &rw->rw_lock);
+		}
+		else {
+			wchan_wakeone(rw->rw_wwchan, &rw->rw_lock);
+		}
+	}
+	else {
+		KASSERT(rw->rw_readers > 0);
+		rw->rw_readers--;
+		if (rw->rw_readers == 0 && rw->rw_wwaiting > 0) {
+			wchan_wakeone(rw->rw_wwchan, &rw->rw_lock);
+		}
+	}
+
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold(struct rwlock *rw)
+{
+	bool ret;
+
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	ret = (rw->rw_writer == curthread);
+	spinlock_release(&rw->rw_lock);
+
+	return ret;
 }
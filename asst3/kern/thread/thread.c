@@ -42,7 +42,11 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <clock.h>
+#include <kcache.h>
 #include <wchan.h>
+#include <workqueue.h>
+#include <qsbr.h>
 #include <thread.h>
 #include <threadlist.h>
 #include <threadprivate.h>
@@ -72,6 +76,13 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Object caches for threads and wait channels. */
+static struct kcache *thread_cache;
+static struct kcache *wchan_cache;
+
+/* Whether thread_stack_get/put use the per-cpu stack cache. */
+static bool thread_stackcache_on = true;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -111,6 +122,96 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Give THREAD a stack, from this cpu's cache of stacks of exited
+ * threads if there is one there, otherwise a new one. Cached stacks
+ * still have the guard values from when they were new (they were
+ * checked on the way in), so only a new one needs them put on.
+ *
+ * The cache is touched only by this cpu, with interrupts off so we
+ * can't be moved to another cpu halfway through.
+ */
+static
+int
+thread_stack_get(struct thread *thread)
+{
+	void *stack;
+	int spl;
+
+	stack = NULL;
+	spl = splhigh();
+	if (thread_stackcache_on && curcpu->c_nstacks > 0) {
+		stack = curcpu->c_stacks[--curcpu->c_nstacks];
+	}
+	splx(spl);
+
+	if (stack != NULL) {
+		thread->t_stack = stack;
+		pcpu_add(PCPU_STACK_HIT, 1);
+		return 0;
+	}
+
+	thread->t_stack = kmalloc(STACK_SIZE);
+	if (thread->t_stack == NULL) {
+		return ENOMEM;
+	}
+	thread_checkstack_init(thread);
+	pcpu_add(PCPU_STACK_MISS, 1);
+	return 0;
+}
+
+/*
+ * Take THREAD's stack back, into this cpu's cache if there is room.
+ */
+static
+void
+thread_stack_put(struct thread *thread)
+{
+	void *stack;
+	int spl;
+
+	thread_checkstack(thread);
+	stack = thread->t_stack;
+	thread->t_stack = NULL;
+
+	spl = splhigh();
+	if (thread_stackcache_on && curcpu->c_nstacks < THREAD_STACKCACHE) {
+		curcpu->c_stacks[curcpu->c_nstacks++] = stack;
+		stack = NULL;
+	}
+	splx(spl);
+
+	if (stack != NULL) {
+		kfree(stack);
+	}
+}
+
+/*
+ * Turn the stack cache on or off, for benchmarking. Turning it off
+ * also empties every cpu's cache, which touches other cpus' caches
+ * behind their backs, so do it only when nothing else is creating or
+ * destroying threads.
+ */
+void
+thread_stackcache_enable(bool on)
+{
+	struct cpu *c;
+	unsigned i;
+	int spl;
+
+	spl = splhigh();
+	thread_stackcache_on = on;
+	if (!on) {
+		for (i=0; i < cpuarray_num(&allcpus); i++) {
+			c = cpuarray_get(&allcpus, i);
+			while (c->c_nstacks > 0) {
+				kfree(c->c_stacks[--c->c_nstacks]);
+			}
+		}
+	}
+	splx(spl);
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -123,14 +224,14 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kcache_alloc(thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		kcache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -144,12 +245,24 @@ thread_create(const char *name)
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
+	thread->t_priority = 0;
+	thread->t_basepri = 0;
+	thread->t_ticks = 0;
+	thread->t_affinity = THREAD_AFFINITY_ALL;
+	thread->t_migrations = 0;
+	thread->t_inherit = SCHED_NPRIO;
+	thread->t_blockedon = NULL;
+	thread->t_pinext = NULL;
+	thread->t_heldlocks = NULL;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Public fields */
+	thread->t_utid = 0;
+
 	/* If you add to struct thread, be sure to initialize here */
 
 	return thread;
@@ -169,6 +282,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -180,15 +294,39 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_migrating);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	for (i=0; i<PCPU_NCOUNTERS; i++) {
+		c->c_counters[i] = 0;
+	}
+	c->c_nstacks = 0;
+	c->c_qsbr_readers = 0;
+	c->c_qsbr_gen = 0;
+
+	c->c_timers = timerwheel_create();
+	if (c->c_timers == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
+	c->c_workqueue = workqueue_create();
+	if (c->c_workqueue == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
+	bzero(&c->c_migratework, sizeof(c->c_migratework));
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	for (i=0; i<SCHED_NPRIO; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	threadlist_init(&c->c_strideq);
+	c->c_tspass = 0;
+	c->c_vtime = 0;
+	/* Other cpus take this to steal and wake; keep it fair */
+	spinlock_init_ticket(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_curas = NULL;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -255,6 +393,24 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Number of cpus.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+/*
+ * Cpu number NUM. (c_number is the index in allcpus.)
+ */
+struct cpu *
+cpu_get(unsigned num)
+{
+	return cpuarray_get(&allcpus, num);
+}
+
 /*
  * Destroy a thread.
  *
@@ -278,7 +434,7 @@ thread_destroy(struct thread *thread)
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
 	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
+		thread_stack_put(thread);
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
@@ -287,7 +443,7 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	kcache_free(thread_cache, thread);
 }
 
 /*
@@ -317,6 +473,9 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	struct threadlist *rq;
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -331,9 +490,13 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<=SCHED_NPRIO; i++) {
+		rq = (i < SCHED_NPRIO) ? &curcpu->c_runqueue[i] :
+			&curcpu->c_strideq;
+		rq->tl_count = 0;
+		rq->tl_head.tln_next = &rq->tl_tail;
+		rq->tl_tail.tln_prev = &rq->tl_head;
+	}
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -374,6 +537,12 @@ thread_shutdown(void)
 void
 thread_bootstrap(void)
 {
+	thread_cache = kcache_create("thread", sizeof(struct thread),
+				     NULL, NULL);
+	if (thread_cache == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+
 	cpuarray_init(&allcpus);
 
 	/*
@@ -445,10 +614,354 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Check if thread T's affinity mask allows it to run on cpu C.
+ */
+static
+bool
+thread_canrun(struct thread *t, struct cpu *c)
+{
+	return (t->t_affinity & (1U << c->c_number)) != 0;
+}
+
+/*
+ * Stride class bookkeeping. p_tickets and p_pass of every process are
+ * protected by stride_lock, which nests inside the run queue locks.
+ */
+static struct spinlock stride_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Check if thread T belongs to the stride class.
+ */
+static
+bool
+thread_isstride(struct thread *t)
+{
+	return t->t_proc != NULL && t->t_proc->p_tickets > 0;
+}
+
+/*
+ * Effective priority: the thread's own level, or an inherited one if
+ * that is higher (lower-numbered).
+ */
+unsigned
+thread_getpriority(struct thread *t)
+{
+	return t->t_inherit < t->t_priority ? t->t_inherit : t->t_priority;
+}
+
+/*
+ * Run queue operations. Each cpu has one queue per priority level for
+ * the default class, and one queue for the stride class; a thread
+ * goes on the queue for its class and effective level. The caller
+ * must hold the cpu's run queue lock.
+ */
+
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_priority < SCHED_NPRIO);
+
+	if (thread_isstride(t)) {
+		threadlist_addtail(&c->c_strideq, t);
+	}
+	else {
+		threadlist_addtail(&c->c_runqueue[thread_getpriority(t)], t);
+	}
+}
+
+/*
+ * Pick the next thread to run on C.
+ *
+ * The default class as a whole and each stride process are clients
+ * of a stride scheduler: the one with the lowest pass goes next. A
+ * client coming back from having nothing runnable has its pass moved
+ * up to the cpu's virtual time, so it can't save up cpu time while
+ * asleep. Within the default class, take the first thread from the
+ * highest-priority nonempty queue.
+ */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t, *best;
+	bool havets;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	havets = false;
+	for (i=0; i<SCHED_NPRIO; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			havets = true;
+			break;
+		}
+	}
+
+	best = NULL;
+	if (!threadlist_isempty(&c->c_strideq)) {
+		spinlock_acquire(&stride_lock);
+		THREADLIST_FORALL(t, c->c_strideq) {
+			if (t->t_proc->p_pass < c->c_vtime) {
+				t->t_proc->p_pass = c->c_vtime;
+			}
+			if (best == NULL ||
+			    t->t_proc->p_pass < best->t_proc->p_pass) {
+				best = t;
+			}
+		}
+		if (havets && c->c_tspass < c->c_vtime) {
+			c->c_tspass = c->c_vtime;
+		}
+		if (havets && c->c_tspass <= best->t_proc->p_pass) {
+			best = NULL;
+		}
+		else {
+			c->c_vtime = best->t_proc->p_pass;
+		}
+		spinlock_release(&stride_lock);
+	}
+	if (best != NULL) {
+		threadlist_remove(&c->c_strideq, best);
+		return best;
+	}
+
+	if (!havets) {
+		return NULL;
+	}
+	if (c->c_tspass > c->c_vtime) {
+		c->c_vtime = c->c_tspass;
+	}
+	return threadlist_remhead(&c->c_runqueue[i]);
+}
+
+/*
+ * Take the thread that would otherwise run last on C, among those
+ * allowed to run on cpu DEST.
+ */
+static
+struct thread *
+runqueue_remtail(struct cpu *c, struct cpu *dest)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=SCHED_NPRIO; i-- > 0; ) {
+		THREADLIST_FORALL_REV(t, c->c_runqueue[i]) {
+			if (thread_canrun(t, dest)) {
+				threadlist_remove(&c->c_runqueue[i], t);
+				return t;
+			}
+		}
+	}
+	THREADLIST_FORALL_REV(t, c->c_strideq) {
+		if (thread_canrun(t, dest)) {
+			threadlist_remove(&c->c_strideq, t);
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Number of threads on C's run queues. Without the run queue lock
+ * held the answer is only a hint, which is all thread_steal needs.
+ */
+static
+unsigned
+runqueue_count(struct cpu *c)
+{
+	unsigned i, count;
+
+	count = c->c_strideq.tl_count;
+	for (i=0; i<SCHED_NPRIO; i++) {
+		count += c->c_runqueue[i].tl_count;
+	}
+	return count;
+}
+
+/*
+ * Work stealing.
+ *
+ * Called by a cpu that has run out of threads, from the idle loop in
+ * thread_switch, before it goes to sleep in cpu_idle(). Busy cpus
+ * never push work around; instead the idle one picks the busiest
+ * other cpu and takes half of its waiting threads, from the tail of
+ * its queues (the lowest-priority, last-to-run end). Because the idle
+ * loop wakes up on every hardclock, an idle cpu finds new work within
+ * one tick.
+ *
+ * The victim is chosen by peeking at the other cpus' queue lengths
+ * without locking them, so finding nothing to do costs no lock
+ * traffic at all. Only the victim's lock is taken, and never together
+ * with our own, so two cpus stealing at once can't deadlock.
+ *
+ * Migrating threads isn't free because of cache affinity; a thread's
+ * working cache set will end up having to be moved to the other CPU.
+ * But an idle cpu has nothing better to do, and System/161 does not
+ * (yet) model such cache effects anyway.
+ *
+ * Returns true if it found anything.
+ */
+static
+bool
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct threadlist stolen;
+	struct thread *t;
+	unsigned i, numcpus, count, best, to_take;
+
+	numcpus = cpuarray_num(&allcpus);
+
+	/*
+	 * Start the search with our neighbour so that cpus with nothing
+	 * to do don't all pile onto the same victim.
+	 */
+	victim = NULL;
+	best = 0;
+	for (i=1; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, (curcpu->c_number + i) % numcpus);
+		if (c->c_isidle) {
+			/* It'll run what it has itself. */
+			continue;
+		}
+		count = runqueue_count(c);
+		if (count > best) {
+			best = count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return false;
+	}
+
+	threadlist_init(&stolen);
+	spinlock_acquire(&victim->c_runqueue_lock);
+	to_take = DIVROUNDUP(runqueue_count(victim), 2);
+	for (i=0; i<to_take; i++) {
+		t = runqueue_remtail(victim, curcpu->c_self);
+		if (t == NULL) {
+			/* Nothing left that may run here. */
+			break;
+		}
+		/*
+		 * Ordinarily, the victim's curthread will not appear
+		 * on its run queue. However, it can under the
+		 * following circumstances:
+		 *   - it went to sleep;
+		 *   - the processor became idle, so it remained
+		 *     curthread;
+		 *   - it was reawakened, so it was put on the run
+		 *     queue;
+		 *   - and the processor hasn't fully unidled yet, so
+		 *     all these things are still true.
+		 *
+		 * Migrating that thread can cause bad things to
+		 * happen, so put it back and stop.
+		 */
+		if (t == victim->c_curthread) {
+			runqueue_add(victim, t);
+			break;
+		}
+		t->t_cpu = curcpu->c_self;
+		t->t_migrations++;
+		threadlist_addhead(&stolen, t);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (threadlist_isempty(&stolen)) {
+		threadlist_cleanup(&stolen);
+		return false;
+	}
+
+	pcpu_add(PCPU_STEAL, 1);
+	pcpu_add(PCPU_MIGRATE, stolen.tl_count);
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	while ((t = threadlist_remhead(&stolen)) != NULL) {
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+		      t->t_name, victim->c_number, curcpu->c_number);
+		runqueue_add(curcpu->c_self, t);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	threadlist_cleanup(&stolen);
+	return true;
+}
+
+/*
+ * Choose the cpu to wake thread T up on.
+ *
+ * The cpu it last ran on (t_cpu) probably still has its working set
+ * in cache, so if that cpu is idle, use it. Otherwise use the cpu
+ * doing the waking: a thread woken by another is likely to work on
+ * what the waker just produced, so keeping the pair together keeps
+ * that data in one cache too. (Not when woken from an interrupt
+ * handler; there the waker is whatever thread happened to be running.)
+ * Failing both, go back to t_cpu, or to the first allowed cpu,
+ * preferring an idle one. Work stealing evens things out later.
+ *
+ * A thread can't be moved if it is still curthread on its cpu: that
+ * happens when it went to sleep, the cpu went idle on its stack, and
+ * it is now being woken before the cpu has picked anything else.
+ */
+static
+struct cpu *
+thread_wakeup_cpu(struct thread *t)
+{
+	struct cpu *last, *here, *c, *fallback;
+	bool stillthere, lastidle;
+	unsigned i, numcpus;
+
+	last = t->t_cpu;
+	here = curcpu->c_self;
+
+	spinlock_acquire(&last->c_runqueue_lock);
+	stillthere = (last->c_curthread == t);
+	lastidle = last->c_isidle;
+	spinlock_release(&last->c_runqueue_lock);
+
+	if (stillthere) {
+		return last;
+	}
+	if (lastidle && thread_canrun(t, last)) {
+		return last;
+	}
+	if (!curthread->t_in_interrupt && thread_canrun(t, here)) {
+		return here;
+	}
+	if (thread_canrun(t, last)) {
+		return last;
+	}
+
+	fallback = last;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!thread_canrun(t, c)) {
+			continue;
+		}
+		if (c->c_isidle) {
+			return c;
+		}
+		if (fallback == last) {
+			fallback = c;
+		}
+	}
+	return fallback;
+}
+
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too.
+ * If the caller already holds a run queue lock, it's for the thread's
+ * own cpu, and the thread stays there. Otherwise we're waking it up,
+ * and it goes wherever thread_wakeup_cpu says.
  */
 static
 void
@@ -456,20 +969,23 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 {
 	struct cpu *targetcpu;
 
-	/* Lock the run queue of the target thread's cpu. */
-	targetcpu = target->t_cpu;
-
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
+		targetcpu = target->t_cpu;
 		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
 	}
 	else {
+		targetcpu = thread_wakeup_cpu(target);
+		if (targetcpu != target->t_cpu) {
+			target->t_cpu = targetcpu;
+			target->t_migrations++;
+		}
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -484,6 +1000,56 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 }
 
+/*
+ * Send off threads that yielded on a cpu their affinity mask no
+ * longer allows (see thread_switch). Like exorcise, this has to wait
+ * until we're off their stacks.
+ */
+static
+void
+send_migrants(void)
+{
+	struct thread *t;
+
+	while ((t = threadlist_remhead(&curcpu->c_migrating)) != NULL) {
+		KASSERT(t != curthread);
+		KASSERT(t->t_state == S_READY);
+		thread_make_runnable(t, false);
+	}
+}
+
+/*
+ * Work function for c_migratework. There's nothing to do: by the time
+ * the worker gets here it has already run send_migrants on its way
+ * out of thread_switch.
+ */
+static
+void
+thread_evictwork(void *data)
+{
+	(void)data;
+}
+
+/*
+ * Called from the idle loop in thread_switch, like thread_steal. If
+ * the thread we're idling on has been refused this cpu (see
+ * thread_switch), it can't leave until we switch off its stack, and
+ * with nothing else to run we never would. So wake our worker thread,
+ * which is bound here; switching to it sends the migrant on. Returns
+ * true if the worker was woken and the run queue should be checked
+ * again.
+ */
+static
+bool
+thread_evict(void)
+{
+	if (threadlist_isempty(&curcpu->c_migrating)) {
+		return false;
+	}
+	return workqueue_enqueue(&curcpu->c_migratework, thread_evictwork,
+				 NULL);
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -508,13 +1074,12 @@ thread_fork(const char *name,
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
+	/* Get a stack */
+	result = thread_stack_get(newthread);
+	if (result) {
 		thread_destroy(newthread);
-		return ENOMEM;
+		return result;
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -522,6 +1087,9 @@ thread_fork(const char *name,
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_basepri = curthread->t_basepri;
+	newthread->t_priority = newthread->t_basepri;
+	newthread->t_affinity = curthread->t_affinity;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -587,11 +1155,18 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
+	/* We can't be in a qsbr read-side section; tell qsbr.c. */
+	qsbr_quiescent();
+
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. A thread
+	 * that isn't allowed here any more has to leave regardless.
+	 */
+	if (newstate == S_READY && runqueue_count(curcpu->c_self) == 0 &&
+	    thread_canrun(cur, curcpu->c_self)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -602,7 +1177,17 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
-		thread_make_runnable(cur, true /*have lock*/);
+		if (thread_canrun(cur, curcpu->c_self)) {
+			thread_make_runnable(cur, true /*have lock*/);
+		}
+		else {
+			/*
+			 * Not allowed here any more. We're on its
+			 * stack, so it can't go to another cpu yet;
+			 * send_migrants does that after the switch.
+			 */
+			threadlist_addtail(&curcpu->c_migrating, cur);
+		}
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
@@ -644,10 +1229,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu->c_self);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (!thread_evict() && !thread_steal()) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -726,6 +1313,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Move threads that can't run here any more. */
+	send_migrants();
+
 	/* Turn interrupts back on. */
 	splx(spl);
 }
@@ -759,6 +1349,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Move threads that can't run here any more. */
+	send_migrants();
+
 	/* Enable interrupts. */
 	spl0();
 
@@ -821,139 +1414,314 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Each cpu has SCHED_NPRIO run
+ * queues and always runs the first thread of the highest-priority
+ * (lowest-numbered) nonempty one. A thread at level L gets a quantum
+ * of SCHED_QUANTUM << L hardclocks:
+ *
+ *    - using up a whole quantum moves it down one level, so CPU hogs
+ *      sink to the long, low-priority quanta;
+ *    - going to sleep in wchan_sleep moves it up one level, so
+ *      interactive and I/O-bound threads float up and preempt hogs
+ *      as soon as they wake;
+ *    - schedule(), called every SCHEDULE_HARDCLOCKS from hardclock(),
+ *      moves everything back to its base level so nothing starves.
+ *
+ * A thread never rises above its base level (t_basepri), which is
+ * set with setpriority() and inherited across thread_fork.
+ *
+ * Processes given tickets with settickets() are instead in the
+ * proportional-share (stride) class, which sits alongside the MLFQ:
+ * on each cpu, the MLFQ as a whole counts as one client holding
+ * SCHED_TSTICKETS tickets, and each stride process is another. Every
+ * hardclock charges the running client STRIDE1 / tickets, and
+ * runqueue_remhead picks the client that has been charged least. So a
+ * process with 100 tickets competing with the MLFQ gets half a cpu
+ * however many threads the MLFQ has. Shares are per cpu; use
+ * setaffinity to pin processes that should share one.
  */
 
-void
-schedule(void)
-{
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
-}
+#define SCHED_QUANTUM	4U	/* Quantum at level 0, in hardclocks */
+#define STRIDE1		(1U << 20) /* Pass charged per tick at 1 ticket */
 
 /*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
+ * Periodic priority boost.
  *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * Threads that are asleep are not touched here; they move up on their
+ * way to sleep anyway.
  */
 void
-thread_consider_migration(void)
+schedule(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
+	struct threadlist boosted;
 	struct thread *t;
+	unsigned i;
+	int spl;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+	spl = splhigh();
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+
+	threadlist_init(&boosted);
+	for (i=1; i<SCHED_NPRIO; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i]))
+		       != NULL) {
+			threadlist_addtail(&boosted, t);
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
+	while ((t = threadlist_remhead(&boosted)) != NULL) {
+		t->t_priority = t->t_basepri;
+		t->t_ticks = 0;
+		runqueue_add(curcpu->c_self, t);
+	}
+	threadlist_cleanup(&boosted);
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
+	if (!curcpu->c_isidle) {
+		curthread->t_priority = curthread->t_basepri;
+		curthread->t_ticks = 0;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
+	spinlock_release(&curcpu->c_runqueue_lock);
+	splx(spl);
+}
+
+/*
+ * Charge the current thread for a hardclock. Returns true if its
+ * quantum has run out (in which case it has been demoted) or if a
+ * higher-priority thread is waiting for this cpu.
+ */
+bool
+thread_tick(void)
+{
+	struct thread *cur;
+	struct proc *p;
+	bool preempt;
+	unsigned i;
+	int spl;
+
+	cur = curthread;
+	preempt = false;
+
+	spl = splhigh();
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+
+	if (curcpu->c_isidle) {
+		/* Not running anything; thread_switch will sort it out. */
+		spinlock_release(&curcpu->c_runqueue_lock);
+		splx(spl);
+		return false;
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
+	cur->t_ticks++;
+	if (thread_isstride(cur)) {
+		/* Charge the process; round-robin its threads. */
+		p = cur->t_proc;
+		spinlock_acquire(&stride_lock);
+		if (p->p_tickets > 0) {
+			p->p_pass += STRIDE1 / p->p_tickets;
 		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
+		spinlock_release(&stride_lock);
+		if (cur->t_ticks >= SCHED_QUANTUM) {
+			cur->t_ticks = 0;
+			preempt = true;
+		}
+	}
+	else {
+		curcpu->c_tspass += STRIDE1 / SCHED_TSTICKETS;
+		if (cur->t_ticks >= (SCHED_QUANTUM << cur->t_priority)) {
+			if (cur->t_priority < SCHED_NPRIO - 1) {
+				cur->t_priority++;
+			}
+			cur->t_ticks = 0;
+			preempt = true;
+		}
+		else if (!threadlist_isempty(&curcpu->c_strideq) &&
+			 cur->t_ticks % SCHED_QUANTUM == 0) {
 			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
+			 * Let the stride clients compete at the same
+			 * granularity whatever level we're at.
 			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
+			preempt = true;
+		}
+		for (i=0; i<thread_getpriority(cur) && !preempt; i++) {
+			if (!threadlist_isempty(&curcpu->c_runqueue[i])) {
+				preempt = true;
 			}
+		}
+	}
+	if (!thread_canrun(cur, curcpu->c_self)) {
+		/* Its affinity changed; get it moved. */
+		preempt = true;
+	}
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
+	spinlock_release(&curcpu->c_runqueue_lock);
+	splx(spl);
+	return preempt;
+}
+
+/*
+ * Change the current thread's base priority. It starts a fresh
+ * quantum at the new level, and gives up the cpu in case that is now
+ * lower than something else waiting.
+ */
+void
+thread_setpriority(unsigned prio)
+{
+	int spl;
+
+	KASSERT(prio < SCHED_NPRIO);
+
+	spl = splhigh();
+	curthread->t_basepri = prio;
+	curthread->t_priority = prio;
+	curthread->t_ticks = 0;
+	splx(spl);
+
+	thread_yield();
+}
+
+/*
+ * Change the level thread T inherits.
+ *
+ * If T is on a run queue it has to move to the one for its new
+ * effective level. It may also be ready but on no queue at all, in
+ * transit between cpus (see thread_steal); then runqueue_add will
+ * pick up the new level when it gets there. A boost that races with
+ * T being woken up may be missed until T is next queued, at worst
+ * until the next schedule().
+ */
+void
+thread_setinherit(struct thread *t, unsigned prio)
+{
+	struct cpu *c;
+	struct thread *t2;
+	unsigned oldpri, newpri;
+	int spl;
+
+	KASSERT(prio <= SCHED_NPRIO);
+
+	spl = splhigh();
+	while (1) {
+		c = t->t_cpu;
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (t->t_cpu == c) {
+			break;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+	oldpri = thread_getpriority(t);
+	t->t_inherit = prio;
+	newpri = thread_getpriority(t);
+
+	if (newpri != oldpri && t->t_state == S_READY &&
+	    !thread_isstride(t)) {
+		THREADLIST_FORALL(t2, c->c_runqueue[oldpri]) {
+			if (t2 == t) {
+				threadlist_remove(&c->c_runqueue[oldpri], t);
+				threadlist_addtail(&c->c_runqueue[newpri], t);
+				break;
+			}
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
 	}
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	spinlock_release(&c->c_runqueue_lock);
+	splx(spl);
+}
+
+/*
+ * Change a process's stride tickets. A process joining the class
+ * keeps its old pass; runqueue_remhead brings it up to date. Yield
+ * so that the current thread goes on the right queue.
+ */
+void
+thread_settickets(struct proc *p, unsigned tickets)
+{
+	KASSERT(tickets <= SCHED_MAXTICKETS);
+
+	spinlock_acquire(&stride_lock);
+	p->p_tickets = tickets;
+	spinlock_release(&stride_lock);
+
+	thread_yield();
+}
+
+/*
+ * Copy the stride share to a new process. The child starts from the
+ * parent's pass so that forking earns no extra cpu time. p_pass is 64
+ * bits, so it can't be read safely without the lock.
+ */
+void
+thread_forktickets(struct proc *parent, struct proc *child)
+{
+	spinlock_acquire(&stride_lock);
+	child->p_tickets = parent->p_tickets;
+	child->p_pass = parent->p_pass;
+	spinlock_release(&stride_lock);
+}
+
+/*
+ * Change a thread's affinity mask. If T is the current thread and
+ * may no longer run here, this yields, and returns on an allowed cpu.
+ */
+int
+thread_setaffinity(struct thread *t, uint32_t mask)
+{
+	uint32_t present;
+	unsigned i;
+
+	present = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		present |= 1U << cpuarray_get(&allcpus, i)->c_number;
+	}
+	if ((mask & present) == 0) {
+		return EINVAL;
+	}
+
+	t->t_affinity = mask;
+	if (t == curthread && !thread_canrun(t, curcpu->c_self)) {
+		thread_yield();
+	}
+	return 0;
+}
+
+static
+void
+thread_printone(struct thread *t, const char *state)
+{
+	kprintf("    %-5s pri %u/%u  cpus 0x%08x  migrations %-5u %s\n",
+		state, thread_getpriority(t), t->t_basepri, t->t_affinity,
+		t->t_migrations, t->t_name);
+}
+
+/*
+ * Dump the scheduler state. Sleeping threads aren't on any list we
+ * can get at, so only running and runnable threads are shown.
+ */
+void
+thread_printsched(void)
+{
+	struct cpu *c;
+	struct thread *t;
+	unsigned i, j;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		kprintf("cpu%u:%s\n", c->c_number,
+			c->c_isidle ? " idle" : "");
+		if (!c->c_isidle) {
+			thread_printone(c->c_curthread, "run");
+		}
+		for (j=0; j<SCHED_NPRIO; j++) {
+			THREADLIST_FORALL(t, c->c_runqueue[j]) {
+				thread_printone(t, "ready");
+			}
+		}
+		THREADLIST_FORALL(t, c->c_strideq) {
+			thread_printone(t, "strd");
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -962,6 +1730,20 @@ thread_consider_migration(void)
  * Wait channel functions
  */
 
+/*
+ * Set up the wait channel cache. Locks make wait channels, and the
+ * kernel process makes a lock, so this runs before proc_bootstrap.
+ */
+void
+wchan_bootstrap(void)
+{
+	wchan_cache = kcache_create("wchan", sizeof(struct wchan),
+				    NULL, NULL);
+	if (wchan_cache == NULL) {
+		panic("wchan_bootstrap: Out of memory\n");
+	}
+}
+
 /*
  * Create a wait channel. NAME is a symbolic string name for it.
  * This is what's displayed by ps -alx in Unix.
@@ -975,7 +1757,7 @@ wchan_create(const char *name)
 {
 	struct wchan *wc;
 
-	wc = kmalloc(sizeof(*wc));
+	wc = kcache_alloc(wchan_cache);
 	if (wc == NULL) {
 		return NULL;
 	}
@@ -993,7 +1775,7 @@ void
 wchan_destroy(struct wchan *wc)
 {
 	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
+	kcache_free(wchan_cache, wc);
 }
 
 /*
@@ -1015,6 +1797,16 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	/* must not hold other spinlocks */
 	KASSERT(curcpu->c_spinlocks == 1);
 
+	/*
+	 * Blocking before the quantum runs out earns a move up one
+	 * level (see the scheduler comments above). Holding LK keeps
+	 * interrupts off, so this can't race with thread_tick.
+	 */
+	if (curthread->t_priority > curthread->t_basepri) {
+		curthread->t_priority--;
+	}
+	curthread->t_ticks = 0;
+
 	thread_switch(S_SLEEP, wc, lk);
 	spinlock_acquire(lk);
 }
@@ -1081,6 +1873,26 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move one sleeping thread from one wait channel to another, leaving
+ * it asleep. Used for wait morphing in the CV code.
+ */
+struct thread *
+wchan_moveone(struct wchan *from, struct wchan *to, struct spinlock *lk)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	target = threadlist_remhead(&from->wc_threads);
+	if (target == NULL) {
+		return NULL;
+	}
+	target->t_wchan_name = to->wc_name;
+	threadlist_addtail(&to->wc_threads, target);
+	return target;
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1098,6 +1910,92 @@ wchan_isempty(struct wchan *wc, struct spinlock *lk)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Per-cpu counters
+ */
+
+static const char *const pcpu_names[PCPU_NCOUNTERS] = {
+	[PCPU_KMALLOC] = "kmalloc",
+	[PCPU_KFREE] = "kfree",
+	[PCPU_KMALLOC_PAGES] = "kmalloc pages",
+	[PCPU_VMFAULT] = "vm faults",
+	[PCPU_SYSCALL] = "syscalls",
+	[PCPU_STEAL] = "steals",
+	[PCPU_MIGRATE] = "threads stolen",
+	[PCPU_LOCK_SPIN] = "lock spins",
+	[PCPU_LOCK_SLEEP] = "lock sleeps",
+	[PCPU_STACK_HIT] = "stack reuses",
+	[PCPU_STACK_MISS] = "stack allocs",
+};
+
+/*
+ * Counts from before the boot cpu's struct cpu exists. There's only
+ * one cpu running then, with interrupts off, so no locking.
+ */
+static unsigned long pcpu_bootcounters[PCPU_NCOUNTERS];
+
+/*
+ * Add N to counter CTR on this cpu. Interrupts are turned off so that
+ * we can't be moved to another cpu halfway through the update, and so
+ * that an interrupt handler counting the same thing can't get in.
+ */
+void
+pcpu_add(enum pcpu_counter ctr, unsigned long n)
+{
+	int spl;
+
+	KASSERT(ctr < PCPU_NCOUNTERS);
+
+	if (!CURCPU_EXISTS()) {
+		pcpu_bootcounters[ctr] += n;
+		return;
+	}
+
+	spl = splhigh();
+	curcpu->c_counters[ctr] += n;
+	splx(spl);
+}
+
+/*
+ * Total of counter CTR over all cpus. CPUs are only ever added to
+ * allcpus during boot, so we don't need a lock to walk it.
+ */
+unsigned long
+pcpu_read(enum pcpu_counter ctr)
+{
+	unsigned long total;
+	unsigned i;
+
+	KASSERT(ctr < PCPU_NCOUNTERS);
+
+	total = pcpu_bootcounters[ctr];
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		total += cpuarray_get(&allcpus, i)->c_counters[ctr];
+	}
+	return total;
+}
+
+/*
+ * Print every counter, with the total and the per-cpu breakdown.
+ */
+void
+pcpu_printstats(void)
+{
+	unsigned i, j;
+
+	for (i=0; i<PCPU_NCOUNTERS; i++) {
+		kprintf("%-14s %10lu:", pcpu_names[i],
+			pcpu_read((enum pcpu_counter)i));
+		for (j=0; j < cpuarray_num(&allcpus); j++) {
+			kprintf(" %lu",
+				cpuarray_get(&allcpus, j)->c_counters[i]);
+		}
+		kprintf("\n");
+	}
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Machine-independent IPI handling
  */
@@ -1167,12 +2065,58 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown IPI to all other CPUs, and return how many
+ * that was.
+ */
+unsigned
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	unsigned i, n;
+	struct cpu *c;
+
+	n = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, mapping);
+			n++;
+		}
+	}
+	return n;
+}
+
+/*
+ * Send a TLB shootdown IPI to the other CPUs that have AS loaded, and
+ * return how many that was. CPUs that load AS after we look here start
+ * with a flushed TLB, so the caller must already have made sure the
+ * mappings can't be faulted back in.
+ */
+unsigned
+ipi_tlbshootdown_as(struct addrspace *as, const struct tlbshootdown *mapping)
+{
+	unsigned i, n;
+	struct cpu *c;
+
+	n = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self && c->c_curas == as) {
+			ipi_tlbshootdown(c, mapping);
+			n++;
+		}
+	}
+	return n;
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
 void
 interprocessor_interrupt(void)
 {
+	struct tlbshootdown shootdowns[TLBSHOOTDOWN_MAX];
+	unsigned numshootdown;
 	uint32_t bits;
 	unsigned i;
 
@@ -1202,18 +2146,24 @@ interprocessor_interrupt(void)
 		 * interrupt; don't need to do anything else.
 		 */
 	}
+	numshootdown = 0;
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		/*
-		 * Note: depending on your VM system locking you might
-		 * need to release the ipi lock while calling
-		 * vm_tlbshootdown.
+		 * Take the requests and do them after releasing the
+		 * ipi lock: vm_tlbshootdown may wake up the sender,
+		 * and waking a thread can send IPIs of its own.
 		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
+		numshootdown = curcpu->c_numshootdown;
+		for (i=0; i<numshootdown; i++) {
+			shootdowns[i] = curcpu->c_shootdown[i];
 		}
 		curcpu->c_numshootdown = 0;
 	}
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	for (i=0; i<numshootdown; i++) {
+		vm_tlbshootdown(&shootdowns[i]);
+	}
 }
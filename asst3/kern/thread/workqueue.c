@@ -0,0 +1,282 @@
+/*
+ * Deferred work: per-cpu worker threads.
+ *
+ * Each cpu's queue is a lock-free stack of struct work: enqueueing
+ * pushes with compare and swap, and the worker takes the whole stack
+ * at once by swapping in NULL, then reverses it to run the work in
+ * the order it came. Since only the worker ever removes anything, and
+ * it removes everything, the usual ABA trouble with lock-free stacks
+ * can't happen.
+ *
+ * wq_lock is only for sleeping: the worker sets wq_sleeping and then
+ * looks at the queue once more before it sleeps, and an enqueuer
+ * pushes and then looks at wq_sleeping, so at least one of them sees
+ * the other. An enqueuer that sees wq_sleeping takes the lock, which
+ * it can't get until the worker is actually on the wait channel.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <membar.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+
+struct workqueue {
+	void *volatile wq_head;		/* Top of stack of struct work */
+	atomic_t wq_depth;		/* Enqueued and not yet run */
+	atomic_t wq_maxdepth;		/* Most wq_depth has been */
+	struct spinlock wq_lock;
+	struct wchan *wq_wchan;
+	volatile bool wq_sleeping;
+
+	/* Statistics; written only by the worker. */
+	unsigned long wq_done;
+	uint64_t wq_latsum;		/* Total nanoseconds spent queued */
+	uint64_t wq_latmax;
+};
+
+struct workqueue *
+workqueue_create(void)
+{
+	struct workqueue *wq;
+
+	wq = kmalloc(sizeof(*wq));
+	if (wq == NULL) {
+		return NULL;
+	}
+	wq->wq_wchan = wchan_create("workqueue");
+	if (wq->wq_wchan == NULL) {
+		kfree(wq);
+		return NULL;
+	}
+	wq->wq_head = NULL;
+	atomic_set(&wq->wq_depth, 0);
+	atomic_set(&wq->wq_maxdepth, 0);
+	spinlock_init(&wq->wq_lock);
+	wq->wq_sleeping = false;
+	wq->wq_done = 0;
+	wq->wq_latsum = 0;
+	wq->wq_latmax = 0;
+	return wq;
+}
+
+/*
+ * Put W on the current cpu's queue and wake the worker if need be.
+ */
+static
+void
+wq_push(struct work *w)
+{
+	struct workqueue *wq;
+	void *head, *old;
+	int depth, max, seen;
+
+	wq = curcpu->c_workqueue;
+	gettime(&w->w_queued);
+
+	/*
+	 * Count it here rather than when the worker looks, which would
+	 * miss whatever ran in between.
+	 */
+	depth = atomic_fetch_add(&wq->wq_depth, 1) + 1;
+	max = atomic_read(&wq->wq_maxdepth);
+	while (depth > max) {
+		seen = atomic_cas(&wq->wq_maxdepth, max, depth);
+		if (seen == max) {
+			break;
+		}
+		max = seen;
+	}
+
+	head = wq->wq_head;
+	while (1) {
+		w->w_next = head;
+		old = atomic_casptr(&wq->wq_head, head, w);
+		if (old == head) {
+			break;
+		}
+		head = old;
+	}
+
+	if (wq->wq_sleeping) {
+		spinlock_acquire(&wq->wq_lock);
+		wq->wq_sleeping = false;
+		wchan_wakeone(wq->wq_wchan, &wq->wq_lock);
+		spinlock_release(&wq->wq_lock);
+	}
+}
+
+bool
+workqueue_enqueue(struct work *w, void (*func)(void *), void *arg)
+{
+	if (atomic_cas(&w->w_pending, 0, 1) != 0) {
+		return false;
+	}
+	w->w_func = func;
+	w->w_arg = arg;
+	wq_push(w);
+	return true;
+}
+
+/*
+ * Timeout function for the delayed variant; runs in the hardclock
+ * interrupt of the cpu that enqueued W.
+ */
+static
+void
+wq_timeout(void *data)
+{
+	wq_push(data);
+}
+
+bool
+workqueue_enqueue_delayed(struct work *w, void (*func)(void *), void *arg,
+			  unsigned ticks)
+{
+	if (atomic_cas(&w->w_pending, 0, 1) != 0) {
+		return false;
+	}
+	w->w_func = func;
+	w->w_arg = arg;
+	timeout(&w->w_timeout, wq_timeout, w, ticks);
+	return true;
+}
+
+/*
+ * Take everything on the queue, oldest first.
+ */
+static
+struct work *
+wq_takeall(struct workqueue *wq)
+{
+	struct work *list, *w, *next, *prev;
+	void *old;
+
+	list = wq->wq_head;
+	while (list != NULL) {
+		old = atomic_casptr(&wq->wq_head, list, NULL);
+		if (old == list) {
+			break;
+		}
+		list = old;
+	}
+
+	/* The stack is newest first; turn it around. */
+	prev = NULL;
+	for (w = list; w != NULL; w = next) {
+		next = w->w_next;
+		w->w_next = prev;
+		prev = w;
+	}
+	return prev;
+}
+
+/*
+ * Run W and account for it.
+ */
+static
+void
+wq_run(struct workqueue *wq, struct work *w)
+{
+	struct timespec now;
+	void (*func)(void *);
+	void *arg;
+	uint64_t nsecs;
+
+	gettime(&now);
+	timespec_sub(&now, &w->w_queued, &now);
+	nsecs = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	wq->wq_latsum += nsecs;
+	if (nsecs > wq->wq_latmax) {
+		wq->wq_latmax = nsecs;
+	}
+	wq->wq_done++;
+	atomic_sub(&wq->wq_depth, 1);
+
+	func = w->w_func;
+	arg = w->w_arg;
+	/* Full barrier: after this, W belongs to whoever enqueues it. */
+	(void)atomic_cas(&w->w_pending, 1, 0);
+	func(arg);
+}
+
+static
+void
+wq_worker(void *data, unsigned long cpunum)
+{
+	struct workqueue *wq = data;
+	struct work *w, *next;
+	int result;
+
+	result = thread_setaffinity(curthread, 1U << cpunum);
+	if (result) {
+		panic("workqueue: thread_setaffinity: %s\n", strerror(result));
+	}
+	thread_setpriority(0);
+
+	while (1) {
+		w = wq_takeall(wq);
+		if (w == NULL) {
+			spinlock_acquire(&wq->wq_lock);
+			wq->wq_sleeping = true;
+			membar_any_any();
+			if (wq->wq_head == NULL) {
+				wchan_sleep(wq->wq_wchan, &wq->wq_lock);
+			}
+			wq->wq_sleeping = false;
+			spinlock_release(&wq->wq_lock);
+			continue;
+		}
+
+		for (; w != NULL; w = next) {
+			next = w->w_next;
+			wq_run(wq, w);
+		}
+	}
+}
+
+void
+workqueue_bootstrap(void)
+{
+	struct cpu *c;
+	char name[16];
+	unsigned i;
+	int result;
+
+	for (i=0; i < cpu_count(); i++) {
+		c = cpu_get(i);
+		snprintf(name, sizeof(name), "worker/%u", c->c_number);
+		result = thread_fork(name, NULL, wq_worker, c->c_workqueue,
+				     c->c_number);
+		if (result) {
+			panic("workqueue_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+}
+
+void
+workqueue_printstats(void)
+{
+	struct workqueue *wq;
+	unsigned i;
+
+	kprintf("cpu   depth   max depth        done   avg usecs   "
+		"max usecs\n");
+	for (i=0; i < cpu_count(); i++) {
+		wq = cpu_get(i)->c_workqueue;
+		kprintf("%3u %7d %11d %11lu %11llu %11llu\n", i,
+			atomic_read(&wq->wq_depth),
+			atomic_read(&wq->wq_maxdepth),
+			wq->wq_done,
+			wq->wq_done ?
+			(unsigned long long)(wq->wq_latsum / wq->wq_done / 1000)
+			: 0,
+			(unsigned long long)(wq->wq_latmax / 1000));
+	}
+}
@@ -48,8 +48,7 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	KASSERT(ops != NULL);
 
 	vn->vn_ops = ops;
-	vn->vn_refcount = 1;
-	spinlock_init(&vn->vn_countlock);
+	atomic_set(&vn->vn_refcount, 1);
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
 	return 0;
@@ -61,12 +60,10 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 void
 vnode_cleanup(struct vnode *vn)
 {
-	KASSERT(vn->vn_refcount == 1);
-
-	spinlock_cleanup(&vn->vn_countlock);
+	KASSERT(atomic_read(&vn->vn_refcount) == 1);
 
 	vn->vn_ops = NULL;
-	vn->vn_refcount = 0;
+	atomic_set(&vn->vn_refcount, 0);
 	vn->vn_fs = NULL;
 	vn->vn_data = NULL;
 }
@@ -81,9 +78,16 @@ vnode_incref(struct vnode *vn)
 {
 	KASSERT(vn != NULL);
 
-	spinlock_acquire(&vn->vn_countlock);
-	vn->vn_refcount++;
-	spinlock_release(&vn->vn_countlock);
+	atomic_add(&vn->vn_refcount, 1);
+}
+
+/*
+ * Decrement refcount, unless it's 1.
+ */
+bool
+vnode_decref_unless_last(struct vnode *vn)
+{
+	return atomic_add_unless(&vn->vn_refcount, -1, 1);
 }
 
 /*
@@ -94,25 +98,16 @@ vnode_incref(struct vnode *vn)
 void
 vnode_decref(struct vnode *vn)
 {
-	bool destroy;
 	int result;
 
 	KASSERT(vn != NULL);
+	KASSERT(atomic_read(&vn->vn_refcount) > 0);
 
-	spinlock_acquire(&vn->vn_countlock);
-
-	KASSERT(vn->vn_refcount > 0);
-	if (vn->vn_refcount > 1) {
-		vn->vn_refcount--;
-		destroy = false;
-	}
-	else {
-		/* Don't decrement; pass the reference to VOP_RECLAIM. */
-		destroy = true;
-	}
-	spinlock_release(&vn->vn_countlock);
-
-	if (destroy) {
+	/*
+	 * Decrement unless we hold the last reference. If we do,
+	 * don't decrement; pass the reference to VOP_RECLAIM.
+	 */
+	if (!vnode_decref_unless_last(vn)) {
 		result = VOP_RECLAIM(vn);
 		if (result != 0 && result != EBUSY) {
 			// XXX: lame.
@@ -129,6 +124,8 @@ vnode_decref(struct vnode *vn)
 void
 vnode_check(struct vnode *v, const char *opstr)
 {
+	int refcount;
+
 	/* not safe, and not really needed to check constant fields */
 	/*vfs_biglock_acquire();*/
 
@@ -159,20 +156,18 @@ vnode_check(struct vnode *v, const char *opstr)
 		panic("vnode_check: vop_%s: deadbeef fs pointer\n", opstr);
 	}
 
-	spinlock_acquire(&v->vn_countlock);
-
-	if (v->vn_refcount < 0) {
+	refcount = atomic_read(&v->vn_refcount);
+	if (refcount < 0) {
 		panic("vnode_check: vop_%s: negative refcount %d\n", opstr,
-		      v->vn_refcount);
+		      refcount);
 	}
-	else if (v->vn_refcount == 0) {
+	else if (refcount == 0) {
 		panic("vnode_check: vop_%s: zero refcount\n", opstr);
 	}
-	else if (v->vn_refcount > 0x100000) {
+	else if (refcount > 0x100000) {
 		kprintf("vnode_check: vop_%s: warning: large refcount %d\n",
-			opstr, v->vn_refcount);
+			opstr, refcount);
 	}
 
-	spinlock_release(&v->vn_countlock);
 	/*vfs_biglock_release();*/
 }
@@ -32,6 +32,8 @@
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <kcache.h>
 #include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
@@ -48,18 +50,35 @@
  *
  */
 
+// caches for address spaces and their regions; a region is allocated
+// for every segment on every exec and fork so these are hot
+static struct kcache *as_cache;
+static struct kcache *region_cache;
+
+void as_bootstrap(void)
+{
+	as_cache = kcache_create("addrspace", sizeof(struct addrspace),
+				 NULL, NULL);
+	region_cache = kcache_create("region", sizeof(struct region),
+				     NULL, NULL);
+	if (as_cache == NULL || region_cache == NULL) {
+		panic("as_bootstrap: Out of memory\n");
+	}
+}
+
 // initialize virtual address space with no regions
 struct addrspace *
 as_create(void)
 {
 	struct addrspace *as;
 
-	as = kmalloc(sizeof(struct addrspace));
+	as = kcache_alloc(as_cache);
 	if (as == NULL)
 	{
 		return NULL;
 	}
 
+	spinlock_init(&as->as_lock);
 	as->regions = NULL;
 
 	return as;
@@ -80,7 +99,7 @@ int as_copy(struct addrspace *old, struct addrspace **ret)
 	// Copy the regions
 	while (old_region != NULL){
 
-		struct region *temp = kmalloc(sizeof(struct region));
+		struct region *temp = kcache_alloc(region_cache);
 		if (temp == NULL){
 			as_destroy(newas);
 			return ENOMEM;
@@ -121,13 +140,14 @@ void as_destroy(struct addrspace *as)
 	while (temp != NULL)
 	{
 		struct region *next = temp->next;
-		kfree(temp);
+		kcache_free(region_cache, temp);
 		temp = next;
 	}
 
 	remove_HPT((uint32_t)as);
 
-	kfree(as);
+	spinlock_cleanup(&as->as_lock);
+	kcache_free(as_cache, as);
 }
 
 void as_activate(void)
@@ -146,6 +166,8 @@ void as_activate(void)
 	for (int i = 0; i < NUM_TLB; i++){
 		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
 	}
+	// for ipi_tlbshootdown_as
+	curcpu->c_curas = as;
 	splx(spl);
 }
 
@@ -161,6 +183,7 @@ void as_deactivate(void)
 	for (int i=0; i<NUM_TLB; i++) {
 		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
 	}
+	curcpu->c_curas = NULL;
 
 	splx(spl);
 }
@@ -201,7 +224,7 @@ int as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	}
 
 	// Create a new region
-	struct region *new_region = kmalloc(sizeof(struct region));
+	struct region *new_region = kcache_alloc(region_cache);
 	if (new_region == NULL) {
 		return ENOMEM;
 	}
@@ -220,9 +243,45 @@ int as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	}
 
 	// Insert the new region at the start of linked list
+	spinlock_acquire(&as->as_lock);
 	new_region->next = as->regions;
 	as->regions = new_region;
+	spinlock_release(&as->as_lock);
+
+	return 0;
+}
+
+/*
+ * Remove the region at VADDR of size MEMSIZE, which should match one
+ * given to as_define_region, and unmap and free its pages. Other
+ * threads of the process may be running, so the pages go through
+ * vm_unmap, which shoots down the TLB entries everywhere first.
+ */
+int as_remove_region(struct addrspace *as, vaddr_t vaddr, size_t memsize)
+{
+	struct region **prev, *temp;
+
+	KASSERT(vaddr % PAGE_SIZE == 0);
+	KASSERT(memsize % PAGE_SIZE == 0);
+
+	spinlock_acquire(&as->as_lock);
+	prev = &as->regions;
+	while (*prev != NULL) {
+		if ((*prev)->base == vaddr && (*prev)->size == memsize) {
+			break;
+		}
+		prev = &(*prev)->next;
+	}
+	temp = *prev;
+	if (temp == NULL) {
+		spinlock_release(&as->as_lock);
+		return EINVAL;
+	}
+	*prev = temp->next;
+	spinlock_release(&as->as_lock);
 
+	kcache_free(region_cache, temp);
+	vm_unmap(as, vaddr, memsize / PAGE_SIZE);
 	return 0;
 }
 
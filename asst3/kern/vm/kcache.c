@@ -0,0 +1,548 @@
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <kcache.h>
+#include <platform/maxcpus.h>
+
+/*
+ * Object caches. See <kcache.h> for the interface.
+ *
+ * Each slab is one page from alloc_kpages(1). The objects are laid out
+ * from the bottom of the page and the slab header sits at the top, so
+ * the slab owning an object is found by rounding its address. A free
+ * object is linked into its slab's free list through a word placed
+ * just past the end of the object, so the linkage never overwrites
+ * constructed state.
+ *
+ * On top of the slabs each CPU has a small magazine of free objects.
+ * kcache_alloc and kcache_free only touch the current CPU's magazine
+ * (with interrupts off, so we can't be preempted or migrated) unless
+ * it is empty or full, in which case half a magazine is moved to or
+ * from the slabs under the cache lock.
+ *
+ * Allocations made before the first CPU structure exists skip the
+ * magazines and go straight to the slabs.
+ */
+
+/* Magazine size; makes struct kcache_cpu 64 bytes. */
+#define KCACHE_MAGSIZE	13
+#define KCACHE_BATCH	(KCACHE_MAGSIZE / 2 + 1)
+
+struct kcache_cpu {
+	unsigned kcc_count;		/* objects in kcc_objs[] */
+	unsigned kcc_allocs;		/* statistics */
+	unsigned kcc_frees;
+	void *kcc_objs[KCACHE_MAGSIZE];
+};
+
+struct kslab {
+	struct kcache *ks_cache;	/* cache this slab belongs to */
+	struct kslab *ks_next;		/* on kc_slabs or kc_full */
+	struct kslab *ks_prev;
+	void *ks_free;			/* first free object */
+	unsigned ks_inuse;		/* objects not on ks_free */
+};
+
+struct kcache {
+	const char *kc_name;
+	size_t kc_objsize;		/* size requested by the caller */
+	size_t kc_linkoffset;		/* offset of free list link */
+	size_t kc_slotsize;		/* spacing of objects in a slab */
+	unsigned kc_perslab;		/* objects per slab */
+	int (*kc_ctor)(void *);
+	void (*kc_dtor)(void *);
+
+	struct spinlock kc_lock;	/* protects the fields below */
+	struct kslab *kc_slabs;		/* slabs with free objects */
+	struct kslab *kc_full;		/* slabs with no free objects */
+	unsigned kc_nslabs;		/* total slabs */
+	unsigned kc_nempty;		/* slabs with nothing in use */
+	unsigned kc_refills;		/* magazine refills (misses) */
+	unsigned kc_nallocs;		/* allocs/frees without a cpu */
+	unsigned kc_nfrees;
+
+	struct kcache *kc_next;		/* on kcaches, under kcaches_lock */
+
+	struct kcache_cpu kc_cpu[MAXCPUS];
+};
+
+static struct spinlock kcaches_lock = SPINLOCK_INITIALIZER;
+static struct kcache *kcaches;
+
+#define KSLAB_OF(obj) \
+	((struct kslab *)(((vaddr_t)(obj) & PAGE_FRAME) + \
+			  PAGE_SIZE - sizeof(struct kslab)))
+#define KOBJ_LINK(kc, obj) \
+	(*(void **)((char *)(obj) + (kc)->kc_linkoffset))
+
+////////////////////////////////////////////////////////////
+// slab lists
+
+static
+void
+kslab_unlink(struct kslab **head, struct kslab *ks)
+{
+	if (ks->ks_prev != NULL) {
+		ks->ks_prev->ks_next = ks->ks_next;
+	}
+	else {
+		KASSERT(*head == ks);
+		*head = ks->ks_next;
+	}
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks->ks_prev;
+	}
+	ks->ks_next = ks->ks_prev = NULL;
+}
+
+static
+void
+kslab_link(struct kslab **head, struct kslab *ks)
+{
+	ks->ks_prev = NULL;
+	ks->ks_next = *head;
+	if (*head != NULL) {
+		(*head)->ks_prev = ks;
+	}
+	*head = ks;
+}
+
+////////////////////////////////////////////////////////////
+// slab creation and destruction
+
+/*
+ * Get a page and construct a slab's worth of objects in it. Called
+ * without the cache lock, as the constructor may well allocate.
+ */
+static
+struct kslab *
+kslab_create(struct kcache *kc)
+{
+	struct kslab *ks;
+	vaddr_t page;
+	char *obj;
+	unsigned i, j;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+
+	ks = KSLAB_OF(page);
+	ks->ks_cache = kc;
+	ks->ks_next = ks->ks_prev = NULL;
+	ks->ks_free = NULL;
+	ks->ks_inuse = 0;
+
+	/* Build the free list backwards so it comes out in order. */
+	for (i = kc->kc_perslab; i-- > 0; ) {
+		obj = (char *)page + i * kc->kc_slotsize;
+		if (kc->kc_ctor != NULL && kc->kc_ctor(obj) != 0) {
+			for (j = i + 1; j < kc->kc_perslab; j++) {
+				obj = (char *)page + j * kc->kc_slotsize;
+				kc->kc_dtor(obj);
+			}
+			free_kpages(page);
+			return NULL;
+		}
+		KOBJ_LINK(kc, obj) = ks->ks_free;
+		ks->ks_free = obj;
+	}
+	return ks;
+}
+
+/*
+ * Destroy an unused slab. Called without the cache lock.
+ */
+static
+void
+kslab_destroy(struct kcache *kc, struct kslab *ks)
+{
+	vaddr_t page;
+	unsigned i;
+
+	KASSERT(ks->ks_inuse == 0);
+
+	page = (vaddr_t)ks & PAGE_FRAME;
+	if (kc->kc_dtor != NULL) {
+		for (i = 0; i < kc->kc_perslab; i++) {
+			kc->kc_dtor((char *)page + i * kc->kc_slotsize);
+		}
+	}
+	free_kpages(page);
+}
+
+////////////////////////////////////////////////////////////
+// slab-level alloc and free (cache lock held)
+
+static
+void *
+kslab_getobj(struct kcache *kc)
+{
+	struct kslab *ks;
+	void *obj;
+
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+	ks = kc->kc_slabs;
+	if (ks == NULL) {
+		return NULL;
+	}
+	obj = ks->ks_free;
+	KASSERT(obj != NULL);
+	ks->ks_free = KOBJ_LINK(kc, obj);
+	if (ks->ks_inuse++ == 0) {
+		kc->kc_nempty--;
+	}
+	if (ks->ks_free == NULL) {
+		kslab_unlink(&kc->kc_slabs, ks);
+		kslab_link(&kc->kc_full, ks);
+	}
+	return obj;
+}
+
+/*
+ * Put OBJ back in its slab. If that leaves an unused slab and we
+ * already have one spare, unlink it and return it so the caller can
+ * destroy it once the lock is dropped.
+ */
+static
+struct kslab *
+kslab_putobj(struct kcache *kc, void *obj)
+{
+	struct kslab *ks;
+
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+	ks = KSLAB_OF(obj);
+	KASSERT(ks->ks_cache == kc);
+	KASSERT(ks->ks_inuse > 0);
+
+	if (ks->ks_free == NULL) {
+		kslab_unlink(&kc->kc_full, ks);
+		kslab_link(&kc->kc_slabs, ks);
+	}
+	KOBJ_LINK(kc, obj) = ks->ks_free;
+	ks->ks_free = obj;
+
+	if (--ks->ks_inuse > 0) {
+		return NULL;
+	}
+	if (kc->kc_nempty == 0) {
+		kc->kc_nempty++;
+		return NULL;
+	}
+	kslab_unlink(&kc->kc_slabs, ks);
+	kc->kc_nslabs--;
+	return ks;
+}
+
+/*
+ * Add a new slab to the cache. Returns false if out of memory.
+ * Called without the cache lock.
+ */
+static
+bool
+kcache_grow(struct kcache *kc)
+{
+	struct kslab *ks;
+
+	ks = kslab_create(kc);
+	if (ks == NULL) {
+		return false;
+	}
+	spinlock_acquire(&kc->kc_lock);
+	kslab_link(&kc->kc_slabs, ks);
+	kc->kc_nslabs++;
+	kc->kc_nempty++;
+	spinlock_release(&kc->kc_lock);
+	return true;
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+struct kcache *
+kcache_create(const char *name, size_t size,
+	      int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kcache *kc;
+	unsigned i;
+
+	KASSERT(size > 0);
+	KASSERT(ctor == NULL || dtor != NULL);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+
+	kc->kc_name = name;
+	kc->kc_objsize = size;
+	kc->kc_linkoffset = ROUNDUP(size, sizeof(void *));
+	kc->kc_slotsize = ROUNDUP(kc->kc_linkoffset + sizeof(void *), 8);
+	kc->kc_perslab = (PAGE_SIZE - sizeof(struct kslab)) / kc->kc_slotsize;
+	if (kc->kc_perslab == 0) {
+		panic("kcache_create: %s: objects of %u bytes are too big\n",
+		      name, size);
+	}
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+
+	spinlock_init(&kc->kc_lock);
+	kc->kc_slabs = NULL;
+	kc->kc_full = NULL;
+	kc->kc_nslabs = 0;
+	kc->kc_nempty = 0;
+	kc->kc_refills = 0;
+	kc->kc_nallocs = 0;
+	kc->kc_nfrees = 0;
+
+	for (i = 0; i < MAXCPUS; i++) {
+		kc->kc_cpu[i].kcc_count = 0;
+		kc->kc_cpu[i].kcc_allocs = 0;
+		kc->kc_cpu[i].kcc_frees = 0;
+	}
+
+	spinlock_acquire(&kcaches_lock);
+	kc->kc_next = kcaches;
+	kcaches = kc;
+	spinlock_release(&kcaches_lock);
+
+	return kc;
+}
+
+void
+kcache_destroy(struct kcache *kc)
+{
+	struct kcache **p;
+	struct kslab *ks, *dead;
+	struct kcache_cpu *cc;
+	unsigned i;
+
+	spinlock_acquire(&kcaches_lock);
+	for (p = &kcaches; *p != kc; p = &(*p)->kc_next) {
+		KASSERT(*p != NULL);
+	}
+	*p = kc->kc_next;
+	spinlock_release(&kcaches_lock);
+
+	/* Empty every CPU's magazine back into the slabs. */
+	dead = NULL;
+	spinlock_acquire(&kc->kc_lock);
+	for (i = 0; i < MAXCPUS; i++) {
+		cc = &kc->kc_cpu[i];
+		while (cc->kcc_count > 0) {
+			ks = kslab_putobj(kc, cc->kcc_objs[--cc->kcc_count]);
+			if (ks != NULL) {
+				ks->ks_next = dead;
+				dead = ks;
+			}
+		}
+	}
+	if (kc->kc_full != NULL) {
+		panic("kcache_destroy: %s: objects still in use\n",
+		      kc->kc_name);
+	}
+	while (kc->kc_slabs != NULL) {
+		ks = kc->kc_slabs;
+		if (ks->ks_inuse > 0) {
+			panic("kcache_destroy: %s: objects still in use\n",
+			      kc->kc_name);
+		}
+		kslab_unlink(&kc->kc_slabs, ks);
+		ks->ks_next = dead;
+		dead = ks;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	while (dead != NULL) {
+		ks = dead;
+		dead = ks->ks_next;
+		kslab_destroy(kc, ks);
+	}
+
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
+
+void *
+kcache_alloc(struct kcache *kc)
+{
+	struct kcache_cpu *cc;
+	void *obj;
+	unsigned i;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		/* Early boot: no magazines yet. */
+		for (;;) {
+			spinlock_acquire(&kc->kc_lock);
+			obj = kslab_getobj(kc);
+			if (obj != NULL) {
+				kc->kc_nallocs++;
+				spinlock_release(&kc->kc_lock);
+				return obj;
+			}
+			spinlock_release(&kc->kc_lock);
+			if (!kcache_grow(kc)) {
+				return NULL;
+			}
+		}
+	}
+
+	/* Fast path: this CPU's magazine. */
+	spl = splhigh();
+	cc = &kc->kc_cpu[curcpu->c_number];
+	if (cc->kcc_count > 0) {
+		cc->kcc_allocs++;
+		obj = cc->kcc_objs[--cc->kcc_count];
+		splx(spl);
+		return obj;
+	}
+	splx(spl);
+
+	/*
+	 * Refill the magazine with a batch from the slabs. Holding the
+	 * spinlock keeps us on this CPU, but we need to look up curcpu
+	 * again as we may have moved since the check above.
+	 */
+	for (;;) {
+		spinlock_acquire(&kc->kc_lock);
+		obj = kslab_getobj(kc);
+		if (obj != NULL) {
+			break;
+		}
+		spinlock_release(&kc->kc_lock);
+		if (!kcache_grow(kc)) {
+			return NULL;
+		}
+	}
+	cc = &kc->kc_cpu[curcpu->c_number];
+	cc->kcc_allocs++;
+	kc->kc_refills++;
+	for (i = 1; i < KCACHE_BATCH && cc->kcc_count < KCACHE_MAGSIZE; i++) {
+		void *extra;
+
+		extra = kslab_getobj(kc);
+		if (extra == NULL) {
+			break;
+		}
+		cc->kcc_objs[cc->kcc_count++] = extra;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	return obj;
+}
+
+void
+kcache_free(struct kcache *kc, void *obj)
+{
+	struct kcache_cpu *cc;
+	struct kslab *ks, *dead;
+	unsigned i;
+	int spl;
+
+	if (obj == NULL) {
+		return;
+	}
+	KASSERT(KSLAB_OF(obj)->ks_cache == kc);
+
+	dead = NULL;
+	if (!CURCPU_EXISTS()) {
+		spinlock_acquire(&kc->kc_lock);
+		kc->kc_nfrees++;
+		dead = kslab_putobj(kc, obj);
+		spinlock_release(&kc->kc_lock);
+		if (dead != NULL) {
+			kslab_destroy(kc, dead);
+		}
+		return;
+	}
+
+	/* Fast path: room in this CPU's magazine. */
+	spl = splhigh();
+	cc = &kc->kc_cpu[curcpu->c_number];
+	cc->kcc_frees++;
+	if (cc->kcc_count < KCACHE_MAGSIZE) {
+		cc->kcc_objs[cc->kcc_count++] = obj;
+		splx(spl);
+		return;
+	}
+	splx(spl);
+
+	/* Magazine full: send OBJ and a batch from it back to the slabs. */
+	spinlock_acquire(&kc->kc_lock);
+	cc = &kc->kc_cpu[curcpu->c_number];
+	for (i = 0; i < KCACHE_BATCH; i++) {
+		ks = kslab_putobj(kc, obj);
+		if (ks != NULL) {
+			ks->ks_next = dead;
+			dead = ks;
+		}
+		if (cc->kcc_count == 0) {
+			break;
+		}
+		obj = cc->kcc_objs[--cc->kcc_count];
+	}
+	if (i == KCACHE_BATCH) {
+		/* put back the one we took last */
+		cc->kcc_objs[cc->kcc_count++] = obj;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	while (dead != NULL) {
+		ks = dead;
+		dead = ks->ks_next;
+		kslab_destroy(kc, ks);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// statistics
+
+/*
+ * Print a line per cache. The magazines have no lock; each CPU's is
+ * protected only by that CPU turning interrupts off. So the other
+ * CPUs' counters are read while they may be changing, and the totals
+ * are only approximate on a busy system. The output says so, and
+ * "inuse" is kept from going negative when a free is counted before
+ * the matching alloc.
+ */
+void
+kcache_printstats(void)
+{
+	struct kcache *kc;
+	unsigned i, allocs, frees, cached;
+
+	spinlock_acquire(&kcaches_lock);
+
+	kprintf("Object caches (per-cpu counts approximate):\n");
+	kprintf("%-14s %5s %5s %6s %8s %8s %8s %6s %7s\n",
+		"name", "size", "/slab", "slabs", "inuse", "allocs",
+		"frees", "cached", "refills");
+
+	for (kc = kcaches; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		allocs = kc->kc_nallocs;
+		frees = kc->kc_nfrees;
+		cached = 0;
+		for (i = 0; i < MAXCPUS; i++) {
+			allocs += kc->kc_cpu[i].kcc_allocs;
+			frees += kc->kc_cpu[i].kcc_frees;
+			cached += kc->kc_cpu[i].kcc_count;
+		}
+		kprintf("%-14s %5u %5u %6u %8u %8u %8u %6u %7u\n",
+			kc->kc_name, kc->kc_objsize, kc->kc_perslab,
+			kc->kc_nslabs, allocs > frees ? allocs - frees : 0,
+			allocs, frees,
+			cached, kc->kc_refills);
+		spinlock_release(&kc->kc_lock);
+	}
+
+	spinlock_release(&kcaches_lock);
+}
@@ -30,6 +30,7 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <cpu.h>
 #include <vm.h>
 
 /*
@@ -102,6 +103,15 @@ fill_deadbeef(void *vptr, size_t len)
  * LABELS records the allocation site and a generation number for each
  * allocation and is useful for tracking down memory leaks.
  *
+ * PROFILE enables LABELS and also keeps a running total per allocation
+ * site: number of allocations and frees, bytes currently allocated,
+ * and the most bytes ever allocated at once. khprof prints the sites
+ * with the most bytes allocated, along with how much that has changed
+ * since the last khgen. Only subpage blocks are counted; whole-page
+ * allocations carry no label. That leaves out kcache objects (threads,
+ * procs, locks, vnodes, ...), which live in whole-page slabs, so the
+ * khprof command prints the per-cache totals after the table.
+ *
  * On top of these one can enable the following:
  *
  * CHECKBEEF checks that free blocks still contain 0xdeadbeef when
@@ -117,10 +127,18 @@ fill_deadbeef(void *vptr, size_t len)
 #undef SLOWER
 #undef GUARDS
 #undef LABELS
+#undef PROFILE
 
 #undef CHECKBEEF
 #undef CHECKGUARDS
 
+/* PROFILE implies LABELS */
+#ifdef PROFILE
+#ifndef LABELS
+#define LABELS
+#endif
+#endif
+
 ////////////////////////////////////////
 
 #if PAGE_SIZE == 4096
@@ -697,12 +715,166 @@ dump_subpages(unsigned generation)
 
 #endif /* LABELS */
 
+////////////////////////////////////////
+
+#ifdef PROFILE
+
+/*
+ * Per-allocation-site totals, in a small open-addressed hash table
+ * keyed on the label. Sites that don't fit are lumped together under
+ * label 0. All of this is protected by kmalloc_spinlock.
+ */
+
+#define NALLOCSITES 256		/* must be a power of 2 */
+
+struct allocsite {
+	vaddr_t label;		/* call site, or 0 if slot is empty */
+	unsigned allocs;	/* number of blocks allocated */
+	unsigned frees;		/* number of blocks freed */
+	size_t live;		/* bytes currently allocated */
+	size_t peak;		/* maximum value of live */
+	size_t genbase;		/* value of live at last khgen */
+};
+
+static struct allocsite allocsites[NALLOCSITES];
+static struct allocsite overflowsite;
+
+/*
+ * Find (or create) the entry for LABEL.
+ */
+static
+struct allocsite *
+profile_site(vaddr_t label)
+{
+	unsigned i, n;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	i = (label >> 2) % NALLOCSITES;
+	for (n = 0; n < NALLOCSITES; n++) {
+		if (allocsites[i].label == label) {
+			return &allocsites[i];
+		}
+		if (allocsites[i].label == 0) {
+			allocsites[i].label = label;
+			return &allocsites[i];
+		}
+		i = (i + 1) % NALLOCSITES;
+	}
+	return &overflowsite;
+}
+
+static
+void
+profile_alloc(vaddr_t label, size_t blocksize)
+{
+	struct allocsite *site;
+
+	site = profile_site(label);
+	site->allocs++;
+	site->live += blocksize;
+	if (site->live > site->peak) {
+		site->peak = site->live;
+	}
+}
+
+static
+void
+profile_free(vaddr_t label, size_t blocksize)
+{
+	struct allocsite *site;
+
+	site = profile_site(label);
+	KASSERT(site->live >= blocksize);
+	site->frees++;
+	site->live -= blocksize;
+}
+
+static
+void
+profile_nextgeneration(void)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	for (i=0; i<NALLOCSITES; i++) {
+		allocsites[i].genbase = allocsites[i].live;
+	}
+	overflowsite.genbase = overflowsite.live;
+}
+
+static
+void
+profile_printsite(const struct allocsite *site)
+{
+	kprintf("%p %8u %8u %8zu %8zu %8d\n", (void *)site->label,
+		site->allocs, site->frees, site->live, site->peak,
+		(int)(site->live - site->genbase));
+}
+
+/*
+ * Print the TOPN sites with the most bytes allocated, biggest first.
+ * We don't have the stack space to sort a copy of the table, so just
+ * pick the largest remaining site TOPN times.
+ */
+static
+void
+profile_print(unsigned topn)
+{
+	uint32_t printed[NALLOCSITES / 32];
+	unsigned i, n, best;
+	size_t total;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	total = overflowsite.live;
+	for (i=0; i<ARRAYCOUNT(printed); i++) {
+		printed[i] = 0;
+	}
+	for (i=0; i<NALLOCSITES; i++) {
+		total += allocsites[i].live;
+	}
+
+	kprintf("Heap profile: %zu bytes in subpage blocks\n", total);
+	kprintf("%-10s %8s %8s %8s %8s %8s\n",
+		"site", "allocs", "frees", "live", "peak", "delta");
+
+	for (n=0; n<topn; n++) {
+		best = NALLOCSITES;
+		for (i=0; i<NALLOCSITES; i++) {
+			if (allocsites[i].label == 0 ||
+			    (printed[i / 32] & (1U << (i % 32)))) {
+				continue;
+			}
+			if (best == NALLOCSITES ||
+			    allocsites[i].live > allocsites[best].live) {
+				best = i;
+			}
+		}
+		if (best == NALLOCSITES) {
+			break;
+		}
+		printed[best / 32] |= 1U << (best % 32);
+		profile_printsite(&allocsites[best]);
+	}
+	if (overflowsite.allocs > 0) {
+		kprintf("(sites that didn't fit in the table:)\n");
+		profile_printsite(&overflowsite);
+	}
+}
+
+#endif /* PROFILE */
+
 void
 kheap_nextgeneration(void)
 {
 #ifdef LABELS
 	spinlock_acquire(&kmalloc_spinlock);
 	mallocgeneration++;
+#ifdef PROFILE
+	profile_nextgeneration();
+#endif
 	spinlock_release(&kmalloc_spinlock);
 #endif
 }
@@ -720,6 +892,20 @@ kheap_dump(void)
 #endif
 }
 
+void
+kheap_profile(unsigned topn)
+{
+#ifdef PROFILE
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&kmalloc_spinlock);
+	profile_print(topn);
+	spinlock_release(&kmalloc_spinlock);
+#else
+	(void)topn;
+	kprintf("Enable PROFILE in kmalloc.c to use this functionality.\n");
+#endif
+}
+
 void
 kheap_dumpall(void)
 {
@@ -805,6 +991,9 @@ kheap_printstats(void)
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
+	kprintf("kmalloc: %lu calls (%lu whole pages), kfree: %lu calls\n",
+		pcpu_read(PCPU_KMALLOC), pcpu_read(PCPU_KMALLOC_PAGES),
+		pcpu_read(PCPU_KFREE));
 	kprintf("Subpage allocator status:\n");
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
@@ -946,6 +1135,9 @@ subpage_kmalloc(size_t sz
 #ifdef LABELS
 			retptr = establishlabel(retptr, label);
 #endif
+#ifdef PROFILE
+			profile_alloc(label, sizes[blktype]);
+#endif
 
 			checksubpages();
 
@@ -989,6 +1181,9 @@ subpage_kmalloc(size_t sz
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
 	pr->nfree = PAGE_SIZE / sizes[blktype];
 
+	/* Tag the page so kfree can find pr without searching. */
+	kpage_setowner(prpage, pr);
+
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
 	 * using in spring 2001 attempted to optimize this loop and
@@ -1069,17 +1264,14 @@ subpage_kfree(void *ptr)
 	prpage = 0;
 	blktype = 0;
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
+	pr = kpage_getowner(ptraddr & PAGE_FRAME);
+	if (pr == KPAGE_UNTRACKED) {
+		/* No frame table tags; search our pages. */
+		for (pr = allbase; pr; pr = pr->next_all) {
+			prpage = PR_PAGEADDR(pr);
+			if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
+				break;
+			}
 		}
 	}
 
@@ -1089,6 +1281,14 @@ subpage_kfree(void *ptr)
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	/* check for corruption */
+	KASSERT(prpage == (ptraddr & PAGE_FRAME));
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -1102,6 +1302,11 @@ subpage_kfree(void *ptr)
 	checkguardband(ptraddr, smallerblocksize, blocksize);
 #endif
 
+#ifdef PROFILE
+	/* The label sits just below the pointer we handed out. */
+	profile_free(((struct malloclabel *)ptr)[-1].label, sizes[blktype]);
+#endif
+
 	/*
 	 * Clear the block to 0xdeadbeef to make it easier to detect
 	 * uses of dangling pointers.
@@ -1182,6 +1387,8 @@ kmalloc(size_t sz)
 #endif /* __GNUC__ */
 #endif /* LABELS */
 
+	pcpu_add(PCPU_KMALLOC, 1);
+
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
 	if (checksz >= LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
@@ -1189,6 +1396,7 @@ kmalloc(size_t sz)
 
 		/* Round up to a whole number of pages. */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
+		pcpu_add(PCPU_KMALLOC_PAGES, npages);
 		address = alloc_kpages(npages);
 		if (address==0) {
 			return NULL;
@@ -1213,10 +1421,14 @@ kfree(void *ptr)
 {
 	/*
 	 * Try subpage first; if that fails, assume it's a big allocation.
+	 * Either way the page is classified from its frame table tag, so
+	 * this doesn't depend on the size of the heap.
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+	pcpu_add(PCPU_KFREE, 1);
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
@@ -9,14 +9,22 @@
 #include <proc.h>
 #include <current.h>
 #include <spl.h>
+#include <cpu.h>
+#include <synch.h>
 
 /* Place your page table functions here */
 
-static struct spinlock HPT_lock = SPINLOCK_INITIALIZER;
+// every fault takes this, so make it fair between cpus
+static struct spinlock HPT_lock = TICKETLOCK_INITIALIZER;
 
 // another lock for copy
 static struct spinlock HPT_copy_lock = SPINLOCK_INITIALIZER;
 
+// vm_unmap waits for the other cpus' shootdowns on unmap_sem; unmap_lock
+// makes sure only one unmap at a time is counting on it
+static struct lock *unmap_lock;
+static struct semaphore *unmap_sem;
+
 uint32_t hpt_size = 0;
 
 struct HPT *HP_table;
@@ -71,6 +79,9 @@ static paddr_t lookup_HPT(vaddr_t virtual_page_number, struct addrspace *as, uin
 
 			break;
 		}
+		if (HP_table[index].next == -1) {
+			break;
+		}
 		index = HP_table[index].next;
 	}
 	
@@ -79,7 +90,9 @@ static paddr_t lookup_HPT(vaddr_t virtual_page_number, struct addrspace *as, uin
 }   
 
 static int check_valid_translation(vaddr_t faultaddress, struct addrspace *as,uint32_t *dirty){
-	// scan all regions in virtual address space
+	// scan all regions in virtual address space; another thread of the
+	// process may be adding or removing one, so hold the lock
+	spinlock_acquire(&as->as_lock);
 	struct region *temp = as -> regions;
 	while (temp != NULL) {
 		vaddr_t base_address = temp -> base;
@@ -95,6 +108,7 @@ static int check_valid_translation(vaddr_t faultaddress, struct addrspace *as,ui
 				*dirty = TLBLO_DIRTY;
 			}
 
+			spinlock_release(&as->as_lock);
 			return 0;
 		}
 
@@ -102,54 +116,115 @@ static int check_valid_translation(vaddr_t faultaddress, struct addrspace *as,ui
 		temp = temp -> next;
 	}
 
+	spinlock_release(&as->as_lock);
 	return EFAULT;
 }
 
-// scan HPT to insert entry
+// empty an entry. HPT_lock must be held.
+static void clear_HPT_entry(uint32_t index) {
+	HP_table[index].pid = 0;
+	HP_table[index].vpn = 0;
+	HP_table[index].entry_lo = 0;
+	HP_table[index].next = -1;
+	HP_table[index].prev = -1;
+}
+
+// put a new entry at the end of the chain from its hash slot, in the
+// hash slot itself if that's free, otherwise in the next free slot.
+// HPT_lock must be held. Chains only ever hold valid entries (see
+// unlink_HPT_entry), so a free slot is never on anyone's chain.
+static void place_HPT(uint32_t pid, vaddr_t vpn, paddr_t entry_lo) {
+	uint32_t index = (pid ^ (vpn >> 12)) % hpt_size;
+	uint32_t free_entry;
+	int32_t prev = -1;
+
+	if ((HP_table[index].entry_lo & TLBLO_VALID) != 0) {
+		while (HP_table[index].next != -1) {
+			index = HP_table[index].next;
+		}
+		prev = index;
+
+		free_entry = (index + 1) % hpt_size;
+		while ((HP_table[free_entry].entry_lo & TLBLO_VALID) != 0) {
+			free_entry = (free_entry + 1) % hpt_size;
+		}
+		HP_table[index].next = free_entry;
+		index = free_entry;
+	}
+
+	HP_table[index].pid = pid;
+	HP_table[index].vpn = vpn;
+	HP_table[index].entry_lo = entry_lo;
+	HP_table[index].next = -1;
+	HP_table[index].prev = prev;
+}
+
+// take an entry out of the table. HPT_lock must be held.
+//
+// Chains coalesce: an entry placed after a collision can sit in a slot
+// that is some other page's hash slot, and that page's entry then goes
+// further down the same chain. So whatever came after the entry can't
+// just be moved up or left cut off; lookups that start at any of those
+// slots would stop short. Instead, cut the chain here and put each
+// entry that followed back in from scratch. Those belonging to
+// DROP_PID are freed instead (for remove_HPT).
+static void unlink_HPT_entry(uint32_t index, uint32_t drop_pid) {
+	struct HPT entry;
+	int32_t next = HP_table[index].next;
+
+	if (HP_table[index].prev != -1) {
+		HP_table[HP_table[index].prev].next = -1;
+	}
+	clear_HPT_entry(index);
+
+	// the rest of the chain is still valid, so placing won't take
+	// its slots. An entry whose hash slot is further along gets
+	// appended to the end of it and comes round again, by which
+	// time its hash slot has been redone and it lands elsewhere.
+	while (next != -1) {
+		entry = HP_table[next];
+		clear_HPT_entry(next);
+		next = entry.next;
+
+		if (entry.pid == drop_pid) {
+			free_kpages(PADDR_TO_KVADDR(entry.entry_lo & PAGE_FRAME));
+		} else {
+			place_HPT(entry.pid, entry.vpn, entry.entry_lo);
+		}
+	}
+}
+
+// scan HPT to insert entry. If another thread of the process has
+// already mapped the page, the existing entry is returned instead and
+// the caller should free its frame.
 static paddr_t insert_HPT(struct addrspace *as, vaddr_t virtual_page_number, paddr_t frame_number,uint32_t dirty){
 	// get index of entry we want to insert
 	uint32_t index = (((uint32_t )as) ^ (virtual_page_number >> 12)) % hpt_size;
-	
-	uint32_t next_entry = 0;
+	vaddr_t vpn = virtual_page_number & PAGE_FRAME;
+	paddr_t ret;
 
 	// use lock to warp HPT to prevent race condition
 	spinlock_acquire(&HPT_lock);
 
-	// if the first entry is free, there is no collision
-	if ((HP_table[index].entry_lo & TLBLO_VALID) == 0) {
-		next_entry = index;
-		HP_table[next_entry].pid = (uint32_t)as;
-		HP_table[next_entry].vpn = (virtual_page_number & PAGE_FRAME);
-		HP_table[next_entry].entry_lo = (frame_number & PAGE_FRAME) | dirty | TLBLO_VALID;
-		HP_table[next_entry].next = -1;
-		
-		spinlock_release(&HPT_lock);
-		return HP_table[next_entry].entry_lo;
-	}
-
-	// get the last child of linklist and the index where we want to insert an new entry
-	while (HP_table[index].next != -1) {
+	// look for an existing mapping of the page
+	while ((HP_table[index].entry_lo & TLBLO_VALID) != 0) {
+		if (HP_table[index].pid == (uint32_t)as &&
+		    HP_table[index].vpn == vpn) {
+			ret = HP_table[index].entry_lo;
+			spinlock_release(&HPT_lock);
+			return ret;
+		}
+		if (HP_table[index].next == -1) {
+			break;
+		}
 		index = HP_table[index].next;
 	}
 
-	// find an available entry to insert
-	next_entry = (index + hpt_size/2) % hpt_size;
-	while ((HP_table[next_entry].entry_lo & TLBLO_VALID) != 0){
-		next_entry = (2 * next_entry) % hpt_size;
-	}
-
-	// link two entries
-	HP_table[index].next = next_entry;
-
-	// initialize new entry
-	HP_table[next_entry].pid = (uint32_t)as;
-	HP_table[next_entry].vpn = (virtual_page_number & PAGE_FRAME);
-	HP_table[next_entry].entry_lo = (frame_number & PAGE_FRAME) | dirty | TLBLO_VALID;
-	HP_table[next_entry].next = -1;
-
+	ret = (frame_number & PAGE_FRAME) | dirty | TLBLO_VALID;
+	place_HPT((uint32_t)as, vpn, ret);
 	spinlock_release(&HPT_lock);
 
-	return HP_table[next_entry].entry_lo;
+	return ret;
 }
 
 int copy_HPT(uint32_t old, uint32_t new) {
@@ -157,8 +232,17 @@ int copy_HPT(uint32_t old, uint32_t new) {
 	for (uint32_t i = 0; i < hpt_size; i++){
 		// find an entry with old process id
 		if (HP_table[i].pid == old) {
-			vaddr_t old_vpn = HP_table[i].vpn;
-			paddr_t old_entryLo = HP_table[i].entry_lo;
+			// other threads of the process may be faulting pages
+			// in as we go, so take a consistent copy of the entry
+			spinlock_acquire(&HPT_lock);
+			struct HPT entry = HP_table[i];
+			spinlock_release(&HPT_lock);
+			if (entry.pid != old) {
+				continue;
+			}
+
+			vaddr_t old_vpn = entry.vpn;
+			paddr_t old_entryLo = entry.entry_lo;
 			uint32_t dirty = old_entryLo & TLBLO_DIRTY;
 			
 			// allocate a new frame for new process
@@ -166,6 +250,7 @@ int copy_HPT(uint32_t old, uint32_t new) {
 
 			// allocate frame failed
 			if (base == 0){
+				spinlock_release(&HPT_copy_lock);
 				as_destroy((struct addrspace*)new);
 				return EFAULT;
 			}
@@ -190,41 +275,107 @@ int copy_HPT(uint32_t old, uint32_t new) {
 }
 
 void remove_HPT(uint32_t pid) {
-	int32_t next_entry = 0;
 	spinlock_acquire(&HPT_lock);
 	for (uint32_t i = 0; i < hpt_size; i++){
-		if (HP_table[i].pid == pid){
+		if (HP_table[i].pid == pid &&
+		    (HP_table[i].entry_lo & TLBLO_VALID) != 0){
 			paddr_t frame_number = HP_table[i].entry_lo & PAGE_FRAME;
 			free_kpages(PADDR_TO_KVADDR(frame_number));
 
-			if (HP_table[i].next != -1) {
-				// current entry is in the middle of collision chain, remove this 
-				// entry then connect its adjacent nodes
-				next_entry = HP_table[i].next;
-
-				HP_table[i].pid = HP_table[next_entry].pid;
-				HP_table[i].vpn = HP_table[next_entry].vpn;
-				HP_table[i].entry_lo = HP_table[next_entry].entry_lo;
-				HP_table[i].next = HP_table[next_entry].next;
-
-				// delete current node
-				HP_table[next_entry].pid = 0;
-				HP_table[next_entry].vpn = 0;
-				HP_table[next_entry].entry_lo = 0;
-				HP_table[next_entry].next = -1;
-			} else {
-				// current node is at the end of link list
-				HP_table[i].pid = 0;
-				HP_table[i].vpn = 0;
-				HP_table[i].entry_lo = 0;
-				HP_table[i].next = 1;
-			}
+			// our entries later in the chain are freed along
+			// with it; everyone else's are put back, but
+			// never as ours, so the scan can't miss any
+			unlink_HPT_entry(i, pid);
 		}
 	}
 
 	spinlock_release(&HPT_lock);
 }
 
+// remove the entry for one page, returning its frame (or 0 if the page
+// wasn't mapped).
+static paddr_t remove_HPT_entry(uint32_t pid, vaddr_t vpn) {
+	uint32_t index = (pid ^ (vpn >> 12)) % hpt_size;
+	paddr_t frame_number;
+
+	spinlock_acquire(&HPT_lock);
+	while (HP_table[index].pid != pid || HP_table[index].vpn != vpn) {
+		if ((HP_table[index].entry_lo & TLBLO_VALID) == 0 ||
+		    HP_table[index].next == -1) {
+			spinlock_release(&HPT_lock);
+			return 0;
+		}
+		index = HP_table[index].next;
+	}
+	if ((HP_table[index].entry_lo & TLBLO_VALID) == 0) {
+		spinlock_release(&HPT_lock);
+		return 0;
+	}
+	frame_number = HP_table[index].entry_lo & PAGE_FRAME;
+
+	// pid is an address space pointer, so never 0: keep everyone
+	unlink_HPT_entry(index, 0);
+
+	spinlock_release(&HPT_lock);
+	return frame_number;
+}
+
+/*
+ * Unmap NPAGES pages of AS from VADDR and free them. Other threads of
+ * the process may be running on other cpus with the pages in their
+ * TLBs, so: take the pages out of the HPT (so they can't be faulted
+ * back in), shoot down the TLB entries on every cpu that has AS
+ * loaded, and only free the frames once all of those have answered.
+ * Goes a batch of pages at a time so one shootdown covers each batch.
+ */
+#define UNMAP_BATCH 16
+
+void vm_unmap(struct addrspace *as, vaddr_t vaddr, unsigned npages)
+{
+	paddr_t frames[UNMAP_BATCH];
+	struct tlbshootdown ts;
+	unsigned i, n, nframes, nsent;
+	int spl;
+
+	KASSERT(vaddr % PAGE_SIZE == 0);
+
+	lock_acquire(unmap_lock);
+	while (npages > 0) {
+		n = npages < UNMAP_BATCH ? npages : UNMAP_BATCH;
+
+		nframes = 0;
+		for (i = 0; i < n; i++) {
+			paddr_t frame = remove_HPT_entry((uint32_t)as, vaddr + i * PAGE_SIZE);
+			if (frame != 0) {
+				frames[nframes++] = frame;
+			}
+		}
+
+		if (nframes > 0) {
+			ts.ts_vaddr = vaddr;
+			ts.ts_npages = n;
+			ts.ts_done = unmap_sem;
+
+			// don't let this thread move cpus in between
+			spl = splhigh();
+			vm_tlbshootdown(&ts);
+			nsent = ipi_tlbshootdown_as(as, &ts);
+			splx(spl);
+
+			for (i = 0; i < nsent + 1; i++) {
+				P(unmap_sem);
+			}
+			for (i = 0; i < nframes; i++) {
+				free_kpages(PADDR_TO_KVADDR(frames[i]));
+			}
+		}
+
+		vaddr += n * PAGE_SIZE;
+		npages -= n;
+	}
+	lock_release(unmap_lock);
+}
+
 void vm_bootstrap(void)
 {
 	/* Initialise any global components of your VM sub-system here.
@@ -232,14 +383,27 @@ void vm_bootstrap(void)
 		* You may or may not need to add anything here depending what's
 		* provided or required by the assignment spec.
 		*/
+	// set up kseg2 mappings first, the HPT lives there
+	kvm_bootstrap();
+	as_bootstrap();
+
+	unmap_lock = lock_create("vm_unmap");
+	unmap_sem = sem_create("vm_unmap", 0);
+	if (unmap_lock == NULL || unmap_sem == NULL) {
+		panic("vm_bootstrap: Out of memory\n");
+	}
+
 	// get size of ram of compute number of entries for HPT
 	paddr_t ram_size = ram_getsize();
 
 	// get number of entries in HPT
 	hpt_size = 2 * (ram_size / PAGE_SIZE);
 
-	// initialize HPT
-	HP_table = kmalloc(hpt_size * sizeof(struct HPT));
+	// initialize HPT, it doesn't need contiguous frames so use vmalloc
+	HP_table = vmalloc(hpt_size * sizeof(struct HPT));
+	if (HP_table == NULL) {
+		panic("vm_bootstrap: couldn't allocate HPT\n");
+	}
 
 	// initialize each entry
 	for (uint32_t i = 0; i < hpt_size; i++){
@@ -247,11 +411,20 @@ void vm_bootstrap(void)
 		HP_table[i].vpn = 0;
 		HP_table[i].entry_lo = 0;
 		HP_table[i].next = -1;
+		HP_table[i].prev = -1;
 	}
 }
 
 int vm_fault(int faulttype, vaddr_t faultaddress)
 {   
+	pcpu_add(PCPU_VMFAULT, 1);
+
+	// kernel TLB miss on vmalloc'd memory, this can happen with spinlocks
+	// held (e.g. walking the HPT) so kvm_fault doesn't lock anything
+	if (faultaddress >= MIPS_KSEG2) {
+		return kvm_fault(faultaddress);
+	}
+
 	// check read only fault
 	if (faulttype == VM_FAULT_READONLY) {
 		return EFAULT;
@@ -307,6 +480,12 @@ int vm_fault(int faulttype, vaddr_t faultaddress)
 		if (new_entry == 0){
 			return EFAULT;
 		}
+
+		// another thread of the process mapped it first; use theirs
+		if ((new_entry & PAGE_FRAME) != frame_number) {
+			free_kpages(base);
+			frame_number = new_entry & PAGE_FRAME;
+		}
 	}
 
 	// for debug
@@ -328,12 +507,25 @@ int vm_fault(int faulttype, vaddr_t faultaddress)
 }
 
 /*
- * SMP-specific functions.  Unused in our UNSW configuration.
+ * Drop the TLB entries for a range of pages on this CPU, and tell the
+ * sender if it's waiting. Called directly by free_kvpages and vm_unmap
+ * and from the IPI handler on the other CPUs.
  */
 
 void vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("vm tried to do tlb shootdown?!\n");
+	int spl = splhigh();
+	for (unsigned i = 0; i < ts->ts_npages; i++) {
+		vaddr_t vaddr = ts->ts_vaddr + i * PAGE_SIZE;
+		int index = tlb_probe(vaddr & TLBHI_VPAGE, 0);
+		if (index >= 0) {
+			tlb_write(TLBHI_INVALID(index), TLBLO_INVALID(), index);
+		}
+	}
+	splx(spl);
+
+	if (ts->ts_done != NULL) {
+		V(ts->ts_done);
+	}
 }
 
@@ -39,6 +39,7 @@
  * about the kern/ headers.
  */
 #include <kern/fcntl.h>
+#include <kern/futex.h>
 #include <kern/ioctl.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
@@ -147,7 +148,40 @@ ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
+/*
+ * Simplified: this sets the calling thread's priority. PID must be 0
+ * or the caller's own pid (EINVAL otherwise), and PRIO runs from 0
+ * (highest) to 3 (lowest).
+ */
+int setpriority(pid_t pid, int prio);
+/* Run only on the cpus in MASK (bit N for cpu N); PID as for setpriority. */
+int setaffinity(pid_t pid, unsigned mask);
+/*
+ * Join the proportional-share scheduling class with TICKETS tickets
+ * (1-10000), or leave it with 0. PID as for setpriority. All the
+ * ordinary processes on a cpu together count as 100 tickets.
+ */
+int settickets(pid_t pid, int tickets);
+/*
+ * FUTEX_WAIT: sleep until woken, if *UADDR is VAL; fails with EAGAIN
+ * if it isn't. FUTEX_WAKE: wake up to VAL sleepers on UADDR, and
+ * return how many there were.
+ */
+int futex(volatile int *uaddr, int op, int val);
+/*
+ * Threads. thread_create starts FUNC(ARG) in a new thread of this
+ * process and returns its id; returning from FUNC is thread_exit.
+ * thread_join waits for thread TID and collects what it passed to
+ * thread_exit. _exit still ends the whole process, all threads
+ * included. A process can have at most 16 threads.
+ */
+int thread_create(void *(*func)(void *), void *arg);
+int thread_join(int tid, void **ret);
+__DEAD void thread_exit(void *ret);
 ssize_t __getcwd(char *buf, size_t buflen);
+int __thread_create(void (*start)(void *(*)(void *), void *),
+		    void *(*func)(void *), void *arg);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -0,0 +1,56 @@
+#ifndef _USYNC_H_
+#define _USYNC_H_
+
+/*
+ * User-level mutexes and condition variables (libusync).
+ *
+ * These are built on atomic operations on the object itself and only
+ * call into the kernel (with futex()) when a thread has to sleep, or
+ * when one might be sleeping. An uncontended lock and unlock is two
+ * atomic instructions and no system calls; so is a signal or
+ * broadcast with nobody waiting.
+ *
+ * They work between threads of one process. A process's memory isn't
+ * shared with anyone else's, so they can't be used between processes.
+ *
+ * Mutexes:
+ *     umutex_init     - initialize; or use UMUTEX_INITIALIZER.
+ *     umutex_lock     - acquire, sleeping if need be.
+ *     umutex_trylock  - acquire if free; returns 0, or EBUSY if not.
+ *     umutex_unlock   - release.
+ *
+ * Condition variables:
+ *     ucond_init      - initialize; or use UCOND_INITIALIZER.
+ *     ucond_wait      - release the mutex, sleep, and reacquire it.
+ *                       May return without a signal, so the caller
+ *                       should check its condition in a loop.
+ *     ucond_signal    - wake one waiter.
+ *     ucond_broadcast - wake all waiters.
+ *
+ * As with kernel CVs, the mutex must be held for all three, and every
+ * waiter on a given ucond must use the same mutex.
+ */
+
+struct umutex {
+	volatile int um_state;	/* 0 free, 1 held, 2 held with sleepers */
+};
+
+struct ucond {
+	volatile int uc_seq;	/* bumped by each signal; the futex word */
+	int uc_waiters;		/* protected by the mutex */
+};
+
+#define UMUTEX_INITIALIZER	{ 0 }
+#define UCOND_INITIALIZER	{ 0, 0 }
+
+void umutex_init(struct umutex *m);
+void umutex_lock(struct umutex *m);
+int umutex_trylock(struct umutex *m);
+void umutex_unlock(struct umutex *m);
+
+void ucond_init(struct ucond *c);
+void ucond_wait(struct ucond *c, struct umutex *m);
+void ucond_signal(struct ucond *c, struct umutex *m);
+void ucond_broadcast(struct ucond *c, struct umutex *m);
+
+#endif /* _USYNC_H_ */
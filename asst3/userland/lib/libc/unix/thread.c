@@ -0,0 +1,23 @@
+#include <unistd.h>
+
+/*
+ * Where new threads start. The kernel gives a thread a stack and
+ * calls this with the function and argument passed to thread_create,
+ * so that returning from the function exits the thread.
+ */
+static
+void
+thread_start(void *(*func)(void *), void *arg)
+{
+	thread_exit(func(arg));
+}
+
+/*
+ * Create a thread. Uses the system call __thread_create(), which
+ * does all the work.
+ */
+int
+thread_create(void *(*func)(void *), void *arg)
+{
+	return __thread_create(thread_start, func, arg);
+}
@@ -0,0 +1,200 @@
+/*
+ * User-level mutexes and condition variables on top of futex().
+ *
+ * The mutex is the three-state one from Drepper's "Futexes Are
+ * Tricky": 0 is free, 1 is held, and 2 is held with (possibly)
+ * someone asleep. Only an unlock that finds 2 needs to call the
+ * kernel. A thread that has slept relocks with 2, since it can't
+ * tell whether others are still asleep behind it.
+ *
+ * The condition variable is a sequence number. A waiter notes it,
+ * drops the mutex, and sleeps only if it hasn't changed; a signal
+ * bumps it before waking anyone, so a signal that comes between the
+ * unlock and the sleep makes the sleep return at once instead of
+ * being lost.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <usync.h>
+
+/* Wake count for "everyone"; there's no INT_MAX here. */
+#define WAKE_ALL	0x7fffffff
+
+/*
+ * Atomic operations, with LL/SC. Each asm block makes one attempt;
+ * the loops around them retry if the SC failed.
+ */
+
+/* If *P is OLD, set it to NEW. Returns the value *P had. */
+static
+int
+atomic_cas(volatile int *p, int old, int new)
+{
+	int x, y;
+
+	do {
+		y = new;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"bne %0, %3, 1f;"	/*   if (x != old) skip */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			"1:"
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "+r" (y) : "r" (p), "r" (old)
+			: "memory");
+	} while (x == old && y == 0);
+	return x;
+}
+
+/* Set *P to NEW. Returns the value *P had. */
+static
+int
+atomic_swap(volatile int *p, int new)
+{
+	int x, y;
+
+	do {
+		y = new;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "+r" (y) : "r" (p)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+/* Add D to *P. Returns the value *P had. */
+static
+int
+atomic_add(volatile int *p, int d)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"addu %1, %0, %3;"	/*   y = x + d */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (d)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+/* Full memory barrier. */
+static
+void
+membar(void)
+{
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		"sync;"			/* do it */
+		".set pop"		/* restore assembler mode */
+		: : : "memory");
+}
+
+////////////////////////////////////////////////////////////
+// mutexes
+
+void
+umutex_init(struct umutex *m)
+{
+	m->um_state = 0;
+}
+
+void
+umutex_lock(struct umutex *m)
+{
+	if (atomic_cas(&m->um_state, 0, 1) != 0) {
+		while (atomic_swap(&m->um_state, 2) != 0) {
+			futex(&m->um_state, FUTEX_WAIT, 2);
+		}
+	}
+	membar();
+}
+
+int
+umutex_trylock(struct umutex *m)
+{
+	if (atomic_cas(&m->um_state, 0, 1) != 0) {
+		return EBUSY;
+	}
+	membar();
+	return 0;
+}
+
+void
+umutex_unlock(struct umutex *m)
+{
+	membar();
+	if (atomic_add(&m->um_state, -1) != 1) {
+		m->um_state = 0;
+		futex(&m->um_state, FUTEX_WAKE, 1);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// condition variables
+
+void
+ucond_init(struct ucond *c)
+{
+	c->uc_seq = 0;
+	c->uc_waiters = 0;
+}
+
+void
+ucond_wait(struct ucond *c, struct umutex *m)
+{
+	int seq;
+
+	seq = c->uc_seq;
+	c->uc_waiters++;
+	umutex_unlock(m);
+
+	futex(&c->uc_seq, FUTEX_WAIT, seq);
+
+	while (atomic_swap(&m->um_state, 2) != 0) {
+		futex(&m->um_state, FUTEX_WAIT, 2);
+	}
+	membar();
+	c->uc_waiters--;
+}
+
+void
+ucond_signal(struct ucond *c, struct umutex *m)
+{
+	(void)m;
+	if (c->uc_waiters > 0) {
+		atomic_add(&c->uc_seq, 1);
+		futex(&c->uc_seq, FUTEX_WAKE, 1);
+	}
+}
+
+/*
+ * There's no requeue operation, so everyone wakes up and contends for
+ * the mutex. Fine for the small thread counts we have.
+ */
+void
+ucond_broadcast(struct ucond *c, struct umutex *m)
+{
+	(void)m;
+	if (c->uc_waiters > 0) {
+		atomic_add(&c->uc_seq, 1);
+		futex(&c->uc_seq, FUTEX_WAKE, WAKE_ALL);
+	}
+}
@@ -0,0 +1,123 @@
+/*
+ * futextest - check futex() and the uncontended paths of libusync.
+ *
+ * First checks the futex calls that don't sleep: FUTEX_WAIT on a word
+ * that doesn't hold the given value fails with EAGAIN, FUTEX_WAKE
+ * with nobody asleep wakes nobody, and bad arguments get EINVAL.
+ * Then checks that a held umutex can't be taken again, and times
+ * NLOOPS uncontended lock/unlock pairs against NLOOPS getpid calls,
+ * to show that the former never enter the kernel.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+#include <usync.h>
+
+#define NLOOPS	100000
+
+static
+unsigned long
+elapsed_usec(time_t secs0, unsigned long nsecs0)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (secs - secs0) * 1000000 + nsecs / 1000 - nsecs0 / 1000;
+}
+
+static
+void
+checkcalls(void)
+{
+	volatile int word[2] = { 5, 0 };
+	int r;
+
+	r = futex(&word[0], FUTEX_WAIT, 4);
+	if (r != -1 || errno != EAGAIN) {
+		errx(1, "FUTEX_WAIT on a changed word: got %d, errno %d", r,
+		     errno);
+	}
+	r = futex(&word[0], FUTEX_WAKE, 1);
+	if (r != 0) {
+		errx(1, "FUTEX_WAKE with nobody asleep woke %d", r);
+	}
+	r = futex((volatile int *)((volatile char *)word + 1),
+		  FUTEX_WAKE, 1);
+	if (r != -1 || errno != EINVAL) {
+		errx(1, "futex on a misaligned address: got %d", r);
+	}
+	r = futex(&word[0], 42, 0);
+	if (r != -1 || errno != EINVAL) {
+		errx(1, "futex with a bad op: got %d", r);
+	}
+	r = futex(NULL, FUTEX_WAIT, 0);
+	if (r != -1 || errno != EFAULT) {
+		errx(1, "FUTEX_WAIT on NULL: got %d", r);
+	}
+	printf("futextest: system calls ok\n");
+}
+
+static
+void
+checkmutex(void)
+{
+	struct umutex m = UMUTEX_INITIALIZER;
+	struct ucond c = UCOND_INITIALIZER;
+
+	umutex_lock(&m);
+	if (umutex_trylock(&m) != EBUSY) {
+		errx(1, "umutex_trylock got a held mutex");
+	}
+	/* Nobody is waiting, so these shouldn't do anything. */
+	ucond_signal(&c, &m);
+	ucond_broadcast(&c, &m);
+	umutex_unlock(&m);
+
+	if (umutex_trylock(&m) != 0) {
+		errx(1, "umutex_trylock failed on a free mutex");
+	}
+	umutex_unlock(&m);
+	if (m.um_state != 0) {
+		errx(1, "mutex state %d after unlock", m.um_state);
+	}
+	printf("futextest: mutex ok\n");
+}
+
+static
+void
+timeit(void)
+{
+	struct umutex m = UMUTEX_INITIALIZER;
+	time_t secs;
+	unsigned long nsecs, mutexusec, syscallusec;
+	unsigned i;
+
+	__time(&secs, &nsecs);
+	for (i=0; i<NLOOPS; i++) {
+		umutex_lock(&m);
+		umutex_unlock(&m);
+	}
+	mutexusec = elapsed_usec(secs, nsecs);
+
+	__time(&secs, &nsecs);
+	for (i=0; i<NLOOPS; i++) {
+		(void)getpid();
+	}
+	syscallusec = elapsed_usec(secs, nsecs);
+
+	printf("%u lock/unlock pairs: %lu usec\n", NLOOPS, mutexusec);
+	printf("%u getpid calls:      %lu usec\n", NLOOPS, syscallusec);
+}
+
+int
+main(void)
+{
+	checkcalls();
+	checkmutex();
+	timeit();
+	printf("futextest: passed.\n");
+	return 0;
+}
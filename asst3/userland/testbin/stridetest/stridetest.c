@@ -0,0 +1,168 @@
+/*
+ * stridetest - check the proportional-share (stride) scheduler.
+ *
+ * Forks NWORKERS cpu hogs, pins them all to cpu 0, gives them the
+ * tickets in tickets[] below, and lets them run for RUNSECS seconds.
+ * A worker with 0 tickets stays in the ordinary scheduling class,
+ * which as a whole counts as DEFAULT_TICKETS. Each worker counts how
+ * many chunks of work it got done and reports that through a file;
+ * the parent then checks that each one's share of the total is within
+ * TOLERANCE percentage points of its share of the tickets.
+ *
+ * Run it on an otherwise idle system.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#define NWORKERS	3
+#define RUNSECS		10
+#define DEFAULT_TICKETS	100
+#define TOLERANCE	5	/* percentage points */
+#define CHUNK		1000	/* loop iterations between clock checks */
+
+static const int tickets[NWORKERS] = { 100, 200, 0 };
+
+static
+void
+resultfile(char *buf, size_t len, int n)
+{
+	snprintf(buf, len, "stridetest.%d", n);
+}
+
+/*
+ * Burn cpu until ENDSECS, counting chunks of work, and save the count.
+ * We start counting at STARTSECS so that all the workers have been
+ * forked and are competing before anyone's score counts.
+ */
+static
+void
+worker(int n, time_t startsecs, time_t endsecs)
+{
+	char name[32];
+	volatile unsigned i;
+	unsigned long chunks;
+	time_t secs;
+	unsigned long nsecs;
+	int fd;
+
+	if (tickets[n] > 0 && settickets(0, tickets[n]) < 0) {
+		err(1, "worker %d: settickets", n);
+	}
+
+	do {
+		__time(&secs, &nsecs);
+	} while (secs < startsecs);
+
+	chunks = 0;
+	while (secs < endsecs) {
+		for (i=0; i<CHUNK; i++) {
+			/* nothing */
+		}
+		chunks++;
+		__time(&secs, &nsecs);
+	}
+
+	resultfile(name, sizeof(name), n);
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "worker %d: %s", n, name);
+	}
+	if (write(fd, &chunks, sizeof(chunks)) != sizeof(chunks)) {
+		err(1, "worker %d: %s: write", n, name);
+	}
+	close(fd);
+	_exit(0);
+}
+
+static
+unsigned long
+collect(int n)
+{
+	char name[32];
+	unsigned long chunks;
+	int fd;
+
+	resultfile(name, sizeof(name), n);
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	if (read(fd, &chunks, sizeof(chunks)) != sizeof(chunks)) {
+		errx(1, "%s: short read", name);
+	}
+	close(fd);
+	remove(name);
+	return chunks;
+}
+
+int
+main(void)
+{
+	pid_t pids[NWORKERS];
+	unsigned long chunks[NWORKERS], total;
+	unsigned totaltickets, want, got;
+	time_t secs;
+	unsigned long nsecs;
+	int i, status, failures;
+
+	/* Shares are per cpu, so put everyone on the same one. */
+	if (setaffinity(0, 1) < 0) {
+		err(1, "setaffinity");
+	}
+
+	__time(&secs, &nsecs);
+	secs += 2;
+
+	for (i=0; i<NWORKERS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			worker(i, secs, secs + RUNSECS);
+		}
+	}
+
+	for (i=0; i<NWORKERS; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "worker %d failed", i);
+		}
+	}
+
+	totaltickets = 0;
+	total = 0;
+	for (i=0; i<NWORKERS; i++) {
+		totaltickets += tickets[i] > 0 ? tickets[i] : DEFAULT_TICKETS;
+		chunks[i] = collect(i);
+		total += chunks[i];
+	}
+	if (total == 0) {
+		errx(1, "No work got done");
+	}
+
+	failures = 0;
+	for (i=0; i<NWORKERS; i++) {
+		want = (tickets[i] > 0 ? tickets[i] : DEFAULT_TICKETS)
+			* 100 / totaltickets;
+		got = chunks[i] * 100 / total;
+		printf("worker %d: %5d tickets, %8lu chunks, "
+		       "%3u%% (expected %3u%%)\n",
+		       i, tickets[i], chunks[i], got, want);
+		if (got + TOLERANCE < want || got > want + TOLERANCE) {
+			failures++;
+		}
+	}
+
+	if (failures) {
+		errx(1, "FAILED: %d shares out of tolerance", failures);
+	}
+	printf("stridetest: passed.\n");
+	return 0;
+}